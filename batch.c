@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+
+struct worker_state {
+	struct job *jobs;
+	int n_jobs;
+	atomic_int next;
+};
+
+static bool valid_name(const char *name);
+static void *worker(void *data);
+static void dither_job(struct job *job);
+
+/*
+ * Read a region spec: one region per line, as
+ *
+ *   name x y width height [area]
+ *
+ * with blank lines and lines starting with # ignored. Names are used for
+ * labels and filenames, so may only contain letters, digits and
+ * underscores, as may area names.
+ */
+struct region *load_regions(const char *filename, int *n_regions)
+{
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "Couldn't open %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	struct region *regions = NULL;
+	int n = 0;
+	int size = 0;
+	char line[256];
+	int line_no = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		line_no++;
+		char *start = line;
+		while (isspace((unsigned char)*start)) {
+			start++;
+		}
+		if (*start == '\0' || *start == '#') {
+			continue;
+		}
+		if (n == size) {
+			size = size ? 2 * size : 16;
+			regions = realloc(regions, size * sizeof(*regions));
+		}
+		struct region *r = &regions[n];
+		char name[MAX_REGION_NAME];
+		char area[MAX_REGION_NAME] = "";
+		unsigned int x, y, w, h;
+		int n_fields = sscanf(start, "%63s %u %u %u %u %63s", name, &x, &y, &w, &h, area);
+		if (n_fields < 5
+				|| !valid_name(name) || !valid_name(area)
+				|| x > UINT16_MAX || y > UINT16_MAX
+				|| w > UINT16_MAX || h > UINT16_MAX) {
+			fprintf(stderr, "%s:%d: Invalid region.\n", filename, line_no);
+			free(regions);
+			fclose(fp);
+			return NULL;
+		}
+		for (int i = 0; i < n; i++) {
+			if (strcmp(regions[i].name, name) == 0) {
+				fprintf(stderr, "%s:%d: Duplicate region \"%s\".\n", filename, line_no, name);
+				free(regions);
+				fclose(fp);
+				return NULL;
+			}
+		}
+		memcpy(r->name, name, sizeof(r->name));
+		memcpy(r->area, area, sizeof(r->area));
+		r->x = x;
+		r->y = y;
+		r->width = w;
+		r->height = h;
+		n++;
+	}
+	fclose(fp);
+	if (n == 0) {
+		fprintf(stderr, "No regions in %s.\n", filename);
+		free(regions);
+		return NULL;
+	}
+	*n_regions = n;
+	return regions;
+}
+
+/*
+ * Convert every job, spread over up to n_threads threads. Results are
+ * left in each job for the caller to output in order.
+ */
+void run_jobs(struct job *jobs, int n_jobs, int n_threads)
+{
+	struct worker_state state = {
+		.jobs = jobs,
+		.n_jobs = n_jobs,
+		.next = 0
+	};
+	if (n_threads > n_jobs) {
+		n_threads = n_jobs;
+	}
+	if (n_threads <= 1) {
+		worker(&state);
+		return;
+	}
+
+	pthread_t *threads = calloc(n_threads, sizeof(*threads));
+	int n_started = 0;
+	for (int i = 0; i < n_threads; i++) {
+		if (pthread_create(&threads[i], NULL, worker, &state) != 0) {
+			break;
+		}
+		n_started++;
+	}
+	/* If no threads could be started, do the work here instead. */
+	if (n_started == 0) {
+		worker(&state);
+	}
+	for (int i = 0; i < n_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+}
+
+bool valid_name(const char *name)
+{
+	for (const char *c = name; *c; c++) {
+		if (!isalnum((unsigned char)*c) && *c != '_') {
+			return false;
+		}
+	}
+	return true;
+}
+
+void *worker(void *data)
+{
+	struct worker_state *state = data;
+	int i;
+	while ((i = atomic_fetch_add(&state->next, 1)) < state->n_jobs) {
+		struct job *job = &state->jobs[i];
+		if (job->dither != DITHER_NONE) {
+			dither_job(job);
+		}
+		if (job->chunk_width) {
+			job->ok = split_chunks(&job->bitmap, &job->opts, job->chunk_width, job->chunk_height, &job->chunking);
+		} else {
+			job->ok = convert(&job->bitmap, &job->opts, &job->conv);
+			if (job->ok && job->dmg_output) {
+				job->ok = convert_dmg(&job->bitmap, &job->conv, job->sgb_output, job->opts.quiet, &job->dmg);
+				if (!job->ok) {
+					conversion_destroy(&job->conv);
+				}
+			}
+		}
+		if (!job->ok && job->name) {
+			fprintf(stderr, "Failed to convert region %s.\n", job->name);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Dither a copy of the job's pixels, so that each region gets palettes of
+ * its own and overlapping regions don't dither each other's pixels.
+ */
+void dither_job(struct job *job)
+{
+	struct bitmap copy = {
+		.stride = job->bitmap.width,
+		.width = job->bitmap.width,
+		.height = job->bitmap.height
+	};
+	copy.data = malloc((size_t)copy.width * copy.height * sizeof(*copy.data));
+	for (uint32_t y = 0; y < copy.height; y++) {
+		memcpy(&copy.data[(size_t)y * copy.stride], &job->bitmap.data[(size_t)y * job->bitmap.stride],
+				copy.width * sizeof(*copy.data));
+	}
+	dither_bitmap(&copy, job->dither);
+	job->dithered = copy.data;
+	job->bitmap = copy;
+}
@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "chunk.h"
+#include "convert.h"
+#include "dither.h"
+#include "dmg.h"
+#include "image.h"
+
+#define MAX_REGION_NAME 64
+
+/*
+ * A named rectangle of a larger image, to be converted on its own. area
+ * optionally names the part of the game it belongs to, for reports, and
+ * is empty otherwise.
+ */
+struct region {
+	char name[MAX_REGION_NAME];
+	char area[MAX_REGION_NAME];
+	uint16_t x;
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+};
+
+/*
+ * One conversion in a batch. name is NULL when converting the whole
+ * input image. If chunk_width is set, the image is split into chunks of
+ * screens instead of being converted in one go. If dmg_output is set, a
+ * DMG version is made too, with SGB palettes if sgb_output is also set.
+ * With dither set, the job converts a dithered copy of its pixels, kept
+ * in dithered.
+ */
+struct job {
+	const char *name;
+	struct bitmap bitmap;
+	struct bitmap priority;
+	struct bitmap bank;
+	struct convert_options opts;
+	int chunk_width;
+	int chunk_height;
+	bool dmg_output;
+	bool sgb_output;
+	enum dither_mode dither;
+	uint32_t *dithered;
+	struct conversion conv;
+	struct dmg dmg;
+	struct chunking chunking;
+	bool ok;
+};
+
+struct region *load_regions(const char *filename, int *n_regions);
+void run_jobs(struct job *jobs, int n_jobs, int n_threads);
+
+#endif /* BATCH_H */
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "census.h"
+#include "palette.h"
+#include "tile.h"
+
+static uint8_t mask_flags(const struct bitmap *mask, int tx, int ty, uint8_t flag);
+
+/*
+ * Gather the colours of the image, failing if there are more than
+ * max_colours in total or more than 4 in any tile.
+ */
+bool take_census(const struct bitmap *bitmap, const struct masks *masks, int max_colours, bool quiet, struct census *census)
+{
+	memset(census, 0, sizeof(*census));
+	census->tiles_width = bitmap->width / 8;
+	census->tiles_height = bitmap->height / 8;
+
+	int n_tiles = census->tiles_width * census->tiles_height;
+	census->tile_colours = calloc(n_tiles, sizeof(*census->tile_colours));
+	census->n_tile_colours = calloc(n_tiles, sizeof(*census->n_tile_colours));
+	census->tile_flags = calloc(n_tiles, sizeof(*census->tile_flags));
+
+	for (int ty = 0; ty < census->tiles_height; ty++) {
+		for (int tx = 0; tx < census->tiles_width; tx++) {
+			uint32_t base_idx = 8 * ty * bitmap->stride + 8 * tx;
+			uint32_t *colours = census->tile_colours[ty * census->tiles_width + tx];
+			colours[0] = bitmap->data[base_idx];
+			int n_colours = 1;
+			for (uint8_t y = 0; y < 8; y++) {
+				const uint32_t *row = &bitmap->data[base_idx + y * bitmap->stride];
+				for (uint8_t x = 0; x < 8; x++) {
+					uint32_t px = row[x];
+					uint16_t gb = hex_to_gb(px);
+					uint8_t bit = 1u << (gb & 7u);
+					if (!(census->used[gb >> 3u] & bit)) {
+						census->used[gb >> 3u] |= bit;
+						census->n_colours++;
+						if (census->n_colours > max_colours) {
+							if (!quiet) {
+								fprintf(stderr, "Error: More than %d unique colours in image, first extra colour in tile (%d, %d).\n", max_colours, tx, ty);
+							}
+							census_destroy(census);
+							return false;
+						}
+					}
+
+					/*
+					 * Unused slots are zero, so transparent black
+					 * always matches, as it did in the original scan.
+					 */
+					int c_idx = -1;
+					for (int i = 0; i < 4; i++) {
+						if (px == colours[i]) {
+							c_idx = i;
+							break;
+						}
+					}
+					if (c_idx < 0) {
+						if (n_colours == 4) {
+							if (!quiet) {
+								fprintf(stderr, "Error: More than 4 colours in tile (%d, %d).\n", tx, ty);
+								fprintf(stderr, "0: 0x%08X\n", colours[0]);
+								fprintf(stderr, "1: 0x%08X\n", colours[1]);
+								fprintf(stderr, "2: 0x%08X\n", colours[2]);
+								fprintf(stderr, "3: 0x%08X\n", colours[3]);
+								fprintf(stderr, "4: 0x%08X\n", px);
+							}
+							census_destroy(census);
+							return false;
+						}
+						colours[n_colours] = px;
+						n_colours++;
+					}
+				}
+			}
+			census->n_tile_colours[ty * census->tiles_width + tx] = n_colours;
+			if (masks) {
+				census->tile_flags[ty * census->tiles_width + tx] =
+					mask_flags(masks->priority, tx, ty, ATTR_PRIORITY)
+					| mask_flags(masks->bank, tx, ty, ATTR_BANK);
+			}
+		}
+	}
+	return true;
+}
+
+void census_destroy(struct census *census)
+{
+	free(census->tile_colours);
+	free(census->n_tile_colours);
+	free(census->tile_flags);
+	census->tile_colours = NULL;
+	census->n_tile_colours = NULL;
+	census->tile_flags = NULL;
+}
+
+/*
+ * A tile is marked if any of its pixels in the mask is opaque and not
+ * black.
+ */
+uint8_t mask_flags(const struct bitmap *mask, int tx, int ty, uint8_t flag)
+{
+	if (!mask) {
+		return 0;
+	}
+	uint32_t base_idx = 8 * ty * mask->stride + 8 * tx;
+	for (uint8_t y = 0; y < 8; y++) {
+		const uint32_t *row = &mask->data[base_idx + y * mask->stride];
+		for (uint8_t x = 0; x < 8; x++) {
+			if ((row[x] >> 24u) >= 0x80u && (row[x] & 0xFFFFFFu)) {
+				return flag;
+			}
+		}
+	}
+	return 0;
+}
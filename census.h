@@ -0,0 +1,49 @@
+#ifndef CENSUS_H
+#define CENSUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "image.h"
+
+#define N_GB_COLOURS 32768
+#define MAX_UNIQUE_COLOURS 32
+
+/*
+ * Colours used by a whole image, gathered in a single pass before any
+ * per-tile work is done.
+ *
+ * used is a bitset of every RGB555 colour in the image, which the palette
+ * solver numbers to pack colour sets as bitmasks. tile_colours holds
+ * the raw colours of each tile in the order they are first seen, which is
+ * the order the palette search expects them in.
+ *
+ * If mask layers are given, tile_flags holds the attribute bits they
+ * mark for each tile, read in the same pass as the colours.
+ */
+struct census {
+	uint8_t used[N_GB_COLOURS / 8];
+	int n_colours;
+	int tiles_width;
+	int tiles_height;
+	uint32_t (*tile_colours)[4];
+	uint8_t *n_tile_colours;
+	uint8_t *tile_flags;
+};
+
+/*
+ * Optional per-tile mask layers, each the same size as the image.
+ */
+struct masks {
+	const struct bitmap *priority;
+	const struct bitmap *bank;
+};
+
+bool take_census(const struct bitmap *bitmap, const struct masks *masks, int max_colours, bool quiet, struct census *census);
+void census_destroy(struct census *census);
+
+static inline bool census_has_colour(const struct census *census, uint16_t colour)
+{
+	return census->used[colour >> 3u] & (1u << (colour & 7u));
+}
+
+#endif /* CENSUS_H */
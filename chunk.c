@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chunk.h"
+#include "store.h"
+
+#define MAX_CHUNKS 256
+#define MAX_CHUNK_SCREENS 256
+
+/*
+ * Scratch space for a chunk's screens, stacked vertically. The first
+ * n_stacked screens from first are in place.
+ */
+struct stack {
+	struct bitmap bitmap;
+	struct bitmap priority;
+	struct bitmap bank;
+	struct convert_options opts;
+	int first;
+	int n_stacked;
+};
+
+static bool fill_chunks(struct chunking *chunking, const struct bitmap *bitmap, const struct convert_options *opts, bool quiet);
+static void share_tiles(struct chunking *chunking, const struct bitmap *bitmap, const struct convert_options *opts);
+static void stack_init(struct stack *stack, const struct convert_options *opts, int width, int max_height);
+static void stack_screens(struct stack *stack, const struct bitmap *bitmap, const struct convert_options *opts, const struct chunking *chunking, int first, int n);
+static void copy_screen(struct bitmap *dest, const struct bitmap *src, const struct chunking *chunking, int screen, int slot);
+static void stack_destroy(struct stack *stack);
+
+/*
+ * Split the image into chunks of whole width x height tile screens, each
+ * of which fits in VRAM on its own. Each chunk takes the longest run of
+ * screens, in order, that still converts within the budget, so nearby
+ * screens end up sharing tiles and palettes.
+ */
+bool split_chunks(const struct bitmap *bitmap, const struct convert_options *opts, int width, int height, struct chunking *chunking)
+{
+	memset(chunking, 0, sizeof(*chunking));
+	if (bitmap->width % (8 * width) || bitmap->height % (8 * height)) {
+		fprintf(stderr, "Error: A %ux%u image can't be split into %dx%d tile screens.\n",
+				bitmap->width, bitmap->height, width, height);
+		return false;
+	}
+	chunking->screen_width = width;
+	chunking->screen_height = height;
+	chunking->world_width = bitmap->width / (8 * width);
+	chunking->world_height = bitmap->height / (8 * height);
+
+	if (!fill_chunks(chunking, bitmap, opts, false)) {
+		return false;
+	}
+	share_tiles(chunking, bitmap, opts);
+	return true;
+}
+
+/*
+ * Group the screens into chunks, as split_chunks. Unless quiet, the
+ * reason for failing is reported.
+ */
+bool fill_chunks(struct chunking *chunking, const struct bitmap *bitmap, const struct convert_options *opts, bool quiet)
+{
+	int width = chunking->screen_width;
+	int height = chunking->screen_height;
+	int n_world = chunking->world_width * chunking->world_height;
+	chunking->chunks = calloc(n_world, sizeof(*chunking->chunks));
+	chunking->chunk_index = calloc(n_world, sizeof(*chunking->chunk_index));
+	chunking->chunk_slots = calloc(n_world, sizeof(*chunking->chunk_slots));
+
+	struct stack stack;
+	stack_init(&stack, opts, width, n_world * height);
+
+	int first = 0;
+	while (first < n_world) {
+		if (chunking->n_chunks == MAX_CHUNKS) {
+			if (!quiet) {
+				fprintf(stderr, "Error: More than %d chunks needed.\n", MAX_CHUNKS);
+			}
+			stack_destroy(&stack);
+			chunking_destroy(chunking);
+			return false;
+		}
+		struct chunk *chunk = &chunking->chunks[chunking->n_chunks];
+
+		/*
+		 * Find the longest run of screens that fits, doubling its length
+		 * until one doesn't and then bisecting, so that each chunk takes
+		 * O(log n) conversions. n screens are known to fit, and too_many
+		 * not to.
+		 */
+		int max_n = n_world - first < MAX_CHUNK_SCREENS ? n_world - first : MAX_CHUNK_SCREENS;
+		int n = 0;
+		int too_many = max_n + 1;
+		while (n + 1 < too_many) {
+			int attempt = too_many > max_n ? (n ? 2 * n : 1) : (n + too_many) / 2;
+			if (attempt > max_n) {
+				attempt = max_n;
+			}
+			struct conversion conv;
+			stack_screens(&stack, bitmap, opts, chunking, first, attempt);
+			if (!convert(&stack.bitmap, &stack.opts, &conv)) {
+				too_many = attempt;
+				continue;
+			}
+			if (n > 0) {
+				conversion_destroy(&chunk->conv);
+			}
+			chunk->conv = conv;
+			n = attempt;
+		}
+		if (n == 0 && quiet) {
+			stack_destroy(&stack);
+			chunking_destroy(chunking);
+			return false;
+		} else if (n == 0) {
+			int sx = first % chunking->world_width;
+			int sy = first / chunking->world_width;
+			fprintf(stderr, "Error: Screen (%d, %d) doesn't fit in VRAM on its own:\n", sx, sy);
+			/* Convert again to report why. */
+			stack.opts.quiet = false;
+			stack_screens(&stack, bitmap, opts, chunking, first, 1);
+			convert(&stack.bitmap, &stack.opts, &chunk->conv);
+			stack_destroy(&stack);
+			chunking_destroy(chunking);
+			return false;
+		}
+		chunk->first_screen = first;
+		chunk->n_screens = n;
+		if (!dedup_screens(&chunk->conv, width, height, &chunk->screens)) {
+			stack_destroy(&stack);
+			chunking_destroy(chunking);
+			return false;
+		}
+		for (int i = 0; i < n; i++) {
+			chunking->chunk_index[first + i] = chunking->n_chunks;
+			chunking->chunk_slots[first + i] = i;
+		}
+		chunking->n_chunks++;
+		first += n;
+	}
+	stack_destroy(&stack);
+	return true;
+}
+
+/*
+ * Split again with the tiles used by more than one chunk seeded into
+ * every chunk, so that they are loaded once and only the rest change
+ * from chunk to chunk. The first split is kept if that needs more chunks.
+ */
+void share_tiles(struct chunking *chunking, const struct bitmap *bitmap, const struct convert_options *opts)
+{
+	int n_seed = opts ? opts->n_seed_tiles : 0;
+	if (chunking->n_chunks < 2 || n_seed == TILES_PER_BANK) {
+		return;
+	}
+	size_t max_tiles = 0;
+	for (int c = 0; c < chunking->n_chunks; c++) {
+		max_tiles += chunking->chunks[c].conv.n_tiles;
+	}
+
+	/* Count the chunks each tile is in, with last_chunk avoiding repeats. */
+	struct tile_store store;
+	memset(&store, 0, sizeof(store));
+	int *n_chunks = calloc(max_tiles, sizeof(*n_chunks));
+	int *last_chunk = calloc(max_tiles, sizeof(*last_chunk));
+	for (int c = 0; c < chunking->n_chunks; c++) {
+		const struct conversion *conv = &chunking->chunks[c].conv;
+		for (int bank = 0; bank < N_BANKS; bank++) {
+			for (int i = bank ? 0 : n_seed; i < conv->bank_tiles[bank]; i++) {
+				uint8_t flips;
+				uint32_t idx = store_add(&store, &conv->tile_data[16 * (TILES_PER_BANK * bank + i)], &flips);
+				if (last_chunk[idx] != c + 1) {
+					last_chunk[idx] = c + 1;
+					n_chunks[idx]++;
+				}
+			}
+		}
+	}
+
+	uint8_t *seeds = malloc(16 * TILES_PER_BANK);
+	if (n_seed) {
+		memcpy(seeds, opts->seed_tiles, 16 * n_seed);
+	}
+	int n_seeds = n_seed;
+	for (uint32_t idx = 0; idx < store.n_tiles && n_seeds < TILES_PER_BANK; idx++) {
+		if (n_chunks[idx] > 1) {
+			memcpy(&seeds[16 * n_seeds++], store_tile(&store, idx), 16);
+		}
+	}
+	store_destroy(&store);
+	free(n_chunks);
+	free(last_chunk);
+
+	struct convert_options shared_opts;
+	memset(&shared_opts, 0, sizeof(shared_opts));
+	if (opts) {
+		shared_opts = *opts;
+	}
+	shared_opts.seed_tiles = seeds;
+	shared_opts.n_seed_tiles = n_seeds;
+	struct chunking sharing;
+	memset(&sharing, 0, sizeof(sharing));
+	sharing.screen_width = chunking->screen_width;
+	sharing.screen_height = chunking->screen_height;
+	sharing.world_width = chunking->world_width;
+	sharing.world_height = chunking->world_height;
+	if (n_seeds > n_seed && fill_chunks(&sharing, bitmap, &shared_opts, true)) {
+		if (sharing.n_chunks <= chunking->n_chunks) {
+			chunking_destroy(chunking);
+			*chunking = sharing;
+			chunking->n_shared_tiles = n_seeds - n_seed;
+			chunking->shared_tiles = malloc(16 * chunking->n_shared_tiles);
+			memcpy(chunking->shared_tiles, &seeds[16 * n_seed], 16 * chunking->n_shared_tiles);
+		} else {
+			chunking_destroy(&sharing);
+		}
+	}
+	free(seeds);
+}
+
+void chunking_destroy(struct chunking *chunking)
+{
+	for (int i = 0; i < chunking->n_chunks; i++) {
+		conversion_destroy(&chunking->chunks[i].conv);
+		screens_destroy(&chunking->chunks[i].screens);
+	}
+	free(chunking->chunks);
+	free(chunking->chunk_index);
+	free(chunking->chunk_slots);
+	free(chunking->shared_tiles);
+	chunking->chunks = NULL;
+	chunking->chunk_index = NULL;
+	chunking->chunk_slots = NULL;
+	chunking->shared_tiles = NULL;
+	chunking->n_chunks = 0;
+	chunking->n_shared_tiles = 0;
+}
+
+void stack_init(struct stack *stack, const struct convert_options *opts, int width, int max_height)
+{
+	memset(stack, 0, sizeof(*stack));
+	if (opts) {
+		stack->opts = *opts;
+	}
+	stack->opts.quiet = true;
+
+	size_t n_pixels = (size_t)64 * width * max_height;
+	stack->bitmap.data = malloc(n_pixels * sizeof(*stack->bitmap.data));
+	stack->bitmap.width = 8 * width;
+	stack->bitmap.stride = 8 * width;
+	if (stack->opts.masks.priority) {
+		stack->priority = stack->bitmap;
+		stack->priority.data = malloc(n_pixels * sizeof(*stack->priority.data));
+		stack->opts.masks.priority = &stack->priority;
+	}
+	if (stack->opts.masks.bank) {
+		stack->bank = stack->bitmap;
+		stack->bank.data = malloc(n_pixels * sizeof(*stack->bank.data));
+		stack->opts.masks.bank = &stack->bank;
+	}
+}
+
+void stack_screens(struct stack *stack, const struct bitmap *bitmap, const struct convert_options *opts, const struct chunking *chunking, int first, int n)
+{
+	uint32_t height = 8 * n * chunking->screen_height;
+	stack->bitmap.height = height;
+	stack->priority.height = height;
+	stack->bank.height = height;
+
+	/* The screens already in place from earlier attempts can stay. */
+	if (stack->first != first) {
+		stack->first = first;
+		stack->n_stacked = 0;
+	}
+	for (int slot = stack->n_stacked; slot < n; slot++) {
+		copy_screen(&stack->bitmap, bitmap, chunking, first + slot, slot);
+		if (opts && opts->masks.priority) {
+			copy_screen(&stack->priority, opts->masks.priority, chunking, first + slot, slot);
+		}
+		if (opts && opts->masks.bank) {
+			copy_screen(&stack->bank, opts->masks.bank, chunking, first + slot, slot);
+		}
+	}
+	if (n > stack->n_stacked) {
+		stack->n_stacked = n;
+	}
+}
+
+void copy_screen(struct bitmap *dest, const struct bitmap *src, const struct chunking *chunking, int screen, int slot)
+{
+	int width = 8 * chunking->screen_width;
+	int height = 8 * chunking->screen_height;
+	int sx = screen % chunking->world_width;
+	int sy = screen / chunking->world_width;
+	for (int y = 0; y < height; y++) {
+		const uint32_t *row = &src->data[(size_t)(sy * height + y) * src->stride + sx * width];
+		memcpy(&dest->data[(size_t)(slot * height + y) * dest->stride], row, width * sizeof(*row));
+	}
+}
+
+void stack_destroy(struct stack *stack)
+{
+	free(stack->bitmap.data);
+	free(stack->priority.data);
+	free(stack->bank.data);
+}
@@ -0,0 +1,45 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "convert.h"
+#include "image.h"
+#include "screen.h"
+
+/*
+ * A run of consecutive screens that share one set of palettes and tiles.
+ * screens holds the chunk's deduplicated screens, and its world map gives
+ * the screen at each slot.
+ */
+struct chunk {
+	int first_screen;
+	int n_screens;
+	struct conversion conv;
+	struct screens screens;
+};
+
+/*
+ * An image split into chunks, each fitting the tile and palette budget.
+ * Screens are numbered in row-major order; chunk_index gives the chunk
+ * each one is in, and its slot is its number minus the chunk's first.
+ * The n_shared_tiles shared_tiles, used by more than one chunk, are
+ * seeded into every chunk after any seed tiles of the conversion.
+ */
+struct chunking {
+	int screen_width;
+	int screen_height;
+	int world_width;
+	int world_height;
+	int n_chunks;
+	struct chunk *chunks;
+	uint8_t *chunk_index;
+	uint8_t *chunk_slots;
+	uint8_t *shared_tiles;
+	int n_shared_tiles;
+};
+
+bool split_chunks(const struct bitmap *bitmap, const struct convert_options *opts, int width, int height, struct chunking *chunking);
+void chunking_destroy(struct chunking *chunking);
+
+#endif /* CHUNK_H */
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "convert.h"
+#include "solver.h"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static bool assign_palettes(const struct census *census, const struct convert_options *opts, bool quiet, struct conversion *conv);
+static bool place_tile(struct conversion *conv, const uint8_t tile[16], int max_tiles, uint8_t *map, uint8_t *attr);
+
+bool convert(const struct bitmap *bitmap, const struct convert_options *opts, struct conversion *conv)
+{
+	memset(conv, 0, sizeof(*conv));
+	bool quiet = opts && opts->quiet;
+	int max_tiles = (opts && opts->max_tiles) ? opts->max_tiles : MAX_TILES;
+
+	/* Scheduled palettes can show any number of colours in total. */
+	int max_colours = (opts && opts->hblank_writes) ? N_GB_COLOURS : MAX_UNIQUE_COLOURS;
+	struct census census;
+	if (!take_census(bitmap, opts ? &opts->masks : NULL, max_colours, quiet, &census)) {
+		return false;
+	}
+	conv->n_colours = census.n_colours;
+
+	conv->tiles_width = census.tiles_width;
+	conv->tiles_height = census.tiles_height;
+	conv->map_width = MAX(32, census.tiles_width);
+	conv->map_height = MAX(32, census.tiles_height);
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	conv->map = calloc(map_size, sizeof(*conv->map));
+	conv->attributes = calloc(map_size, sizeof(*conv->attributes));
+	conv->tile_data = calloc(16 * MAX_TILES, sizeof(*conv->tile_data));
+	conv->tile_uses = calloc(MAX_TILES, sizeof(*conv->tile_uses));
+	conv->tile_flips = calloc(MAX_TILES, sizeof(*conv->tile_flips));
+	conv->tile_palettes = calloc(MAX_TILES, sizeof(*conv->tile_palettes));
+	if (opts && opts->n_seed_tiles) {
+		memcpy(conv->tile_data, opts->seed_tiles, 16 * opts->n_seed_tiles);
+		conv->n_seed_tiles = opts->n_seed_tiles;
+		conv->bank_tiles[0] = opts->n_seed_tiles;
+		conv->n_tiles = opts->n_seed_tiles;
+	}
+	uint8_t (*instances)[8] = NULL;
+	uint16_t *tile_instances = NULL;
+
+	bool ok;
+	if (opts && opts->hblank_writes) {
+		ok = schedule_palettes(&census, opts->hblank_writes, quiet, conv, &instances, &tile_instances);
+	} else if (opts && opts->solve_ms) {
+		ok = solve_palettes(&census, opts->solve_ms, opts->solve_threads, quiet, conv);
+	} else {
+		ok = assign_palettes(&census, opts, quiet, conv);
+	}
+	census_destroy(&census);
+	if (!ok) {
+		conversion_destroy(conv);
+		return false;
+	}
+
+	for (int ty = 0; ty < conv->tiles_height; ty++) {
+		for (int tx = 0; tx < conv->tiles_width; tx++) {
+			uint32_t base_idx = 8 * ty * bitmap->stride + 8 * tx;
+			uint8_t *map = &conv->map[ty * conv->map_width + tx];
+			uint8_t *attr = &conv->attributes[ty * conv->map_width + tx];
+			uint8_t cur_data[16];
+
+			uint8_t *palette = conv->palettes[*attr & ATTR_PALETTE];
+			if (instances) {
+				palette = instances[tile_instances[ty * conv->tiles_width + tx]];
+			}
+			for (uint8_t y = 0; y < 8; y++) {
+				uint8_t upper = 0;
+				uint8_t lower = 0;
+				for (uint8_t x = 0; x < 8; x++) {
+					uint32_t idx = base_idx + y * bitmap->stride + x;
+					uint32_t px = bitmap->data[idx];
+					int c_idx = colour_in_palette(px, palette);
+					lower <<= 1;
+					upper <<= 1;
+					lower |= c_idx & 1;
+					upper |= (c_idx & 2) >> 1;
+				}
+				cur_data[2 * y] = lower;
+				cur_data[2 * y + 1] = upper;
+			}
+			if (opts && opts->extract) {
+				uint8_t flips;
+				store_add(&conv->store, cur_data, &flips);
+				*attr |= flips;
+				conv->n_tiles = conv->store.n_tiles;
+				continue;
+			}
+			if (!place_tile(conv, cur_data, max_tiles, map, attr)) {
+				if (!quiet && *attr & ATTR_BANK && conv->n_tiles < max_tiles) {
+					fprintf(stderr, "Error: More than %d unique tiles in bank 1, at tile (%d, %d).\n", TILES_PER_BANK, tx, ty);
+				} else if (!quiet) {
+					fprintf(stderr, "Error: More than %d unique tiles, at tile (%d, %d).\n", max_tiles, tx, ty);
+				}
+				free(instances);
+				free(tile_instances);
+				conversion_destroy(conv);
+				return false;
+			}
+			int idx = *map + ((*attr & ATTR_BANK) ? TILES_PER_BANK : 0);
+			conv->tile_uses[idx]++;
+			conv->tile_flips[idx] |= 1u << ((*attr & (ATTR_HFLIP | ATTR_VFLIP)) >> 5u);
+			conv->tile_palettes[idx] |= 1u << (*attr & ATTR_PALETTE);
+		}
+	}
+	free(instances);
+	free(tile_instances);
+	return true;
+}
+
+/*
+ * Greedily assign each tile to the first of the 8 palettes that has or
+ * can take all of its colours, then sort the palettes. Seeded palettes
+ * come first, are treated as full, and keep their order.
+ */
+bool assign_palettes(const struct census *census, const struct convert_options *opts, bool quiet, struct conversion *conv)
+{
+	uint8_t used_colours_in_palettes[MAX_PALETTES] = {0};
+	int n_seeded = opts ? opts->n_seed_palettes : 0;
+	for (int p_idx = 0; p_idx < n_seeded; p_idx++) {
+		memcpy(conv->palettes[p_idx], opts->seed_palettes[p_idx], 8);
+		used_colours_in_palettes[p_idx] = 4;
+	}
+	conv->n_palettes = n_seeded;
+
+	for (int ty = 0; ty < census->tiles_height; ty++) {
+		for (int tx = 0; tx < census->tiles_width; tx++) {
+			int t_idx = ty * census->tiles_width + tx;
+			uint32_t *colours = census->tile_colours[t_idx];
+			int n_colours = census->n_tile_colours[t_idx];
+
+			uint8_t cur_palette[8];
+			hex_to_palette(colours, cur_palette);
+			int p_idx = palette_in_list(cur_palette, n_colours, conv->palettes, used_colours_in_palettes);
+			if (p_idx < 0) {
+				if (!quiet) {
+					fprintf(stderr, "Error: More than %d palettes needed at tile (%d, %d).\n", MAX_PALETTES, tx, ty);
+				}
+				return false;
+			}
+			conv->attributes[ty * conv->map_width + tx] = p_idx | census->tile_flags[t_idx];
+			conv->n_palettes = MAX(conv->n_palettes, p_idx + 1);
+		}
+	}
+	for (int p_idx = n_seeded; p_idx < conv->n_palettes; p_idx++) {
+		sort_palette(conv->palettes[p_idx]);
+	}
+	return true;
+}
+
+void conversion_destroy(struct conversion *conv)
+{
+	free(conv->tile_data);
+	free(conv->map);
+	free(conv->attributes);
+	free(conv->schedule);
+	free(conv->tile_uses);
+	free(conv->tile_flips);
+	free(conv->tile_palettes);
+	store_destroy(&conv->store);
+	conv->tile_uses = NULL;
+	conv->tile_flips = NULL;
+	conv->tile_palettes = NULL;
+	conv->tile_data = NULL;
+	conv->map = NULL;
+	conv->attributes = NULL;
+	conv->schedule = NULL;
+}
+
+/*
+ * Find or add a tile, filling in its map entry and the flip and bank
+ * bits of its attributes. Tiles already marked with ATTR_BANK are kept to
+ * bank 1, others search and fill bank 0 first. New tiles are only added
+ * while there are fewer than max_tiles.
+ */
+bool place_tile(struct conversion *conv, const uint8_t tile[16], int max_tiles, uint8_t *map, uint8_t *attr)
+{
+	int first_bank = (*attr & ATTR_BANK) ? 1 : 0;
+	for (int bank = first_bank; bank < N_BANKS; bank++) {
+		uint8_t flips;
+		const uint8_t *list = &conv->tile_data[16 * TILES_PER_BANK * bank];
+		int idx = tile_in_list(tile, list, conv->bank_tiles[bank], &flips);
+		if (idx >= 0) {
+			*map = idx;
+			*attr |= flips | (bank ? ATTR_BANK : 0);
+			return true;
+		}
+	}
+	if (conv->n_tiles >= max_tiles) {
+		return false;
+	}
+	for (int bank = first_bank; bank < N_BANKS; bank++) {
+		int idx = conv->bank_tiles[bank];
+		if (idx < TILES_PER_BANK) {
+			memcpy(&conv->tile_data[16 * (TILES_PER_BANK * bank + idx)], tile, 16);
+			conv->bank_tiles[bank]++;
+			conv->n_tiles++;
+			*map = idx;
+			*attr |= bank ? ATTR_BANK : 0;
+			return true;
+		}
+	}
+	return false;
+}
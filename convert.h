@@ -0,0 +1,95 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "census.h"
+#include "image.h"
+#include "palette.h"
+#include "raster.h"
+#include "store.h"
+#include "tile.h"
+
+/*
+ * The result of converting one background. The map and attributes are
+ * kept in their final hardware format, and are always at least 32x32
+ * tiles, the size of a hardware BG map. tiles_width and tiles_height are
+ * the size of the image itself, in tiles.
+ *
+ * Tiles go in VRAM bank 0 until it is full, or if the bank mask says
+ * so, in bank 1, in which case their attributes have ATTR_BANK set.
+ * tile_data holds room for both banks back to back, with bank 1 starting
+ * at tile TILES_PER_BANK.
+ *
+ * The first n_seed_tiles tiles of bank 0 are seeded, i.e. already in
+ * VRAM, so aren't output.
+ *
+ * When extracting a tileset, tiles go in store instead, with no limit,
+ * and the map isn't filled in.
+ *
+ * tile_uses, tile_flips and tile_palettes record, for each stored tile,
+ * how many map cells use it, which flips they use (a bit for each
+ * combination of ATTR_HFLIP and ATTR_VFLIP) and which palettes.
+ *
+ * When palettes are scheduled per row, palettes holds the palettes to
+ * load before the frame, and schedule the HBlank writes that change
+ * them, terminated by SCHEDULE_END.
+ */
+struct conversion {
+	int n_colours;
+	uint8_t palettes[MAX_PALETTES][8];
+	int n_palettes;
+	int tiles_width;
+	int tiles_height;
+	uint8_t *tile_data;
+	int n_tiles;
+	int n_seed_tiles;
+	int bank_tiles[N_BANKS];
+	uint32_t *tile_uses;
+	uint8_t *tile_flips;
+	uint8_t *tile_palettes;
+	struct tile_store store;
+	uint8_t *schedule;
+	int schedule_len;
+	int n_raster_palettes;
+	int map_width;
+	int map_height;
+	uint8_t *map;
+	uint8_t *attributes;
+};
+
+/*
+ * max_tiles limits the number of unique tiles, up to MAX_TILES if zero.
+ * quiet suppresses error messages, for trial conversions. If hblank_writes
+ * is set, palettes are scheduled per tile row, with up to that many
+ * colour writes per HBlank.
+ *
+ * Seed tiles, up to TILES_PER_BANK, and seed palettes, up to MAX_PALETTES,
+ * are loaded before the image is processed so that they are reused, for
+ * data that is already resident. Seed palettes can't be scheduled.
+ *
+ * If solve_ms is set, palettes are assigned by the multi-start solver,
+ * searching for up to that many milliseconds on solve_threads threads,
+ * or one per core if zero, instead of greedily.
+ *
+ * extract collects any number of unique tiles into the conversion's
+ * store, for extracting a tileset rather than building a BG.
+ */
+struct convert_options {
+	struct masks masks;
+	int max_tiles;
+	int hblank_writes;
+	const uint8_t *seed_tiles;
+	int n_seed_tiles;
+	const uint8_t (*seed_palettes)[8];
+	int n_seed_palettes;
+	int solve_ms;
+	int solve_threads;
+	bool extract;
+	bool quiet;
+};
+
+bool convert(const struct bitmap *bitmap, const struct convert_options *opts, struct conversion *conv);
+void conversion_destroy(struct conversion *conv);
+
+#endif /* CONVERT_H */
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "deps.h"
+
+/*
+ * The files read and written this run, for a make dependency file. Only
+ * the main thread reads inputs and writes outputs, so there is no
+ * locking.
+ */
+struct file_list {
+	char **names;
+	int n;
+};
+
+static struct file_list inputs;
+static struct file_list outputs;
+
+static void add_file(struct file_list *list, const char *filename);
+static void put_escaped(FILE *fp, const char *filename);
+
+void depend_input(const char *filename)
+{
+	add_file(&inputs, filename);
+}
+
+void depend_output(const char *filename)
+{
+	add_file(&outputs, filename);
+}
+
+/*
+ * Write a make rule with every output, plus target if given, depending on
+ * every input, followed by an empty rule for each input so that make
+ * doesn't fail if one is deleted, like -MP.
+ */
+bool write_depfile(const char *filename, const char *target)
+{
+	FILE *fp = fopen(filename, "w");
+	if (!fp) {
+		fprintf(stderr, "Couldn't open %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	bool first = true;
+	if (target) {
+		put_escaped(fp, target);
+		first = false;
+	}
+	for (int i = 0; i < outputs.n; i++) {
+		if (!first) {
+			fputc(' ', fp);
+		}
+		put_escaped(fp, outputs.names[i]);
+		first = false;
+	}
+	fputc(':', fp);
+	for (int i = 0; i < inputs.n; i++) {
+		fputs(" \\\n  ", fp);
+		put_escaped(fp, inputs.names[i]);
+	}
+	fputc('\n', fp);
+	for (int i = 0; i < inputs.n; i++) {
+		fputc('\n', fp);
+		put_escaped(fp, inputs.names[i]);
+		fputs(":\n", fp);
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Failed to write %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void add_file(struct file_list *list, const char *filename)
+{
+	for (int i = 0; i < list->n; i++) {
+		if (strcmp(list->names[i], filename) == 0) {
+			return;
+		}
+	}
+	list->names = realloc(list->names, (list->n + 1) * sizeof(*list->names));
+	list->names[list->n++] = strdup(filename);
+}
+
+void put_escaped(FILE *fp, const char *filename)
+{
+	for (const char *c = filename; *c; c++) {
+		if (*c == ' ' || *c == '#') {
+			fputc('\\', fp);
+		} else if (*c == '$') {
+			fputc('$', fp);
+		}
+		fputc(*c, fp);
+	}
+}
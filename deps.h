@@ -0,0 +1,10 @@
+#ifndef DEPS_H
+#define DEPS_H
+
+#include <stdbool.h>
+
+void depend_input(const char *filename);
+void depend_output(const char *filename);
+bool write_depfile(const char *filename, const char *target);
+
+#endif /* DEPS_H */
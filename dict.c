@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "dict.h"
+
+#define MIN_CAPACITY 4096u
+
+/* The header's tile count while the table holds tiles not yet written. */
+#define DIRTY UINT32_MAX
+
+static char *join_path(const char *path, const char *extension);
+static bool map_index(struct tile_dict *dict, uint32_t capacity);
+static void rebuild_index(struct tile_dict *dict, uint32_t n_tiles);
+static void insert(struct tile_dict *dict, uint32_t id, const uint8_t tile[16]);
+static const uint8_t *get_tile(const struct tile_dict *dict, uint32_t id);
+
+/*
+ * Open or create the dictionary at path. The index is locked until the
+ * dictionary is closed, so concurrent runs take turns.
+ */
+bool dict_open(const char *path, struct tile_dict *dict)
+{
+	memset(dict, 0, sizeof(*dict));
+	dict->path = path;
+	dict->idx_fd = -1;
+	dict->dat_fd = -1;
+
+	char *dat_path = join_path(path, ".dat");
+	dict->dat_fd = open(dat_path, O_RDWR | O_CREAT, 0644);
+	if (dict->dat_fd < 0) {
+		fprintf(stderr, "Couldn't open %s: %s\n", dat_path, strerror(errno));
+		free(dat_path);
+		return false;
+	}
+	free(dat_path);
+
+	char *idx_path = join_path(path, ".idx");
+	dict->idx_fd = open(idx_path, O_RDWR | O_CREAT, 0644);
+	if (dict->idx_fd < 0) {
+		fprintf(stderr, "Couldn't open %s: %s\n", idx_path, strerror(errno));
+		free(idx_path);
+		close(dict->dat_fd);
+		return false;
+	}
+	free(idx_path);
+	if (flock(dict->idx_fd, LOCK_EX) != 0) {
+		fprintf(stderr, "Couldn't lock the %s dictionary: %s\n", path, strerror(errno));
+		close(dict->idx_fd);
+		close(dict->dat_fd);
+		return false;
+	}
+
+	struct stat st;
+	fstat(dict->dat_fd, &st);
+	dict->n_file_tiles = st.st_size / 16;
+	if (dict->n_file_tiles > 0) {
+		dict->dat = mmap(NULL, 16 * (size_t)dict->n_file_tiles, PROT_READ, MAP_SHARED, dict->dat_fd, 0);
+		if (dict->dat == MAP_FAILED) {
+			fprintf(stderr, "Couldn't map the %s dictionary: %s\n", path, strerror(errno));
+			close(dict->idx_fd);
+			close(dict->dat_fd);
+			return false;
+		}
+	}
+
+	fstat(dict->idx_fd, &st);
+	struct dict_header header;
+	memset(&header, 0, sizeof(header));
+	if ((size_t)st.st_size >= sizeof(header)) {
+		if (pread(dict->idx_fd, &header, sizeof(header), 0) != sizeof(header)) {
+			memset(&header, 0, sizeof(header));
+		}
+	}
+	bool valid = memcmp(header.magic, DICT_MAGIC, 4) == 0
+		&& header.version == DICT_VERSION
+		&& header.n_tiles == dict->n_file_tiles
+		&& header.capacity >= MIN_CAPACITY
+		&& (header.capacity & (header.capacity - 1)) == 0
+		&& (size_t)st.st_size == sizeof(header) + header.capacity * sizeof(uint32_t);
+	uint32_t capacity = valid ? header.capacity : MIN_CAPACITY;
+	while (capacity < 2 * dict->n_file_tiles) {
+		capacity *= 2;
+	}
+	if (!map_index(dict, capacity)) {
+		if (dict->dat) {
+			munmap((void *)dict->dat, 16 * (size_t)dict->n_file_tiles);
+		}
+		close(dict->idx_fd);
+		close(dict->dat_fd);
+		return false;
+	}
+	if (!valid || capacity != header.capacity) {
+		rebuild_index(dict, dict->n_file_tiles);
+	}
+	return true;
+}
+
+/*
+ * Look up a tile in any orientation, adding it if it's new. Returns its
+ * global ID.
+ */
+uint32_t dict_add(struct tile_dict *dict, const uint8_t tile[16], bool *known)
+{
+	uint8_t canonical[16];
+	canonical_tile(tile, canonical);
+	uint32_t mask = dict->header->capacity - 1;
+	for (uint32_t slot = hash_tile(canonical) & mask; dict->slots[slot]; slot = (slot + 1) & mask) {
+		uint32_t id = dict->slots[slot] - 1;
+		if (memcmp(get_tile(dict, id), canonical, 16) == 0) {
+			*known = true;
+			return id;
+		}
+	}
+
+	*known = false;
+	uint32_t id = dict->n_file_tiles + dict->n_new_tiles;
+	if (dict->n_new_tiles == 0) {
+		dict->header->n_tiles = DIRTY;
+		msync(dict->header, sizeof(*dict->header), MS_SYNC);
+	}
+	if ((dict->n_new_tiles & (dict->n_new_tiles - 1)) == 0) {
+		size_t size = dict->n_new_tiles ? 2 * dict->n_new_tiles : 64;
+		dict->new_tiles = realloc(dict->new_tiles, 16 * size);
+	}
+	memcpy(&dict->new_tiles[16 * dict->n_new_tiles], canonical, 16);
+	dict->n_new_tiles++;
+
+	/* Keep the table at most half full. */
+	if (2 * (id + 1) > dict->header->capacity && map_index(dict, 2 * dict->header->capacity)) {
+		rebuild_index(dict, id + 1);
+	} else {
+		insert(dict, id, canonical);
+	}
+	return id;
+}
+
+/*
+ * Add n_tiles tiles, writing their global IDs to ids and adding to the
+ * counts of tiles already known and new.
+ */
+void dict_add_tiles(struct tile_dict *dict, const uint8_t *tiles, int n_tiles, uint32_t *ids, int *n_known, int *n_new)
+{
+	for (int i = 0; i < n_tiles; i++) {
+		bool known;
+		ids[i] = dict_add(dict, &tiles[16 * i], &known);
+		if (known) {
+			(*n_known)++;
+		} else {
+			(*n_new)++;
+		}
+	}
+}
+
+/*
+ * Add a conversion's own tiles, leaving out its seed tiles, and write
+ * their global IDs to ids in the order of its tile data. Returns the
+ * number of IDs.
+ */
+int dict_add_conversion(struct tile_dict *dict, const struct conversion *conv, uint32_t *ids, int *n_known, int *n_new)
+{
+	*n_known = 0;
+	*n_new = 0;
+	int n_own = conv->bank_tiles[0] - conv->n_seed_tiles;
+	dict_add_tiles(dict, &conv->tile_data[16 * conv->n_seed_tiles], n_own, ids, n_known, n_new);
+	dict_add_tiles(dict, &conv->tile_data[16 * TILES_PER_BANK], conv->bank_tiles[1], &ids[n_own], n_known, n_new);
+	return n_own + conv->bank_tiles[1];
+}
+
+/*
+ * Append any new tiles to the data file, and only once they are on disk
+ * mark the index clean again with the new count. The index is marked
+ * dirty as soon as a new tile goes in, so a run killed before then
+ * leaves an index that gets rebuilt. If the write fails, the new tiles
+ * are dropped from the index and the data file.
+ */
+bool dict_close(struct tile_dict *dict)
+{
+	bool ok = true;
+	size_t len = 16 * (size_t)dict->n_new_tiles;
+	if (len > 0) {
+		if (pwrite(dict->dat_fd, dict->new_tiles, len, 16 * (off_t)dict->n_file_tiles) != (ssize_t)len
+				|| fsync(dict->dat_fd) != 0) {
+			fprintf(stderr, "Failed to write the %s dictionary: %s\n", dict->path, strerror(errno));
+			ok = false;
+			if (ftruncate(dict->dat_fd, 16 * (off_t)dict->n_file_tiles) == 0) {
+				rebuild_index(dict, dict->n_file_tiles);
+			}
+		} else {
+			dict->header->n_tiles = dict->n_file_tiles + dict->n_new_tiles;
+		}
+	}
+	msync(dict->header, dict->idx_size, MS_SYNC);
+	munmap(dict->header, dict->idx_size);
+	if (dict->dat) {
+		munmap((void *)dict->dat, 16 * (size_t)dict->n_file_tiles);
+	}
+	free(dict->new_tiles);
+	close(dict->idx_fd);
+	close(dict->dat_fd);
+	dict->header = NULL;
+	dict->new_tiles = NULL;
+	return ok;
+}
+
+char *join_path(const char *path, const char *extension)
+{
+	size_t size = strlen(path) + strlen(extension) + 1;
+	char *str = malloc(size);
+	snprintf(str, size, "%s%s", path, extension);
+	return str;
+}
+
+/*
+ * (Re)size the index file for capacity slots and map it. The slots need
+ * filling in afterwards. On failure, the old mapping is kept.
+ */
+bool map_index(struct tile_dict *dict, uint32_t capacity)
+{
+	size_t size = sizeof(struct dict_header) + capacity * sizeof(uint32_t);
+	if (ftruncate(dict->idx_fd, size) != 0) {
+		fprintf(stderr, "Couldn't resize the %s dictionary index: %s\n", dict->path, strerror(errno));
+		return false;
+	}
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, dict->idx_fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Couldn't map the %s dictionary index: %s\n", dict->path, strerror(errno));
+		return false;
+	}
+	if (dict->header) {
+		munmap(dict->header, dict->idx_size);
+	}
+	dict->idx_size = size;
+	dict->header = map;
+	dict->slots = (uint32_t *)(dict->header + 1);
+	memcpy(dict->header->magic, DICT_MAGIC, 4);
+	dict->header->version = DICT_VERSION;
+	dict->header->capacity = capacity;
+	return true;
+}
+
+/*
+ * Clear the table and insert the first n_tiles tiles again. The index is
+ * only clean if they are all in the data file.
+ */
+void rebuild_index(struct tile_dict *dict, uint32_t n_tiles)
+{
+	memset(dict->slots, 0, dict->header->capacity * sizeof(uint32_t));
+	dict->header->n_tiles = n_tiles == dict->n_file_tiles ? n_tiles : DIRTY;
+	for (uint32_t id = 0; id < n_tiles; id++) {
+		insert(dict, id, get_tile(dict, id));
+	}
+}
+
+void insert(struct tile_dict *dict, uint32_t id, const uint8_t tile[16])
+{
+	uint32_t mask = dict->header->capacity - 1;
+	uint32_t slot = hash_tile(tile) & mask;
+	while (dict->slots[slot]) {
+		slot = (slot + 1) & mask;
+	}
+	dict->slots[slot] = id + 1;
+}
+
+const uint8_t *get_tile(const struct tile_dict *dict, uint32_t id)
+{
+	if (id < dict->n_file_tiles) {
+		return &dict->dat[16 * id];
+	}
+	return &dict->new_tiles[16 * (id - dict->n_file_tiles)];
+}
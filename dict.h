@@ -0,0 +1,53 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "convert.h"
+
+#define DICT_MAGIC "GBTD"
+#define DICT_VERSION 1
+
+struct dict_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t n_tiles;
+	uint32_t capacity;
+};
+
+/*
+ * A tile dictionary shared between conversions, kept on disk as two
+ * files:
+ *
+ *   PATH.dat  every tile ever seen, 16 bytes each, only ever appended to.
+ *             A tile's global ID is its position in this file.
+ *   PATH.idx  a header followed by an open addressing hash table of
+ *             global ID + 1, or 0 for an empty slot, memory-mapped so
+ *             that lookups don't need to read the whole dictionary.
+ *
+ * Tiles are stored in canonical orientation, the smallest of the tile
+ * and its flips, so a tile and its flips share an ID. Tiles added since
+ * opening are held in memory until the dictionary is closed. If the index
+ * doesn't match the data file, e.g. after a crash, it is rebuilt.
+ */
+struct tile_dict {
+	int idx_fd;
+	struct dict_header *header;
+	uint32_t *slots;
+	size_t idx_size;
+	int dat_fd;
+	const uint8_t *dat;
+	uint32_t n_file_tiles;
+	uint8_t *new_tiles;
+	uint32_t n_new_tiles;
+	const char *path;
+};
+
+bool dict_open(const char *path, struct tile_dict *dict);
+uint32_t dict_add(struct tile_dict *dict, const uint8_t tile[16], bool *known);
+void dict_add_tiles(struct tile_dict *dict, const uint8_t *tiles, int n_tiles, uint32_t *ids, int *n_known, int *n_new);
+int dict_add_conversion(struct tile_dict *dict, const struct conversion *conv, uint32_t *ids, int *n_known, int *n_new);
+bool dict_close(struct tile_dict *dict);
+
+#endif /* DICT_H */
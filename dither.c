@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+ * Quantisation of full-colour images to at most 8 palettes of 4 RGB555
+ * colours, with each tile dithered using only its own palette's colours.
+ *
+ * Rows are processed as separate channel arrays. Ordered dithering works
+ * in simple loops over each tile's 8 pixels so that the compiler can
+ * vectorise them. Floyd-Steinberg is scalar: each pixel's quantisation
+ * depends on the error carried from the one before it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "census.h"
+#include "dither.h"
+#include "palette.h"
+
+#define KMEANS_ITERATIONS 4
+
+/*
+ * 4 colours, expanded from RGB555 back to 8 bits per channel. Unused
+ * entries repeat the first colour. spread is roughly the distance between
+ * neighbouring colours, and scales the ordered dither.
+ */
+struct tile_palette {
+	int16_t r[4];
+	int16_t g[4];
+	int16_t b[4];
+	int16_t spread;
+};
+
+/*
+ * The distinct RGB555 colours of a tile, with how often each is used.
+ */
+struct tile_colours {
+	uint16_t colours[64];
+	uint32_t counts[64];
+	int n;
+};
+
+static const uint8_t bayer[8][8] = {
+	{ 0, 32,  8, 40,  2, 34, 10, 42},
+	{48, 16, 56, 24, 50, 18, 58, 26},
+	{12, 44,  4, 36, 14, 46,  6, 38},
+	{60, 28, 52, 20, 62, 30, 54, 22},
+	{ 3, 35, 11, 43,  1, 33,  9, 41},
+	{51, 19, 59, 27, 49, 17, 57, 25},
+	{15, 47,  7, 39, 13, 45,  5, 37},
+	{63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+static void count_colours(const struct bitmap *bitmap, int tx, int ty, struct tile_colours *colours);
+static void choose_palettes(const struct tile_colours *tiles, int n_tiles, int max_palettes, struct tile_palette *palettes, uint8_t *assignment);
+static void dither_tiles(struct bitmap *bitmap, enum dither_mode mode, const struct tile_palette *palettes);
+static bool palettes_pack(const struct bitmap *bitmap);
+static void fit_palette(const uint16_t *colours, const uint32_t *counts, int n, struct tile_palette *palette);
+static uint64_t palette_error(const struct tile_colours *tile, const struct tile_palette *palette);
+static void finish_palette(struct tile_palette *palette, int k);
+static void unpack_row(const uint32_t *row, int width, int16_t *r, int16_t *g, int16_t *b);
+static void quantise_run(const struct tile_palette *palette, const int16_t *r, const int16_t *g, const int16_t *b, int n, uint8_t *idx);
+static uint32_t palette_colour(const struct tile_palette *palette, int i);
+static int16_t expand(int c);
+static int16_t clamp(int32_t v);
+
+void dither_bitmap(struct bitmap *bitmap, enum dither_mode mode)
+{
+	if (mode == DITHER_NONE) {
+		return;
+	}
+	int tiles_width = (bitmap->width + 7) / 8;
+	int tiles_height = (bitmap->height + 7) / 8;
+	int n_tiles = tiles_width * tiles_height;
+	struct tile_colours *tiles = calloc(n_tiles, sizeof(*tiles));
+	for (int ty = 0; ty < tiles_height; ty++) {
+		for (int tx = 0; tx < tiles_width; tx++) {
+			count_colours(bitmap, tx, ty, &tiles[ty * tiles_width + tx]);
+		}
+	}
+
+	/*
+	 * Tiles are later packed into palettes greedily in scan order, which
+	 * can fail even though every tile fits one of the palettes chosen
+	 * here. If so, start again from the original with one palette fewer;
+	 * a single palette always packs.
+	 */
+	size_t size = (size_t)bitmap->height * bitmap->stride * sizeof(*bitmap->data);
+	uint32_t *original = malloc(size);
+	memcpy(original, bitmap->data, size);
+	uint8_t *assignment = calloc(n_tiles, sizeof(*assignment));
+	struct tile_palette *palettes = calloc(n_tiles, sizeof(*palettes));
+	for (int max_palettes = MAX_PALETTES; max_palettes > 0; max_palettes--) {
+		struct tile_palette shared[MAX_PALETTES];
+		choose_palettes(tiles, n_tiles, max_palettes, shared, assignment);
+		for (int i = 0; i < n_tiles; i++) {
+			palettes[i] = shared[assignment[i]];
+		}
+		dither_tiles(bitmap, mode, palettes);
+		if (palettes_pack(bitmap)) {
+			break;
+		}
+		memcpy(bitmap->data, original, size);
+	}
+	free(original);
+	free(assignment);
+	free(palettes);
+	free(tiles);
+}
+
+/*
+ * Dither each row, restricting every pixel to the colours of its tile's
+ * palette.
+ */
+void dither_tiles(struct bitmap *bitmap, enum dither_mode mode, const struct tile_palette *palettes)
+{
+	int tiles_width = (bitmap->width + 7) / 8;
+	int width = bitmap->width;
+	int height = bitmap->height;
+	int16_t *r = calloc(width, sizeof(*r));
+	int16_t *g = calloc(width, sizeof(*g));
+	int16_t *b = calloc(width, sizeof(*b));
+	uint8_t *idx = calloc(width, sizeof(*idx));
+	/* Floyd-Steinberg error for this row and the next, in 1/16ths. */
+	int32_t *err[2][3];
+	for (int i = 0; i < 2; i++) {
+		for (int c = 0; c < 3; c++) {
+			err[i][c] = calloc(width + 2, sizeof(*err[i][c]));
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		uint32_t *row = &bitmap->data[(size_t)y * bitmap->stride];
+		const struct tile_palette *row_palettes = &palettes[(y / 8) * tiles_width];
+		unpack_row(row, width, r, g, b);
+
+		if (mode == DITHER_ORDERED) {
+			for (int x0 = 0; x0 < width; x0 += 8) {
+				const struct tile_palette *palette = &row_palettes[x0 / 8];
+				int n = width - x0 < 8 ? width - x0 : 8;
+				for (int x = 0; x < n; x++) {
+					int16_t offset = ((bayer[y & 7][x] * 2 - 63) * palette->spread) / 128;
+					r[x0 + x] = clamp(r[x0 + x] + offset);
+					g[x0 + x] = clamp(g[x0 + x] + offset);
+					b[x0 + x] = clamp(b[x0 + x] + offset);
+				}
+				quantise_run(palette, &r[x0], &g[x0], &b[x0], n, &idx[x0]);
+				for (int x = 0; x < n; x++) {
+					row[x0 + x] = palette_colour(palette, idx[x0 + x]);
+				}
+			}
+			continue;
+		}
+
+		/* Floyd-Steinberg: add the error carried down from the last row. */
+		int32_t **cur = err[y & 1];
+		int32_t **next = err[(y + 1) & 1];
+		for (int x = 0; x < width; x++) {
+			r[x] = clamp(r[x] + cur[0][x + 1] / 16);
+			g[x] = clamp(g[x] + cur[1][x + 1] / 16);
+			b[x] = clamp(b[x] + cur[2][x + 1] / 16);
+		}
+		for (int c = 0; c < 3; c++) {
+			memset(next[c], 0, (width + 2) * sizeof(*next[c]));
+		}
+		int32_t carry[3] = {0};
+		for (int x = 0; x < width; x++) {
+			const struct tile_palette *palette = &row_palettes[x / 8];
+			int16_t pr = clamp(r[x] + carry[0] / 16);
+			int16_t pg = clamp(g[x] + carry[1] / 16);
+			int16_t pb = clamp(b[x] + carry[2] / 16);
+			uint8_t i;
+			quantise_run(palette, &pr, &pg, &pb, 1, &i);
+			row[x] = palette_colour(palette, i);
+
+			int32_t e[3] = {
+				pr - palette->r[i],
+				pg - palette->g[i],
+				pb - palette->b[i]
+			};
+			for (int c = 0; c < 3; c++) {
+				carry[c] = 7 * e[c];
+				next[c][x] += 3 * e[c];
+				next[c][x + 1] += 5 * e[c];
+				next[c][x + 2] += e[c];
+			}
+		}
+	}
+
+	for (int i = 0; i < 2; i++) {
+		for (int c = 0; c < 3; c++) {
+			free(err[i][c]);
+		}
+	}
+	free(r);
+	free(g);
+	free(b);
+	free(idx);
+}
+
+/*
+ * Whether the dithered tiles pack into MAX_PALETTES palettes the same way
+ * the conversion will assign them.
+ */
+bool palettes_pack(const struct bitmap *bitmap)
+{
+	struct census census;
+	if (!take_census(bitmap, NULL, MAX_UNIQUE_COLOURS, true, &census)) {
+		return false;
+	}
+	uint8_t list[MAX_PALETTES][8] = {{0}};
+	uint8_t used[MAX_PALETTES] = {0};
+	bool ok = true;
+	for (int t = 0; ok && t < census.tiles_width * census.tiles_height; t++) {
+		uint8_t palette[8];
+		hex_to_palette(census.tile_colours[t], palette);
+		ok = palette_in_list(palette, census.n_tile_colours[t], list, used) >= 0;
+	}
+	census_destroy(&census);
+	return ok;
+}
+
+void count_colours(const struct bitmap *bitmap, int tx, int ty, struct tile_colours *colours)
+{
+	int w = bitmap->width - 8 * tx < 8 ? bitmap->width - 8 * tx : 8;
+	int h = bitmap->height - 8 * ty < 8 ? bitmap->height - 8 * ty : 8;
+	colours->n = 0;
+	for (int y = 0; y < h; y++) {
+		const uint32_t *row = &bitmap->data[(size_t)(8 * ty + y) * bitmap->stride + 8 * tx];
+		for (int x = 0; x < w; x++) {
+			/* Round to the nearest RGB555 colour. */
+			uint32_t px = row[x];
+			int cr = (((px >> 0u) & 0xFFu) * 31 + 127) / 255;
+			int cg = (((px >> 8u) & 0xFFu) * 31 + 127) / 255;
+			int cb = (((px >> 16u) & 0xFFu) * 31 + 127) / 255;
+			uint16_t colour = cr | (cg << 5u) | (cb << 10u);
+			int i;
+			for (i = 0; i < colours->n && colours->colours[i] != colour; i++) {
+			}
+			if (i == colours->n) {
+				colours->colours[i] = colour;
+				colours->counts[i] = 0;
+				colours->n++;
+			}
+			colours->counts[i]++;
+		}
+	}
+}
+
+/*
+ * Choose up to max_palettes shared palettes for the whole image, so
+ * that the result still fits in hardware palettes. Each tile starts with
+ * its own best 4 colours; the palettes are seeded with the most different
+ * of these, then refined by alternately assigning each tile to the palette
+ * that fits it best and refitting each palette to its tiles' colours.
+ */
+void choose_palettes(const struct tile_colours *tiles, int n_tiles, int max_palettes, struct tile_palette *palettes, uint8_t *assignment)
+{
+	uint64_t *nearest = malloc(n_tiles * sizeof(*nearest));
+	int n = 0;
+	int next = 0;
+	for (int i = 0; i < n_tiles; i++) {
+		nearest[i] = UINT64_MAX;
+	}
+	while (n < max_palettes && n < n_tiles) {
+		fit_palette(tiles[next].colours, tiles[next].counts, tiles[next].n, &palettes[n]);
+		n++;
+		uint64_t worst = 0;
+		for (int i = 0; i < n_tiles; i++) {
+			uint64_t err = palette_error(&tiles[i], &palettes[n - 1]);
+			if (err < nearest[i]) {
+				nearest[i] = err;
+				assignment[i] = n - 1;
+			}
+			if (nearest[i] > worst) {
+				worst = nearest[i];
+				next = i;
+			}
+		}
+		if (worst == 0) {
+			break;
+		}
+	}
+	free(nearest);
+
+	uint16_t *colours = malloc((size_t)n_tiles * 64 * sizeof(*colours));
+	uint32_t *counts = malloc((size_t)n_tiles * 64 * sizeof(*counts));
+	for (int iter = 0; iter < KMEANS_ITERATIONS; iter++) {
+		for (int p = 0; p < n; p++) {
+			int n_colours = 0;
+			for (int i = 0; i < n_tiles; i++) {
+				if (assignment[i] != p) {
+					continue;
+				}
+				memcpy(&colours[n_colours], tiles[i].colours, tiles[i].n * sizeof(*colours));
+				memcpy(&counts[n_colours], tiles[i].counts, tiles[i].n * sizeof(*counts));
+				n_colours += tiles[i].n;
+			}
+			if (n_colours > 0) {
+				fit_palette(colours, counts, n_colours, &palettes[p]);
+			}
+		}
+		for (int i = 0; i < n_tiles; i++) {
+			uint64_t best = UINT64_MAX;
+			for (int p = 0; p < n; p++) {
+				uint64_t err = palette_error(&tiles[i], &palettes[p]);
+				if (err < best) {
+					best = err;
+					assignment[i] = p;
+				}
+			}
+		}
+	}
+	free(colours);
+	free(counts);
+}
+
+/*
+ * Fit 4 RGB555 colours to a weighted list of colours: start from the 4
+ * most common, then refine with a few rounds of k-means, snapping each
+ * centroid back onto the RGB555 grid.
+ */
+void fit_palette(const uint16_t *colours, const uint32_t *counts, int n, struct tile_palette *palette)
+{
+	int top[4];
+	int k = 0;
+	for (int i = 0; i < n; i++) {
+		int j = k < 4 ? k++ : 4;
+		while (j > 0 && counts[top[j - 1]] < counts[i]) {
+			if (j < 4) {
+				top[j] = top[j - 1];
+			}
+			j--;
+		}
+		if (j < 4) {
+			top[j] = i;
+		}
+	}
+
+	int32_t cr[4], cg[4], cb[4];
+	for (int i = 0; i < k; i++) {
+		cr[i] = expand(colours[top[i]] & 0x1Fu);
+		cg[i] = expand((colours[top[i]] >> 5u) & 0x1Fu);
+		cb[i] = expand((colours[top[i]] >> 10u) & 0x1Fu);
+	}
+	for (int iter = 0; iter < KMEANS_ITERATIONS && n > 4; iter++) {
+		int64_t sr[4] = {0}, sg[4] = {0}, sb[4] = {0}, sn[4] = {0};
+		for (int j = 0; j < n; j++) {
+			int32_t r = expand(colours[j] & 0x1Fu);
+			int32_t g = expand((colours[j] >> 5u) & 0x1Fu);
+			int32_t b = expand((colours[j] >> 10u) & 0x1Fu);
+			int best = 0;
+			int32_t best_d = INT32_MAX;
+			for (int i = 0; i < k; i++) {
+				int32_t d = (r - cr[i]) * (r - cr[i]) + (g - cg[i]) * (g - cg[i]) + (b - cb[i]) * (b - cb[i]);
+				if (d < best_d) {
+					best_d = d;
+					best = i;
+				}
+			}
+			sr[best] += r * counts[j];
+			sg[best] += g * counts[j];
+			sb[best] += b * counts[j];
+			sn[best] += counts[j];
+		}
+		for (int i = 0; i < k; i++) {
+			if (sn[i] == 0) {
+				continue;
+			}
+			cr[i] = expand(((sr[i] / sn[i]) * 31 + 127) / 255);
+			cg[i] = expand(((sg[i] / sn[i]) * 31 + 127) / 255);
+			cb[i] = expand(((sb[i] / sn[i]) * 31 + 127) / 255);
+		}
+	}
+	for (int i = 0; i < 4; i++) {
+		int j = i < k ? i : 0;
+		palette->r[i] = cr[j];
+		palette->g[i] = cg[j];
+		palette->b[i] = cb[j];
+	}
+	finish_palette(palette, k);
+}
+
+/*
+ * How badly a palette fits a tile: the squared distance from each pixel
+ * to its nearest palette colour, summed.
+ */
+uint64_t palette_error(const struct tile_colours *tile, const struct tile_palette *palette)
+{
+	uint64_t err = 0;
+	for (int j = 0; j < tile->n; j++) {
+		int32_t r = expand(tile->colours[j] & 0x1Fu);
+		int32_t g = expand((tile->colours[j] >> 5u) & 0x1Fu);
+		int32_t b = expand((tile->colours[j] >> 10u) & 0x1Fu);
+		int32_t best = INT32_MAX;
+		for (int i = 0; i < 4; i++) {
+			int32_t dr = r - palette->r[i];
+			int32_t dg = g - palette->g[i];
+			int32_t db = b - palette->b[i];
+			int32_t d = dr * dr + dg * dg + db * db;
+			best = d < best ? d : best;
+		}
+		err += (uint64_t)best * tile->counts[j];
+	}
+	return err;
+}
+
+void finish_palette(struct tile_palette *palette, int k)
+{
+	int min_lum = INT16_MAX;
+	int max_lum = 0;
+	for (int i = 0; i < 4; i++) {
+		int lum = (palette->r[i] * 2 + palette->g[i] * 5 + palette->b[i]) / 8;
+		min_lum = lum < min_lum ? lum : min_lum;
+		max_lum = lum > max_lum ? lum : max_lum;
+	}
+	palette->spread = k > 1 ? (max_lum - min_lum) / (k - 1) : 0;
+}
+
+void unpack_row(const uint32_t *row, int width, int16_t *r, int16_t *g, int16_t *b)
+{
+	for (int x = 0; x < width; x++) {
+		r[x] = row[x] & 0xFFu;
+		g[x] = (row[x] >> 8u) & 0xFFu;
+		b[x] = (row[x] >> 16u) & 0xFFu;
+	}
+}
+
+/*
+ * Find the nearest palette colour to each of n pixels.
+ */
+void quantise_run(const struct tile_palette *palette, const int16_t *r, const int16_t *g, const int16_t *b, int n, uint8_t *idx)
+{
+	for (int x = 0; x < n; x++) {
+		int32_t best_d = INT32_MAX;
+		uint8_t best = 0;
+		for (int i = 0; i < 4; i++) {
+			int32_t dr = r[x] - palette->r[i];
+			int32_t dg = g[x] - palette->g[i];
+			int32_t db = b[x] - palette->b[i];
+			int32_t d = dr * dr + dg * dg + db * db;
+			best = d < best_d ? i : best;
+			best_d = d < best_d ? d : best_d;
+		}
+		idx[x] = best;
+	}
+}
+
+uint32_t palette_colour(const struct tile_palette *palette, int i)
+{
+	return 0xFF000000u
+		| (uint32_t)palette->r[i]
+		| ((uint32_t)palette->g[i] << 8u)
+		| ((uint32_t)palette->b[i] << 16u);
+}
+
+int16_t expand(int c)
+{
+	return (c << 3) | (c >> 2);
+}
+
+int16_t clamp(int32_t v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
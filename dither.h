@@ -0,0 +1,14 @@
+#ifndef DITHER_H
+#define DITHER_H
+
+#include "image.h"
+
+enum dither_mode {
+	DITHER_NONE,
+	DITHER_ORDERED,
+	DITHER_FLOYD_STEINBERG
+};
+
+void dither_bitmap(struct bitmap *bitmap, enum dither_mode mode);
+
+#endif /* DITHER_H */
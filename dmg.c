@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <float.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dmg.h"
+
+/*
+ * Running totals of the colours shown with each shade by one group of
+ * tiles, for picking SGB palettes.
+ */
+struct shade_totals {
+	uint32_t r[4];
+	uint32_t g[4];
+	uint32_t b[4];
+	uint32_t n[4];
+};
+
+static int luminance(uint32_t hex);
+static void merge_groups(struct shade_totals *groups, int *group_of, int n_groups);
+static double merge_cost(const struct shade_totals *a, const struct shade_totals *b);
+static uint16_t mean_colour(const struct shade_totals *totals, int shade);
+
+/*
+ * Build DMG tiles from the image by luminance, mapped linearly from the
+ * darkest to the brightest colour in the image onto the 4 shades. If sgb
+ * is set, the image must be a single 160x144 screen, and SGB palettes and
+ * an attribute file are chosen by merging the CGB palettes down to 4.
+ */
+bool convert_dmg(const struct bitmap *bitmap, const struct conversion *conv, bool sgb, bool quiet, struct dmg *dmg)
+{
+	memset(dmg, 0, sizeof(*dmg));
+	if (sgb && (conv->tiles_width != SGB_ATF_WIDTH || conv->tiles_height != SGB_ATF_HEIGHT)) {
+		if (!quiet) {
+			fprintf(stderr, "Error: SGB output needs a %dx%d image.\n", 8 * SGB_ATF_WIDTH, 8 * SGB_ATF_HEIGHT);
+		}
+		return false;
+	}
+	if (sgb && conv->schedule) {
+		if (!quiet) {
+			fprintf(stderr, "Error: SGB output can't use scheduled palettes.\n");
+		}
+		return false;
+	}
+
+	int min_lum = INT32_MAX;
+	int max_lum = 0;
+	for (int y = 0; y < 8 * conv->tiles_height; y++) {
+		const uint32_t *row = &bitmap->data[(size_t)y * bitmap->stride];
+		for (int x = 0; x < 8 * conv->tiles_width; x++) {
+			int lum = luminance(row[x]);
+			min_lum = lum < min_lum ? lum : min_lum;
+			max_lum = lum > max_lum ? lum : max_lum;
+		}
+	}
+	int range = max_lum - min_lum + 1;
+
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	dmg->map = calloc(map_size, sizeof(*dmg->map));
+	dmg->tile_data = calloc(16 * TILES_PER_BANK, sizeof(*dmg->tile_data));
+	dmg->sgb = sgb;
+	struct shade_totals groups[MAX_PALETTES] = {0};
+	int n_map_tiles = conv->tiles_width * conv->tiles_height;
+	uint8_t *unique = malloc(16 * (size_t)n_map_tiles);
+	int *share = malloc(n_map_tiles * sizeof(*share));
+	int *tile_of = malloc(n_map_tiles * sizeof(*tile_of));
+	int n_unique = 0;
+
+	for (int ty = 0; ty < conv->tiles_height; ty++) {
+		for (int tx = 0; tx < conv->tiles_width; tx++) {
+			struct shade_totals *totals = &groups[conv->attributes[ty * conv->map_width + tx] & ATTR_PALETTE];
+			uint8_t tile[16];
+			for (int y = 0; y < 8; y++) {
+				const uint32_t *row = &bitmap->data[(size_t)(8 * ty + y) * bitmap->stride + 8 * tx];
+				uint8_t lower = 0;
+				uint8_t upper = 0;
+				for (int x = 0; x < 8; x++) {
+					int shade = 4 * (luminance(row[x]) - min_lum) / range;
+					lower = (lower << 1u) | (shade & 1u);
+					upper = (upper << 1u) | ((shade & 2u) >> 1u);
+
+					uint16_t gb = hex_to_gb(row[x]);
+					totals->r[shade] += gb & 0x1Fu;
+					totals->g[shade] += (gb >> 5u) & 0x1Fu;
+					totals->b[shade] += (gb >> 10u) & 0x1Fu;
+					totals->n[shade]++;
+				}
+				tile[2 * y] = lower;
+				tile[2 * y + 1] = upper;
+			}
+
+			int idx;
+			for (idx = 0; idx < n_unique; idx++) {
+				if (tiles_equal(tile, &unique[16 * idx])) {
+					break;
+				}
+			}
+			if (idx == n_unique) {
+				memcpy(&unique[16 * idx], tile, 16);
+				n_unique++;
+				for (share[idx] = 0; share[idx] < conv->bank_tiles[0]; share[idx]++) {
+					if (tiles_equal(tile, &conv->tile_data[16 * share[idx]])) {
+						break;
+					}
+				}
+			}
+			tile_of[ty * conv->tiles_width + tx] = idx;
+		}
+	}
+
+	/*
+	 * The DMG tile set is the first n_shared CGB tiles followed by the
+	 * extra DMG tiles, and the BG can only reach 256 of them. Use the
+	 * longest prefix of the CGB tiles that still leaves room.
+	 */
+	int n_shared;
+	for (n_shared = conv->bank_tiles[0]; n_shared >= 0; n_shared--) {
+		int n_extra = 0;
+		for (int i = 0; i < n_unique; i++) {
+			n_extra += share[i] >= n_shared;
+		}
+		if (n_shared + n_extra <= TILES_PER_BANK) {
+			break;
+		}
+	}
+	if (n_shared < 0) {
+		if (!quiet) {
+			fprintf(stderr, "Error: More than %d unique DMG tiles.\n", TILES_PER_BANK);
+		}
+		free(unique);
+		free(share);
+		free(tile_of);
+		dmg_destroy(dmg);
+		return false;
+	}
+	dmg->n_shared = n_shared;
+	for (int i = 0; i < n_unique; i++) {
+		if (share[i] < n_shared) {
+			continue;
+		}
+		memcpy(&dmg->tile_data[16 * dmg->n_tiles], &unique[16 * i], 16);
+		share[i] = n_shared + dmg->n_tiles++;
+	}
+	for (int ty = 0; ty < conv->tiles_height; ty++) {
+		for (int tx = 0; tx < conv->tiles_width; tx++) {
+			dmg->map[ty * conv->map_width + tx] = share[tile_of[ty * conv->tiles_width + tx]];
+		}
+	}
+	free(unique);
+	free(share);
+	free(tile_of);
+
+	if (!sgb) {
+		return true;
+	}
+
+	int group_of[MAX_PALETTES];
+	merge_groups(groups, group_of, conv->n_palettes);
+	for (int ty = 0; ty < SGB_ATF_HEIGHT; ty++) {
+		for (int tx = 0; tx < SGB_ATF_WIDTH; tx++) {
+			int p_idx = group_of[conv->attributes[ty * conv->map_width + tx] & ATTR_PALETTE];
+			int cell = ty * SGB_ATF_WIDTH + tx;
+			dmg->atf[cell / 4] |= p_idx << (6 - 2 * (cell % 4));
+		}
+	}
+
+	/*
+	 * SGB colour c is shown for shade c after BGP, i.e. for DMG colour
+	 * index 3 - c. Colour 0 comes from the first palette for all of
+	 * them, so use the average over every palette there.
+	 */
+	struct shade_totals all = {0};
+	for (int p_idx = 0; p_idx < SGB_PALETTES; p_idx++) {
+		all.r[3] += groups[p_idx].r[3];
+		all.g[3] += groups[p_idx].g[3];
+		all.b[3] += groups[p_idx].b[3];
+		all.n[3] += groups[p_idx].n[3];
+	}
+	for (int p_idx = 0; p_idx < SGB_PALETTES; p_idx++) {
+		for (int c = 0; c < 4; c++) {
+			uint16_t colour = mean_colour(c == 0 ? &all : &groups[p_idx], 3 - c);
+			dmg->sgb_palettes[p_idx][2 * c] = colour & 0xFFu;
+			dmg->sgb_palettes[p_idx][2 * c + 1] = colour >> 8u;
+		}
+	}
+	return true;
+}
+
+void dmg_destroy(struct dmg *dmg)
+{
+	free(dmg->tile_data);
+	free(dmg->map);
+	dmg->tile_data = NULL;
+	dmg->map = NULL;
+}
+
+int luminance(uint32_t hex)
+{
+	uint16_t gb = hex_to_gb(hex);
+	int r = gb & 0x1Fu;
+	int g = (gb >> 5u) & 0x1Fu;
+	int b = (gb >> 10u) & 0x1Fu;
+	return 2 * r + 5 * g + b;
+}
+
+/*
+ * Merge the groups of tiles using each CGB palette until there are at
+ * most SGB_PALETTES, always merging the pair whose shades are closest in
+ * colour, weighted by how many pixels each has. On return, groups holds
+ * the merged groups first and group_of maps each CGB palette to one.
+ */
+void merge_groups(struct shade_totals *groups, int *group_of, int n_groups)
+{
+	int owner[MAX_PALETTES];
+	for (int i = 0; i < MAX_PALETTES; i++) {
+		owner[i] = i < n_groups ? i : 0;
+	}
+	bool alive[MAX_PALETTES] = {false};
+	for (int i = 0; i < n_groups; i++) {
+		alive[i] = true;
+	}
+	for (int n_alive = n_groups; n_alive > SGB_PALETTES; n_alive--) {
+		int best_a = -1;
+		int best_b = -1;
+		double best = DBL_MAX;
+		for (int a = 0; a < n_groups; a++) {
+			for (int b = a + 1; b < n_groups && alive[a]; b++) {
+				if (!alive[b]) {
+					continue;
+				}
+				double cost = merge_cost(&groups[a], &groups[b]);
+				if (cost < best) {
+					best = cost;
+					best_a = a;
+					best_b = b;
+				}
+			}
+		}
+		for (int c = 0; c < 4; c++) {
+			groups[best_a].r[c] += groups[best_b].r[c];
+			groups[best_a].g[c] += groups[best_b].g[c];
+			groups[best_a].b[c] += groups[best_b].b[c];
+			groups[best_a].n[c] += groups[best_b].n[c];
+		}
+		alive[best_b] = false;
+		for (int i = 0; i < MAX_PALETTES; i++) {
+			if (owner[i] == best_b) {
+				owner[i] = best_a;
+			}
+		}
+	}
+
+	/* Pack the surviving groups to the front. */
+	int packed[MAX_PALETTES] = {0};
+	int n = 0;
+	for (int i = 0; i < MAX_PALETTES; i++) {
+		if (alive[i]) {
+			packed[i] = n;
+			groups[n++] = groups[i];
+		}
+	}
+	for (int i = n; i < MAX_PALETTES; i++) {
+		memset(&groups[i], 0, sizeof(groups[i]));
+	}
+	for (int i = 0; i < MAX_PALETTES; i++) {
+		group_of[i] = packed[owner[i]];
+	}
+}
+
+/*
+ * The squared distance between the mean colours of each shade, times
+ * n_a * n_b / (n_a + n_b), so that merging small groups is cheap.
+ */
+double merge_cost(const struct shade_totals *a, const struct shade_totals *b)
+{
+	double cost = 0;
+	for (int c = 0; c < 4; c++) {
+		if (!a->n[c] || !b->n[c]) {
+			continue;
+		}
+		double dr = (double)a->r[c] / a->n[c] - (double)b->r[c] / b->n[c];
+		double dg = (double)a->g[c] / a->n[c] - (double)b->g[c] / b->n[c];
+		double db = (double)a->b[c] / a->n[c] - (double)b->b[c] / b->n[c];
+		double weight = (double)a->n[c] * b->n[c] / (a->n[c] + b->n[c]);
+		cost += (dr * dr + dg * dg + db * db) * weight;
+	}
+	return cost;
+}
+
+uint16_t mean_colour(const struct shade_totals *totals, int shade)
+{
+	uint32_t n = totals->n[shade];
+	if (n == 0) {
+		/* Unused, so fill in a grey of the right brightness. */
+		uint16_t grey = 31 * shade / 3;
+		return grey | (grey << 5u) | (grey << 10u);
+	}
+	uint16_t r = (totals->r[shade] + n / 2) / n;
+	uint16_t g = (totals->g[shade] + n / 2) / n;
+	uint16_t b = (totals->b[shade] + n / 2) / n;
+	return r | (g << 5u) | (b << 10u);
+}
@@ -0,0 +1,46 @@
+#ifndef DMG_H
+#define DMG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "convert.h"
+#include "image.h"
+
+/*
+ * Colour indices are ordered darkest first, like the sorted CGB palettes,
+ * so DMG_BGP maps index 0 to black and index 3 to white.
+ */
+#define DMG_BGP 0x1Bu
+#define SGB_PALETTES 4
+#define SGB_ATF_WIDTH 20
+#define SGB_ATF_HEIGHT 18
+#define SGB_ATF_SIZE (SGB_ATF_WIDTH * SGB_ATF_HEIGHT / 4)
+
+/*
+ * A monochrome version of a conversion, for the DMG and optionally the
+ * SGB.
+ *
+ * DMG tiles identical to one of the first n_shared CGB bank 0 tiles reuse
+ * its index, so the DMG tile set is those CGB tiles followed by the
+ * n_tiles in tile_data, which the CGB version doesn't have. The map is the
+ * same size as the CGB one. The DMG has no flip attributes, so flipped
+ * CGB tiles can't be shared.
+ *
+ * For the SGB, each tile of the 20x18 screen is given one of 4 palettes
+ * in the attribute file atf, 2 bits per tile with the leftmost tile in
+ * the top bits. Colour 0 is shared by all SGB palettes.
+ */
+struct dmg {
+	uint8_t *tile_data;
+	int n_tiles;
+	int n_shared;
+	uint8_t *map;
+	bool sgb;
+	uint8_t sgb_palettes[SGB_PALETTES][8];
+	uint8_t atf[SGB_ATF_SIZE];
+};
+
+bool convert_dmg(const struct bitmap *bitmap, const struct conversion *conv, bool sgb, bool quiet, struct dmg *dmg);
+void dmg_destroy(struct dmg *dmg);
+
+#endif /* DMG_H */
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <errno.h>
+#include <png.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "output.h"
+
+#define HEADER_BYTES 8
+
+static const png_byte skipped_chunks[] = {
+	'i', 'C', 'C', 'P', '\0',
+	'i', 'T', 'X', 't', '\0',
+	't', 'E', 'X', 't', '\0',
+	'z', 'T', 'X', 't', '\0'
+};
+
+/*
+ * Returns a view of a rectangle of the bitmap, sharing its data.
+ */
+struct bitmap bitmap_view(const struct bitmap *bitmap, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+	struct bitmap view = {
+		.data = &bitmap->data[(size_t)y * bitmap->stride + x],
+		.stride = bitmap->stride,
+		.width = width,
+		.height = height
+	};
+	return view;
+}
+
+/*
+ * Parse a comma-separated list of width=N, height=N, pixels=N and
+ * bytes=N into limits, leaving the others as they were.
+ */
+bool parse_png_limits(const char *spec, struct png_limits *limits)
+{
+	char *copy = strdup(spec);
+	bool ok = true;
+	for (char *item = strtok(copy, ","); item && ok; item = strtok(NULL, ",")) {
+		char *value = strchr(item, '=');
+		char *end = NULL;
+		long long n = value ? strtoll(value + 1, &end, 0) : -1;
+		if (!value || end == value + 1 || *end != '\0' || n <= 0) {
+			fprintf(stderr, "Invalid PNG limit \"%s\".\n", item);
+			ok = false;
+			break;
+		}
+		*value = '\0';
+		if (strcmp(item, "width") == 0 && n <= PNG_UINT_31_MAX) {
+			limits->max_width = n;
+		} else if (strcmp(item, "height") == 0 && n <= PNG_UINT_31_MAX) {
+			limits->max_height = n;
+		} else if (strcmp(item, "pixels") == 0) {
+			limits->max_pixels = n;
+		} else if (strcmp(item, "bytes") == 0) {
+			limits->max_bytes = n;
+		} else {
+			fprintf(stderr, "Unknown PNG limit \"%s\".\n", item);
+			ok = false;
+		}
+	}
+	free(copy);
+	return ok;
+}
+
+/*
+ * Decode a PNG of any colour type and bit depth to 8-bit RGBA. The
+ * header is checked against the limits before anything is allocated,
+ * and text and ICC profile chunks, which are only ever compressed
+ * metadata to us, are skipped without being inflated.
+ */
+bool load_png(const char *filename, const struct png_limits *limits, struct bitmap *bitmap)
+{
+	memset(bitmap, 0, sizeof(*bitmap));
+	FILE *fp = fopen(filename, "rb");
+	uint8_t header[HEADER_BYTES];
+	if (!fp) {
+		fprintf(stderr, "Couldn't open %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	if (fread(header, 1, HEADER_BYTES, fp) != HEADER_BYTES) {
+		fprintf(stderr, "Failed to read PNG data: %s\n", filename);
+		fclose(fp);
+		return false;
+	}
+	if (png_sig_cmp(header, 0, HEADER_BYTES)) {
+		fprintf(stderr, "Not a PNG file: %s\n", filename);
+		fclose(fp);
+		return false;
+	}
+
+	png_structp png_ptr = png_create_read_struct(
+			PNG_LIBPNG_VER_STRING,
+			NULL, NULL, NULL);
+	if (!png_ptr) {
+		fprintf(stderr, "Couldn't create PNG read struct.\n");
+		fclose(fp);
+		return false;
+	}
+
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr) {
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		fclose(fp);
+		fprintf(stderr, "Couldn't create PNG info struct.\n");
+		return false;
+	}
+
+	if (setjmp(png_jmpbuf(png_ptr)) != 0) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		fprintf(stderr, "Couldn't decode %s.\n", filename);
+		return false;
+	}
+
+	png_init_io(png_ptr, fp);
+	png_set_sig_bytes(png_ptr, HEADER_BYTES);
+	png_set_user_limits(png_ptr, limits->max_width, limits->max_height);
+	png_set_chunk_malloc_max(png_ptr, limits->max_bytes);
+	png_set_keep_unknown_chunks(png_ptr, PNG_HANDLE_CHUNK_NEVER, skipped_chunks, sizeof(skipped_chunks) / 5);
+	png_read_info(png_ptr, info_ptr);
+
+	uint32_t width = png_get_image_width(png_ptr, info_ptr);
+	uint32_t height = png_get_image_height(png_ptr, info_ptr);
+	uint64_t n_pixels = (uint64_t)width * height;
+	const char *limit = NULL;
+	if (n_pixels > limits->max_pixels) {
+		limit = "pixels";
+	} else if (n_pixels * sizeof(*bitmap->data) > limits->max_bytes) {
+		limit = "bytes";
+	}
+	if (limit) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		fprintf(stderr, "Error: %s is %ux%u, over the PNG limit on %s.\n", filename, width, height, limit);
+		return false;
+	}
+
+	uint32_t colour_type = png_get_color_type(png_ptr, info_ptr);
+	png_set_expand(png_ptr);
+	png_set_strip_16(png_ptr);
+	png_set_gray_to_rgb(png_ptr);
+	if (!(colour_type & PNG_COLOR_MASK_ALPHA) && !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+		png_set_filler(png_ptr, 0xFFu, PNG_FILLER_AFTER);
+	}
+	png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+	if (png_get_rowbytes(png_ptr, info_ptr) != (size_t)width * sizeof(*bitmap->data)) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		fprintf(stderr, "Couldn't convert %s to RGBA.\n", filename);
+		return false;
+	}
+
+	uint32_t *data = malloc(n_pixels * sizeof(*data));
+	png_bytepp row_pointers = malloc(height * sizeof(png_bytep));
+	if (!data || !row_pointers) {
+		free(data);
+		free(row_pointers);
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		fprintf(stderr, "Couldn't allocate %ux%u pixels for %s.\n", width, height, filename);
+		return false;
+	}
+	for (uint32_t y = 0; y < height; y++) {
+		row_pointers[y] = (unsigned char *)&data[(size_t)y * width];
+	}
+
+	/* From here on, errors also have the image to free. */
+	if (setjmp(png_jmpbuf(png_ptr)) != 0) {
+		free(data);
+		free(row_pointers);
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		fprintf(stderr, "Couldn't decode %s.\n", filename);
+		return false;
+	}
+	png_read_image(png_ptr, row_pointers);
+	png_read_end(png_ptr, NULL);
+
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	free(row_pointers);
+	fclose(fp);
+	bitmap->data = data;
+	bitmap->width = width;
+	bitmap->height = height;
+	bitmap->stride = width;
+	return true;
+}
+
+/*
+ * Write the bitmap as an 8-bit RGBA PNG, going through write_file so an
+ * unchanged file is left alone.
+ */
+bool save_png(const char *filename, const struct bitmap *bitmap)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp = open_memstream(&buf, &len);
+	if (!fp) {
+		fprintf(stderr, "Couldn't create PNG buffer: %s\n", strerror(errno));
+		return false;
+	}
+	png_structp png_ptr = png_create_write_struct(
+			PNG_LIBPNG_VER_STRING,
+			NULL, NULL, NULL);
+	png_infop info_ptr = png_ptr ? png_create_info_struct(png_ptr) : NULL;
+	if (!info_ptr) {
+		fprintf(stderr, "Couldn't create PNG write struct.\n");
+		png_destroy_write_struct(&png_ptr, NULL);
+		fclose(fp);
+		free(buf);
+		return false;
+	}
+	if (setjmp(png_jmpbuf(png_ptr)) != 0) {
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		fclose(fp);
+		free(buf);
+		fprintf(stderr, "Couldn't write PNG data for %s.\n", filename);
+		return false;
+	}
+	png_init_io(png_ptr, fp);
+	png_set_IHDR(png_ptr, info_ptr, bitmap->width, bitmap->height, 8,
+			PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png_ptr, info_ptr);
+	for (uint32_t y = 0; y < bitmap->height; y++) {
+		png_write_row(png_ptr, (png_const_bytep)&bitmap->data[(size_t)y * bitmap->stride]);
+	}
+	png_write_end(png_ptr, NULL);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	fclose(fp);
+
+	bool ok = write_file(filename, (const uint8_t *)buf, len);
+	free(buf);
+	return ok;
+}
@@ -0,0 +1,39 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * An RGBA image. stride is the distance between rows in pixels, which is
+ * larger than width for views into a bigger image.
+ */
+struct bitmap {
+	uint32_t *data;
+	uint32_t stride;
+	uint32_t width;
+	uint32_t height;
+};
+
+#define DEFAULT_MAX_PNG_SIDE 32768
+#define DEFAULT_MAX_PNG_PIXELS (1u << 26)
+#define DEFAULT_MAX_PNG_BYTES (1u << 28)
+
+/*
+ * Limits on what load_png will decode, checked against the header before
+ * anything is allocated. max_bytes bounds both the decoded image and any
+ * one ancillary chunk, so a compressed chunk can't inflate past it either.
+ */
+struct png_limits {
+	uint32_t max_width;
+	uint32_t max_height;
+	uint64_t max_pixels;
+	uint64_t max_bytes;
+};
+
+bool parse_png_limits(const char *spec, struct png_limits *limits);
+bool load_png(const char *filename, const struct png_limits *limits, struct bitmap *bitmap);
+struct bitmap bitmap_view(const struct bitmap *bitmap, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+bool save_png(const char *filename, const struct bitmap *bitmap);
+
+#endif /* IMAGE_H */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+
+#define MAX_DEPTH 64
+
+struct parser {
+	const char *text;
+	size_t len;
+	size_t pos;
+	struct json_token *tokens;
+	uint32_t n_tokens;
+	uint32_t size;
+};
+
+static int add_token(struct parser *p, enum json_type type, size_t start);
+static bool parse_value(struct parser *p, int depth);
+static bool parse_literal(struct parser *p, const char *literal, enum json_type type);
+static bool parse_string(struct parser *p);
+static void skip_space(struct parser *p);
+
+/*
+ * Tokenise a whole document, which must be NUL-terminated. Only
+ * well-formedness is checked, not what is in it.
+ */
+bool json_parse(const char *text, size_t len, struct json *json)
+{
+	struct parser p = {.text = text, .len = len};
+	bool ok = parse_value(&p, 0);
+	skip_space(&p);
+	if (ok && p.pos != p.len) {
+		ok = false;
+	}
+	if (!ok) {
+		int line = 1;
+		for (size_t i = 0; i < p.pos && i < len; i++) {
+			line += text[i] == '\n';
+		}
+		fprintf(stderr, "Invalid JSON on line %d.\n", line);
+		free(p.tokens);
+		return false;
+	}
+	json->text = text;
+	json->tokens = p.tokens;
+	json->n_tokens = p.n_tokens;
+	return true;
+}
+
+/*
+ * Returns the value of key in an object, or -1 if it isn't there or
+ * object isn't an object.
+ */
+int json_get(const struct json *json, int object, const char *key)
+{
+	if (object < 0 || json->tokens[object].type != JSON_OBJECT) {
+		return -1;
+	}
+	uint32_t end = json->tokens[object].next;
+	for (uint32_t k = object + 1; k < end; k = json->tokens[json->tokens[k].next].next) {
+		if (json_equals(json, k, key)) {
+			return json->tokens[k].next;
+		}
+	}
+	return -1;
+}
+
+bool json_equals(const struct json *json, int token, const char *str)
+{
+	if (token < 0) {
+		return false;
+	}
+	const struct json_token *t = &json->tokens[token];
+	size_t len = strlen(str);
+	return t->end - t->start == len && memcmp(&json->text[t->start], str, len) == 0;
+}
+
+/*
+ * Returns a number's integer part, or -1 if the token isn't a number.
+ */
+long long json_int(const struct json *json, int token)
+{
+	if (token < 0 || json->tokens[token].type != JSON_NUMBER) {
+		return -1;
+	}
+	return strtoll(&json->text[json->tokens[token].start], NULL, 10);
+}
+
+/*
+ * Copy a string's text, as it is in the document, or an empty string if
+ * the token isn't one.
+ */
+void json_string(const struct json *json, int token, char *value, size_t size)
+{
+	if (token < 0 || json->tokens[token].type != JSON_STRING) {
+		value[0] = '\0';
+		return;
+	}
+	const struct json_token *t = &json->tokens[token];
+	snprintf(value, size, "%.*s", (int)(t->end - t->start), &json->text[t->start]);
+}
+
+/*
+ * Returns the number of elements in an array, or -1 if it isn't one.
+ */
+int json_count(const struct json *json, int array)
+{
+	if (array < 0 || json->tokens[array].type != JSON_ARRAY) {
+		return -1;
+	}
+	int n = 0;
+	for (uint32_t i = array + 1; i < json->tokens[array].next; i = json->tokens[i].next) {
+		n++;
+	}
+	return n;
+}
+
+void json_destroy(struct json *json)
+{
+	free(json->tokens);
+	json->tokens = NULL;
+	json->n_tokens = 0;
+}
+
+int add_token(struct parser *p, enum json_type type, size_t start)
+{
+	if (p->n_tokens == p->size) {
+		p->size = p->size ? 2 * p->size : 1024;
+		p->tokens = realloc(p->tokens, p->size * sizeof(*p->tokens));
+	}
+	struct json_token *t = &p->tokens[p->n_tokens];
+	t->type = type;
+	t->start = start;
+	t->end = start;
+	t->next = p->n_tokens + 1;
+	return p->n_tokens++;
+}
+
+bool parse_value(struct parser *p, int depth)
+{
+	skip_space(p);
+	if (p->pos >= p->len || depth > MAX_DEPTH) {
+		return false;
+	}
+	char c = p->text[p->pos];
+	if (c == '"') {
+		return parse_string(p);
+	} else if (c == 't') {
+		return parse_literal(p, "true", JSON_BOOL);
+	} else if (c == 'f') {
+		return parse_literal(p, "false", JSON_BOOL);
+	} else if (c == 'n') {
+		return parse_literal(p, "null", JSON_NULL);
+	} else if (c == '[' || c == '{') {
+		bool object = c == '{';
+		int idx = add_token(p, object ? JSON_OBJECT : JSON_ARRAY, p->pos);
+		char close = object ? '}' : ']';
+		p->pos++;
+		skip_space(p);
+		if (p->pos < p->len && p->text[p->pos] == close) {
+			p->pos++;
+		} else {
+			for (;;) {
+				if (object) {
+					skip_space(p);
+					if (p->pos >= p->len || p->text[p->pos] != '"' || !parse_string(p)) {
+						return false;
+					}
+					skip_space(p);
+					if (p->pos >= p->len || p->text[p->pos] != ':') {
+						return false;
+					}
+					p->pos++;
+				}
+				if (!parse_value(p, depth + 1)) {
+					return false;
+				}
+				skip_space(p);
+				if (p->pos >= p->len) {
+					return false;
+				}
+				c = p->text[p->pos++];
+				if (c == close) {
+					break;
+				} else if (c != ',') {
+					return false;
+				}
+			}
+		}
+		p->tokens[idx].end = p->pos;
+		p->tokens[idx].next = p->n_tokens;
+		return true;
+	} else if (c == '-' || (c >= '0' && c <= '9')) {
+		int idx = add_token(p, JSON_NUMBER, p->pos);
+		while (p->pos < p->len && p->text[p->pos] && strchr("+-.eE0123456789", p->text[p->pos])) {
+			p->pos++;
+		}
+		p->tokens[idx].end = p->pos;
+		return true;
+	}
+	return false;
+}
+
+bool parse_literal(struct parser *p, const char *literal, enum json_type type)
+{
+	size_t len = strlen(literal);
+	if (p->len - p->pos < len || memcmp(&p->text[p->pos], literal, len) != 0) {
+		return false;
+	}
+	int idx = add_token(p, type, p->pos);
+	p->pos += len;
+	p->tokens[idx].end = p->pos;
+	return true;
+}
+
+bool parse_string(struct parser *p)
+{
+	int idx = add_token(p, JSON_STRING, ++p->pos);
+	while (p->pos < p->len && p->text[p->pos] != '"') {
+		if (p->text[p->pos] == '\\') {
+			p->pos++;
+		}
+		p->pos++;
+	}
+	if (p->pos >= p->len) {
+		return false;
+	}
+	p->tokens[idx].end = p->pos++;
+	return true;
+}
+
+void skip_space(struct parser *p)
+{
+	while (p->pos < p->len && p->text[p->pos] && strchr(" \t\r\n", p->text[p->pos])) {
+		p->pos++;
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum json_type {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+};
+
+/*
+ * One value of a parsed document, as a range of its text. Strings don't
+ * include their quotes, and escapes are left as they are. An array or
+ * object is followed by its contents, with an object's keys and values
+ * alternating, and next is the index of the token after it and
+ * everything in it, so siblings can be walked without recursing.
+ */
+struct json_token {
+	enum json_type type;
+	uint32_t start;
+	uint32_t end;
+	uint32_t next;
+};
+
+struct json {
+	const char *text;
+	struct json_token *tokens;
+	uint32_t n_tokens;
+};
+
+bool json_parse(const char *text, size_t len, struct json *json);
+int json_get(const struct json *json, int object, const char *key);
+bool json_equals(const struct json *json, int token, const char *str);
+long long json_int(const struct json *json, int token);
+void json_string(const struct json *json, int token, char *value, size_t size);
+int json_count(const struct json *json, int array);
+void json_destroy(struct json *json);
+
+#endif /* JSON_H */
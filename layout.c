@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "layout.h"
+#include "output.h"
+
+/*
+ * The sections moved together when packing: a whole group if it fits in
+ * a bank, or else a single section.
+ */
+struct unit {
+	int group;
+	int item;
+	size_t size;
+	int bank;
+};
+
+static int cmp_units(const void *a, const void *b);
+static bool empty_bank(struct unit *units, int n_units, size_t *used, int bank, int n_banks);
+static void gather_groups(struct unit *units, int n_units, size_t *used, int n_banks);
+static int drop_empty_banks(struct unit *units, int n_units, size_t *used, int n_banks);
+static int split_groups(const struct layout *layout);
+
+/*
+ * Add sections first_section onwards of the object as a new group.
+ */
+void layout_add_sections(struct layout *layout, const struct object *object, int first_section)
+{
+	int n_new = object->n_sections - first_section;
+	layout->items = realloc(layout->items, (layout->n_items + n_new) * sizeof(*layout->items));
+	for (int i = first_section; i < object->n_sections; i++) {
+		struct layout_item *item = &layout->items[layout->n_items++];
+		snprintf(item->name, sizeof(item->name), "%s", object->sections[i].name);
+		item->size = object->sections[i].size;
+		item->group = layout->n_groups;
+		item->bank = -1;
+		item->address = 0;
+	}
+	layout->n_groups++;
+}
+
+/*
+ * Assign every section a bank and address. Units are placed first fit,
+ * largest first. Then the least used bank is emptied into the others
+ * while that's possible, and groups that had to be split are brought
+ * into as few banks as will hold them. Within a bank, sections keep
+ * their original order. Fails if the banks needed run past MAX_ROM_BANK.
+ */
+bool pack_banks(struct layout *layout)
+{
+	size_t *group_size = calloc(layout->n_groups, sizeof(*group_size));
+	for (int i = 0; i < layout->n_items; i++) {
+		if (layout->items[i].size > ROM_BANK_SIZE) {
+			fprintf(stderr, "Error: %s is %zu bytes, more than a ROM bank.\n",
+					layout->items[i].name, layout->items[i].size);
+			free(group_size);
+			return false;
+		}
+		group_size[layout->items[i].group] += layout->items[i].size;
+	}
+
+	struct unit *units = malloc(layout->n_items * sizeof(*units));
+	int n_units = 0;
+	for (int g = 0; g < layout->n_groups; g++) {
+		if (group_size[g] <= ROM_BANK_SIZE) {
+			units[n_units++] = (struct unit){g, -1, group_size[g], -1};
+			continue;
+		}
+		for (int i = 0; i < layout->n_items; i++) {
+			if (layout->items[i].group == g) {
+				units[n_units++] = (struct unit){g, i, layout->items[i].size, -1};
+			}
+		}
+	}
+	qsort(units, n_units, sizeof(*units), cmp_units);
+
+	size_t *used = calloc(n_units + 1, sizeof(*used));
+	int n_banks = 0;
+	for (int u = 0; u < n_units; u++) {
+		int bank = 0;
+		while (bank < n_banks && used[bank] + units[u].size > ROM_BANK_SIZE) {
+			bank++;
+		}
+		n_banks = bank == n_banks ? n_banks + 1 : n_banks;
+		units[u].bank = bank;
+		used[bank] += units[u].size;
+	}
+
+	/* Try to empty the least used bank into the others. */
+	for (;;) {
+		int emptiest = -1;
+		for (int bank = 0; bank < n_banks; bank++) {
+			if (emptiest < 0 || used[bank] < used[emptiest]) {
+				emptiest = bank;
+			}
+		}
+		if (n_banks <= 1 || !empty_bank(units, n_units, used, emptiest, n_banks)) {
+			break;
+		}
+		n_banks = drop_empty_banks(units, n_units, used, n_banks);
+	}
+	gather_groups(units, n_units, used, n_banks);
+	n_banks = drop_empty_banks(units, n_units, used, n_banks);
+	if (layout->first_bank + n_banks - 1 > MAX_ROM_BANK) {
+		fprintf(stderr, "Error: %d banks are needed from bank %d, past the last ROM bank, $%X.\n",
+				n_banks, layout->first_bank, MAX_ROM_BANK);
+		free(used);
+		free(units);
+		free(group_size);
+		return false;
+	}
+
+	for (int u = 0; u < n_units; u++) {
+		for (int i = 0; i < layout->n_items; i++) {
+			struct layout_item *item = &layout->items[i];
+			if (units[u].item == i || (units[u].item < 0 && item->group == units[u].group)) {
+				item->bank = layout->first_bank + units[u].bank;
+			}
+		}
+	}
+	memset(used, 0, (n_units + 1) * sizeof(*used));
+	for (int i = 0; i < layout->n_items; i++) {
+		struct layout_item *item = &layout->items[i];
+		int bank = item->bank - layout->first_bank;
+		item->address = ROMX_START + used[bank];
+		used[bank] += item->size;
+	}
+	layout->n_banks = n_banks;
+	free(used);
+	free(units);
+	free(group_size);
+	return true;
+}
+
+/*
+ * Write a summary of each bank and the sections in it, with a count of
+ * the conversions split over more than one bank.
+ */
+bool write_bank_map(const struct layout *layout, const char *filename)
+{
+	char *buf;
+	size_t len;
+	FILE *fp = open_memstream(&buf, &len);
+	size_t total = 0;
+	for (int i = 0; i < layout->n_items; i++) {
+		total += layout->items[i].size;
+	}
+	fprintf(fp, "; %d sections in %d banks, %zu bytes free, %d split\n",
+			layout->n_items, layout->n_banks,
+			(size_t)layout->n_banks * ROM_BANK_SIZE - total, split_groups(layout));
+	for (int bank = layout->first_bank; bank < layout->first_bank + layout->n_banks; bank++) {
+		size_t used = 0;
+		for (int i = 0; i < layout->n_items; i++) {
+			used += layout->items[i].bank == bank ? layout->items[i].size : 0;
+		}
+		fprintf(fp, "\nBank $%02X: %zu of %u bytes used\n", bank, used, ROM_BANK_SIZE);
+		for (int i = 0; i < layout->n_items; i++) {
+			const struct layout_item *item = &layout->items[i];
+			if (item->bank == bank) {
+				fprintf(fp, "  $%04X-$%04zX  %s\n", item->address,
+						item->address + (item->size ? item->size - 1 : 0), item->name);
+			}
+		}
+	}
+	fclose(fp);
+	bool ok = write_file(filename, (uint8_t *)buf, len);
+	free(buf);
+	return ok;
+}
+
+/*
+ * Write an rgblink linker script placing each section in its bank, in
+ * address order.
+ */
+bool write_linker_script(const struct layout *layout, const char *filename)
+{
+	char *buf;
+	size_t len;
+	FILE *fp = open_memstream(&buf, &len);
+	for (int bank = layout->first_bank; bank < layout->first_bank + layout->n_banks; bank++) {
+		fprintf(fp, "ROMX $%02X\n", bank);
+		for (int i = 0; i < layout->n_items; i++) {
+			if (layout->items[i].bank == bank) {
+				fprintf(fp, "\t\"%s\"\n", layout->items[i].name);
+			}
+		}
+	}
+	fclose(fp);
+	bool ok = write_file(filename, (uint8_t *)buf, len);
+	free(buf);
+	return ok;
+}
+
+void layout_destroy(struct layout *layout)
+{
+	free(layout->items);
+	layout->items = NULL;
+	layout->n_items = 0;
+	layout->n_groups = 0;
+}
+
+/* Largest first, then in their original order. */
+int cmp_units(const void *a, const void *b)
+{
+	const struct unit *ua = a;
+	const struct unit *ub = b;
+	if (ua->size != ub->size) {
+		return ua->size > ub->size ? -1 : 1;
+	}
+	if (ua->group != ub->group) {
+		return ua->group - ub->group;
+	}
+	return ua->item - ub->item;
+}
+
+/*
+ * Move every unit out of the bank into the fullest other bank with room,
+ * largest first. Units are sorted largest first, so this is best fit
+ * decreasing. Nothing is moved unless they all fit.
+ */
+bool empty_bank(struct unit *units, int n_units, size_t *used, int bank, int n_banks)
+{
+	size_t *trial = malloc(n_banks * sizeof(*trial));
+	int *dest = malloc(n_units * sizeof(*dest));
+	memcpy(trial, used, n_banks * sizeof(*trial));
+	trial[bank] = ROM_BANK_SIZE;
+	bool ok = true;
+	for (int u = 0; u < n_units && ok; u++) {
+		dest[u] = units[u].bank;
+		if (units[u].bank != bank) {
+			continue;
+		}
+		int best = -1;
+		for (int b = 0; b < n_banks; b++) {
+			if (trial[b] + units[u].size <= ROM_BANK_SIZE && (best < 0 || trial[b] > trial[best])) {
+				best = b;
+			}
+		}
+		ok = best >= 0;
+		if (ok) {
+			trial[best] += units[u].size;
+			dest[u] = best;
+		}
+	}
+	if (ok) {
+		for (int u = 0; u < n_units; u++) {
+			units[u].bank = dest[u];
+		}
+		memcpy(used, trial, n_banks * sizeof(*used));
+		used[bank] = 0;
+	}
+	free(trial);
+	free(dest);
+	return ok;
+}
+
+/*
+ * For each group that was too big for one bank, and so was split into
+ * its sections, merge its parts in different banks wherever one part
+ * fits in the bank of another, so it spans as few banks as possible.
+ */
+void gather_groups(struct unit *units, int n_units, size_t *used, int n_banks)
+{
+	size_t *share = malloc(n_banks * sizeof(*share));
+	for (int u = 0; u < n_units; u++) {
+		bool seen = units[u].item < 0;
+		for (int v = 0; v < u && !seen; v++) {
+			seen = units[v].item >= 0 && units[v].group == units[u].group;
+		}
+		if (seen) {
+			continue;
+		}
+		int group = units[u].group;
+		bool moved = true;
+		while (moved) {
+			moved = false;
+			memset(share, 0, n_banks * sizeof(*share));
+			for (int v = 0; v < n_units; v++) {
+				if (units[v].item >= 0 && units[v].group == group) {
+					share[units[v].bank] += units[v].size;
+				}
+			}
+			for (int from = 0; from < n_banks && !moved; from++) {
+				for (int to = 0; to < n_banks && !moved; to++) {
+					if (to == from || !share[from] || !share[to] || used[to] + share[from] > ROM_BANK_SIZE) {
+						continue;
+					}
+					for (int v = 0; v < n_units; v++) {
+						if (units[v].item >= 0 && units[v].group == group && units[v].bank == from) {
+							units[v].bank = to;
+						}
+					}
+					used[from] -= share[from];
+					used[to] += share[from];
+					moved = true;
+				}
+			}
+		}
+	}
+	free(share);
+}
+
+/*
+ * Remove banks with nothing left in them, renumbering the rest. Returns
+ * the new number of banks.
+ */
+int drop_empty_banks(struct unit *units, int n_units, size_t *used, int n_banks)
+{
+	for (int bank = n_banks - 1; bank >= 0; bank--) {
+		bool empty = true;
+		for (int u = 0; u < n_units && empty; u++) {
+			empty = units[u].bank != bank;
+		}
+		if (!empty) {
+			continue;
+		}
+		for (int u = 0; u < n_units; u++) {
+			units[u].bank -= units[u].bank > bank;
+		}
+		memmove(&used[bank], &used[bank + 1], (n_banks - bank - 1) * sizeof(*used));
+		n_banks--;
+	}
+	return n_banks;
+}
+
+/* How many groups are spread over more than one bank. */
+int split_groups(const struct layout *layout)
+{
+	int n_split = 0;
+	for (int g = 0; g < layout->n_groups; g++) {
+		int bank = -1;
+		for (int i = 0; i < layout->n_items; i++) {
+			if (layout->items[i].group != g) {
+				continue;
+			}
+			if (bank >= 0 && layout->items[i].bank != bank) {
+				n_split++;
+				break;
+			}
+			bank = layout->items[i].bank;
+		}
+	}
+	return n_split;
+}
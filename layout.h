@@ -0,0 +1,43 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "object.h"
+
+#define ROM_BANK_SIZE 0x4000u
+#define ROMX_START 0x4000u
+#define MAX_ROM_BANK 0x1FF
+
+/*
+ * A section to place in a ROMX bank. Sections of the same group, i.e.
+ * from the same conversion, are kept in one bank where possible, so
+ * loading a screen only needs one bank switch.
+ */
+struct layout_item {
+	char name[MAX_OBJECT_NAME];
+	size_t size;
+	int group;
+	int bank;
+	uint16_t address;
+};
+
+/*
+ * The placement of every section, in banks first_bank onwards.
+ */
+struct layout {
+	struct layout_item *items;
+	int n_items;
+	int n_groups;
+	int first_bank;
+	int n_banks;
+};
+
+void layout_add_sections(struct layout *layout, const struct object *object, int first_section);
+bool pack_banks(struct layout *layout);
+bool write_bank_map(const struct layout *layout, const char *filename);
+bool write_linker_script(const struct layout *layout, const char *filename);
+void layout_destroy(struct layout *layout);
+
+#endif /* LAYOUT_H */
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "loadcost.h"
+#include "output.h"
+
+/* ld a, [hl+] / ld [de], a / inc de, unrolled. */
+#define COPY_CYCLES_PER_BYTE 6
+
+/* Loading the 5 HDMA registers with ldh. */
+#define DMA_SETUP_CYCLES 20
+#define DMA_CYCLES_PER_BLOCK 8
+#define DMA_MAX_BLOCKS 128
+
+/*
+ * The reference RLE decoder: a header byte n gives n + 1 literal bytes
+ * below $80, or a run of n - $7D copies of the next byte from $80, as
+ * PackBits. Per packet, and per byte of each kind.
+ */
+#define RLE_MAX_LITERAL 128
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN 130
+#define RLE_PACKET_CYCLES 12
+#define RLE_LITERAL_CYCLES 10
+#define RLE_RUN_CYCLES 8
+
+static const char *method_names[N_LOAD_METHODS] = {
+	"VBlank copy", "GDMA", "HDMA", "RLE"
+};
+
+static uint32_t vblank_frames(uint32_t cycles);
+
+/*
+ * Estimate the cost of loading data into VRAM with the screen on. Copies
+ * and RLE decoding write VRAM directly, so only run in VBlank. GDMA halts
+ * the CPU but must also fit in VBlank, while HDMA runs during HBlank and
+ * leaves the CPU free in between.
+ */
+void estimate_load(const uint8_t *data, size_t len, struct load_cost *cost)
+{
+	memset(cost, 0, sizeof(*cost));
+	cost->size = len;
+	uint32_t n_blocks = (len + 15) / 16;
+
+	cost->cycles[LOAD_COPY] = COPY_CYCLES_PER_BYTE * len;
+	cost->frames[LOAD_COPY] = vblank_frames(cost->cycles[LOAD_COPY]);
+
+	uint32_t n_transfers = (n_blocks + DMA_MAX_BLOCKS - 1) / DMA_MAX_BLOCKS;
+	cost->cycles[LOAD_GDMA] = DMA_CYCLES_PER_BLOCK * n_blocks + DMA_SETUP_CYCLES * n_transfers;
+	uint32_t blocks_per_vblank = (VBLANK_CYCLES - DMA_SETUP_CYCLES) / DMA_CYCLES_PER_BLOCK;
+	cost->frames[LOAD_GDMA] = (n_blocks + blocks_per_vblank - 1) / blocks_per_vblank;
+
+	cost->cycles[LOAD_HDMA] = cost->cycles[LOAD_GDMA];
+	cost->frames[LOAD_HDMA] = (n_blocks + HBLANKS_PER_FRAME - 1) / HBLANKS_PER_FRAME;
+
+	/* Greedy PackBits: runs of RLE_MIN_RUN or more, literals between. */
+	uint32_t rle_cycles = 0;
+	size_t literal = 0;
+	for (size_t i = 0; i < len;) {
+		size_t run = 1;
+		while (i + run < len && run < RLE_MAX_RUN && data[i + run] == data[i]) {
+			run++;
+		}
+		if (run >= RLE_MIN_RUN) {
+			cost->rle_size += 2;
+			rle_cycles += RLE_PACKET_CYCLES + RLE_RUN_CYCLES * run;
+			literal = 0;
+			i += run;
+			continue;
+		}
+		if (literal % RLE_MAX_LITERAL == 0) {
+			cost->rle_size++;
+			rle_cycles += RLE_PACKET_CYCLES;
+		}
+		cost->rle_size++;
+		rle_cycles += RLE_LITERAL_CYCLES;
+		literal++;
+		i++;
+	}
+	cost->cycles[LOAD_RLE] = rle_cycles;
+	cost->frames[LOAD_RLE] = vblank_frames(rle_cycles);
+}
+
+/*
+ * Print the cost of loading each of the conversion's VRAM blocks, and of
+ * all of them, by each method.
+ */
+void print_load_costs(FILE *fp, const struct conversion *conv, const struct screens *screens, const char *name)
+{
+	struct block blocks[MAX_BLOCKS];
+	int n_blocks = list_blocks(conv, screens, blocks);
+	struct load_cost total = {0};
+
+	fprintf(fp, "%s%sLoad costs, in M-cycles and frames:\n", name ? name : "", name ? ": " : "");
+	fprintf(fp, "  %-18s %6s %6s", "Block", "Bytes", "RLE");
+	for (int m = 0; m < N_LOAD_METHODS; m++) {
+		fprintf(fp, " %15s", method_names[m]);
+	}
+	fprintf(fp, "\n");
+	for (int i = 0; i <= n_blocks; i++) {
+		struct load_cost cost;
+		const char *label = "Total";
+		if (i < n_blocks) {
+			/* Palettes and schedules go through BCPD, not VRAM. */
+			if (strncmp(blocks[i].label, "Palette", 7) == 0 || blocks[i].len == 0) {
+				continue;
+			}
+			estimate_load(blocks[i].data, blocks[i].len, &cost);
+			label = blocks[i].label;
+			total.size += cost.size;
+			total.rle_size += cost.rle_size;
+			for (int m = 0; m < N_LOAD_METHODS; m++) {
+				total.cycles[m] += cost.cycles[m];
+				total.frames[m] += cost.frames[m];
+			}
+		} else {
+			cost = total;
+		}
+		fprintf(fp, "  %-18s %6zu %6zu", label, cost.size, cost.rle_size);
+		for (int m = 0; m < N_LOAD_METHODS; m++) {
+			fprintf(fp, " %9u %5u", cost.cycles[m], cost.frames[m]);
+		}
+		fprintf(fp, "\n");
+	}
+}
+
+uint32_t vblank_frames(uint32_t cycles)
+{
+	return (cycles + VBLANK_CYCLES - 1) / VBLANK_CYCLES;
+}
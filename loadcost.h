@@ -0,0 +1,41 @@
+#ifndef LOADCOST_H
+#define LOADCOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "convert.h"
+#include "screen.h"
+
+/*
+ * Timings in M-cycles at normal speed. A frame is 154 lines of 114
+ * M-cycles, 10 of them in VBlank, and HDMA moves 16 bytes in each of the
+ * 144 HBlanks.
+ */
+#define VBLANK_CYCLES 1140
+#define HBLANKS_PER_FRAME 144
+
+enum load_method {
+	LOAD_COPY,
+	LOAD_GDMA,
+	LOAD_HDMA,
+	LOAD_RLE,
+	N_LOAD_METHODS
+};
+
+/*
+ * The estimated cost of loading one block into VRAM by each method: the
+ * CPU cycles spent, and the frames it takes with the screen on. rle_size
+ * is the size of the block in the RLE format the estimate assumes.
+ */
+struct load_cost {
+	size_t size;
+	size_t rle_size;
+	uint32_t cycles[N_LOAD_METHODS];
+	uint32_t frames[N_LOAD_METHODS];
+};
+
+void estimate_load(const uint8_t *data, size_t len, struct load_cost *cost);
+void print_load_costs(FILE *fp, const struct conversion *conv, const struct screens *screens, const char *name);
+
+#endif /* LOADCOST_H */
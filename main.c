@@ -8,416 +8,1036 @@
  *
  */
 
-#include <errno.h>
-#include <png.h>
+#include <getopt.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "batch.h"
+#include "convert.h"
+#include "deps.h"
+#include "dict.h"
+#include "dither.h"
+#include "image.h"
+#include "layout.h"
+#include "loadcost.h"
+#include "object.h"
+#include "output.h"
+#include "patch.h"
+#include "render.h"
+#include "report.h"
+#include "screen.h"
+#include "sprite.h"
+#include "tilemap.h"
+#include "usage.h"
 
-#define MAX_TILES 1024
-#define MAX_PALETTES 8
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-
-struct bitmap {
-	uint32_t *data;
-	uint16_t width;
-	uint16_t height;
-};
-
-struct tile {
-	unsigned int data_idx: 9;
-	unsigned int palette_idx: 3;
-	bool hflip: 1;
-	bool vflip: 1;
+enum {
+	OPT_PRIORITY_MASK = 256,
+	OPT_BANK_MASK,
+	OPT_LAYERS,
+	OPT_MAX_TILES,
+	OPT_HBLANK_WRITES,
+	OPT_DMG,
+	OPT_SGB,
+	OPT_PATCH,
+	OPT_SYM,
+	OPT_DICT,
+	OPT_SEED_TILES,
+	OPT_SEED_PALETTES,
+	OPT_DEPFILE,
+	OPT_DEP_TARGET,
+	OPT_VERIFY,
+	OPT_USAGE,
+	OPT_HEATMAP,
+	OPT_EXTRACT,
+	OPT_SOLVE,
+	OPT_BANK_MAP,
+	OPT_LINKER_SCRIPT,
+	OPT_FIRST_BANK,
+	OPT_LOAD_COSTS,
+	OPT_SPRITES,
+	OPT_REPORT,
+	OPT_BUDGET,
+	OPT_PNG_LIMITS,
+	OPT_TILEMAP
 };
 
-static void hex_to_palette(uint32_t hex[4], uint8_t palette[8]);
-static int colour_in_palette(uint32_t hex, uint8_t palette[8]);
-static uint16_t hex_to_gb(uint32_t hex);
-static int palette_in_list(uint8_t palette[8], int n_colours, uint8_t list[MAX_PALETTES][8], uint8_t colours_in_palettes[MAX_PALETTES]);
-static void sort_palette(uint8_t palette[8]);
-static struct tile tile_in_list(const uint8_t tile[16], uint8_t list[MAX_TILES * 16], int n_tiles);
-static bool tiles_equal(const uint8_t a[16], const uint8_t b[16]);
-static void flip_tile_horizontal(uint8_t tile[16]);
-static void flip_tile_vertical(uint8_t tile[16]);
-static struct bitmap load_png(const char *filename);
+static void usage(void);
+static bool load_mask(const char *filename, const struct png_limits *limits, const struct bitmap *bitmap, struct bitmap *mask);
+static bool split_layers(char *layers, struct bitmap *image, struct bitmap *priority, struct bitmap *bank);
+static bool region_in_bitmap(const struct region *region, const struct bitmap *bitmap);
+static struct bitmap mask_view(const struct bitmap *mask, const struct region *region);
+static char *join(const char *a, const char *b);
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2) {
-		fprintf(stderr, "Usage: gbctc input.png\n");
+	const char *binary_prefix = NULL;
+	const char *priority_filename = NULL;
+	const char *bank_filename = NULL;
+	char *layers = NULL;
+	const char *regions_filename = NULL;
+	int n_threads = 1;
+	int screen_width = 0;
+	int screen_height = 0;
+	int chunk_width = 0;
+	int chunk_height = 0;
+	int max_tiles = 0;
+	int hblank_writes = 0;
+	enum dither_mode dither = DITHER_NONE;
+	bool dmg = false;
+	bool sgb = false;
+	const char *patch_filename = NULL;
+	const char *sym_filename = NULL;
+	const char *object_filename = NULL;
+	const char *dict_path = NULL;
+	const char *seed_tiles_filename = NULL;
+	const char *seed_palettes_filename = NULL;
+	const char *depfile = NULL;
+	const char *dep_target = NULL;
+	bool verify = false;
+	const char *usage_filename = NULL;
+	const char *heatmap_filename = NULL;
+	bool extract = false;
+	int solve_ms = 0;
+	const char *bank_map_filename = NULL;
+	const char *linker_script_filename = NULL;
+	int first_bank = 1;
+	bool load_costs = false;
+	const char *sheet_filenames[MAX_SPRITE_SHEETS];
+	int n_sheets = 0;
+	const char *report_filename = NULL;
+	struct budget budget = {0};
+	bool budgeted = false;
+	const char *tilemap_filename = NULL;
+	struct png_limits png_limits = {
+		.max_width = DEFAULT_MAX_PNG_SIDE,
+		.max_height = DEFAULT_MAX_PNG_SIDE,
+		.max_pixels = DEFAULT_MAX_PNG_PIXELS,
+		.max_bytes = DEFAULT_MAX_PNG_BYTES
+	};
+
+	const struct option long_options[] = {
+		{"binary", required_argument, NULL, 'b'},
+		{"object", required_argument, NULL, 'o'},
+		{"priority-mask", required_argument, NULL, OPT_PRIORITY_MASK},
+		{"bank-mask", required_argument, NULL, OPT_BANK_MASK},
+		{"layers", required_argument, NULL, OPT_LAYERS},
+		{"regions", required_argument, NULL, 'r'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"screens", required_argument, NULL, 's'},
+		{"chunks", required_argument, NULL, 'c'},
+		{"dither", required_argument, NULL, 'd'},
+		{"max-tiles", required_argument, NULL, OPT_MAX_TILES},
+		{"hblank-writes", required_argument, NULL, OPT_HBLANK_WRITES},
+		{"dmg", no_argument, NULL, OPT_DMG},
+		{"sgb", no_argument, NULL, OPT_SGB},
+		{"patch", required_argument, NULL, OPT_PATCH},
+		{"sym", required_argument, NULL, OPT_SYM},
+		{"dict", required_argument, NULL, OPT_DICT},
+		{"seed-tiles", required_argument, NULL, OPT_SEED_TILES},
+		{"seed-palettes", required_argument, NULL, OPT_SEED_PALETTES},
+		{"depfile", required_argument, NULL, OPT_DEPFILE},
+		{"dep-target", required_argument, NULL, OPT_DEP_TARGET},
+		{"verify", no_argument, NULL, OPT_VERIFY},
+		{"usage", required_argument, NULL, OPT_USAGE},
+		{"heatmap", required_argument, NULL, OPT_HEATMAP},
+		{"extract", no_argument, NULL, OPT_EXTRACT},
+		{"solve", required_argument, NULL, OPT_SOLVE},
+		{"bank-map", required_argument, NULL, OPT_BANK_MAP},
+		{"linker-script", required_argument, NULL, OPT_LINKER_SCRIPT},
+		{"first-bank", required_argument, NULL, OPT_FIRST_BANK},
+		{"load-costs", no_argument, NULL, OPT_LOAD_COSTS},
+		{"sprites", required_argument, NULL, OPT_SPRITES},
+		{"report", required_argument, NULL, OPT_REPORT},
+		{"budget", required_argument, NULL, OPT_BUDGET},
+		{"png-limits", required_argument, NULL, OPT_PNG_LIMITS},
+		{"tilemap", required_argument, NULL, OPT_TILEMAP},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "b:o:r:j:s:c:d:h", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'b':
+				binary_prefix = optarg;
+				break;
+			case 'o':
+				object_filename = optarg;
+				break;
+			case 'r':
+				regions_filename = optarg;
+				break;
+			case 'j':
+				n_threads = strtol(optarg, NULL, 0);
+				if (n_threads < 1) {
+					fprintf(stderr, "Invalid number of jobs \"%s\".\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 's':
+				if (sscanf(optarg, "%dx%d", &screen_width, &screen_height) != 2
+						|| screen_width <= 0 || screen_height <= 0) {
+					fprintf(stderr, "Invalid screen size \"%s\".\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'c':
+				if (sscanf(optarg, "%dx%d", &chunk_width, &chunk_height) != 2
+						|| chunk_width <= 0 || chunk_height <= 0) {
+					fprintf(stderr, "Invalid chunk size \"%s\".\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'd':
+				if (strcmp(optarg, "ordered") == 0) {
+					dither = DITHER_ORDERED;
+				} else if (strcmp(optarg, "floyd-steinberg") == 0 || strcmp(optarg, "fs") == 0) {
+					dither = DITHER_FLOYD_STEINBERG;
+				} else {
+					fprintf(stderr, "Unknown dither mode \"%s\".\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_MAX_TILES:
+				max_tiles = strtol(optarg, NULL, 0);
+				if (max_tiles < 1 || max_tiles > MAX_TILES) {
+					fprintf(stderr, "Tile budget must be between 1 and %d.\n", MAX_TILES);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_HBLANK_WRITES:
+				hblank_writes = strtol(optarg, NULL, 0);
+				if (hblank_writes < 1) {
+					fprintf(stderr, "Invalid number of HBlank writes \"%s\".\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_DMG:
+				dmg = true;
+				break;
+			case OPT_SGB:
+				dmg = true;
+				sgb = true;
+				break;
+			case OPT_PATCH:
+				patch_filename = optarg;
+				break;
+			case OPT_SYM:
+				sym_filename = optarg;
+				break;
+			case OPT_DICT:
+				dict_path = optarg;
+				break;
+			case OPT_SEED_TILES:
+				seed_tiles_filename = optarg;
+				break;
+			case OPT_SEED_PALETTES:
+				seed_palettes_filename = optarg;
+				break;
+			case OPT_DEPFILE:
+				depfile = optarg;
+				break;
+			case OPT_DEP_TARGET:
+				dep_target = optarg;
+				break;
+			case OPT_VERIFY:
+				verify = true;
+				break;
+			case OPT_USAGE:
+				usage_filename = optarg;
+				break;
+			case OPT_HEATMAP:
+				heatmap_filename = optarg;
+				break;
+			case OPT_EXTRACT:
+				extract = true;
+				break;
+			case OPT_SOLVE:
+				solve_ms = strtol(optarg, NULL, 0);
+				if (solve_ms < 1) {
+					fprintf(stderr, "Solver deadline must be at least 1 ms.\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_BANK_MAP:
+				bank_map_filename = optarg;
+				break;
+			case OPT_LINKER_SCRIPT:
+				linker_script_filename = optarg;
+				break;
+			case OPT_FIRST_BANK:
+				first_bank = strtol(optarg, NULL, 0);
+				if (first_bank < 1 || first_bank > MAX_ROM_BANK) {
+					fprintf(stderr, "First bank must be between 1 and %d.\n", MAX_ROM_BANK);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_LOAD_COSTS:
+				load_costs = true;
+				break;
+			case OPT_SPRITES:
+				if (n_sheets == MAX_SPRITE_SHEETS) {
+					fprintf(stderr, "At most %d sprite sheets can be given.\n", MAX_SPRITE_SHEETS);
+					exit(EXIT_FAILURE);
+				}
+				sheet_filenames[n_sheets++] = optarg;
+				break;
+			case OPT_REPORT:
+				report_filename = optarg;
+				break;
+			case OPT_BUDGET:
+				if (!parse_budget(optarg, &budget)) {
+					exit(EXIT_FAILURE);
+				}
+				budgeted = true;
+				break;
+			case OPT_TILEMAP:
+				tilemap_filename = optarg;
+				break;
+			case OPT_PNG_LIMITS:
+				if (!parse_png_limits(optarg, &png_limits)) {
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case OPT_PRIORITY_MASK:
+				priority_filename = optarg;
+				break;
+			case OPT_BANK_MASK:
+				bank_filename = optarg;
+				break;
+			case OPT_LAYERS:
+				layers = optarg;
+				break;
+			case 'h':
+				usage();
+				exit(EXIT_SUCCESS);
+			default:
+				usage();
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	const char *filename = argv[optind];
+	if (screen_width && chunk_width) {
+		fprintf(stderr, "--screens and --chunks can't be used together.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (!patch_filename != !sym_filename) {
+		fprintf(stderr, "--patch and --sym must be used together.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (patch_filename && (chunk_width || dmg || binary_prefix)) {
+		fprintf(stderr, "--patch can't be used with --chunks, --dmg or --binary.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (object_filename && (chunk_width || dmg || binary_prefix || patch_filename)) {
+		fprintf(stderr, "--object can't be used with --chunks, --dmg, --binary or --patch.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (seed_palettes_filename && hblank_writes) {
+		fprintf(stderr, "--seed-palettes can't be used with --hblank-writes.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (verify && chunk_width) {
+		fprintf(stderr, "--verify can't be used with --chunks.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (extract && (screen_width || chunk_width || hblank_writes || max_tiles || dmg
+			|| patch_filename || object_filename || dict_path || seed_tiles_filename
+			|| priority_filename || bank_filename || layers || verify || usage_filename
+			|| heatmap_filename)) {
+		fprintf(stderr, "--extract only supports --binary, --regions, --jobs, --dither,\n"
+				"--seed-palettes and --depfile.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (solve_ms && (hblank_writes || seed_palettes_filename || chunk_width)) {
+		fprintf(stderr, "--solve can't be used with --hblank-writes, --seed-palettes or --chunks.\n");
+		exit(EXIT_FAILURE);
+	}
+	bool pack = bank_map_filename || linker_script_filename;
+	if (pack && (chunk_width || patch_filename || extract || dmg)) {
+		fprintf(stderr, "--bank-map and --linker-script can't be used with --chunks, --patch, --extract or --dmg.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (load_costs && (chunk_width || extract)) {
+		fprintf(stderr, "--load-costs can't be used with --chunks or --extract.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (n_sheets && (regions_filename || screen_width || chunk_width || seed_tiles_filename
+			|| extract || dmg || patch_filename || object_filename || pack || load_costs
+			|| dict_path || usage_filename || heatmap_filename)) {
+		fprintf(stderr, "--sprites can't be used with --regions, --screens, --chunks, --seed-tiles,\n"
+				"--extract, --dmg, --patch, --object, --bank-map, --load-costs, --dict,\n"
+				"--usage or --heatmap.\n");
+		exit(EXIT_FAILURE);
+	}
+	if ((report_filename || budgeted) && (chunk_width || extract || n_sheets)) {
+		fprintf(stderr, "--report and --budget can't be used with --chunks, --extract or --sprites.\n");
+		exit(EXIT_FAILURE);
+	}
+	if ((usage_filename || heatmap_filename) && chunk_width) {
+		fprintf(stderr, "--usage and --heatmap can't be used with --chunks.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (dmg && chunk_width) {
+		fprintf(stderr, "--dmg and --sgb can't be used with --chunks.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (tilemap_filename && (regions_filename || layers || priority_filename || bank_filename
+			|| chunk_width || hblank_writes || extract || n_sheets || dmg
+			|| heatmap_filename)) {
+		fprintf(stderr, "--tilemap can't be used with --regions, --layers, masks, --chunks,\n"
+				"--hblank-writes, --extract, --sprites, --dmg or --heatmap.\n");
 		exit(EXIT_FAILURE);
 	}
 
-	struct bitmap bitmap = load_png(argv[1]);
+	if (depfile) {
+		const char *inputs[] = {
+			filename, priority_filename, bank_filename, regions_filename,
+			seed_tiles_filename, seed_palettes_filename, sym_filename,
+			tilemap_filename
+		};
+		for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+			if (inputs[i]) {
+				depend_input(inputs[i]);
+			}
+		}
+		for (int i = 0; i < n_sheets; i++) {
+			depend_input(sheet_filenames[i]);
+		}
+	}
 
-	printf("%s: %ux%u\n", argv[1], bitmap.width, bitmap.height);
-	if (8 * (bitmap.width / 8) != bitmap.width
-			|| 8 * (bitmap.height / 8) != bitmap.height) {
-		fprintf(stderr, "Width and height must be multiples of 8.\n");
-		exit(EXIT_FAILURE);
+	uint8_t *seed_tiles = NULL;
+	size_t seed_tiles_len = 0;
+	if (seed_tiles_filename) {
+		seed_tiles = read_file(seed_tiles_filename, &seed_tiles_len);
+		if (!seed_tiles) {
+			exit(EXIT_FAILURE);
+		}
+		if (seed_tiles_len % 16 || seed_tiles_len > 16 * TILES_PER_BANK) {
+			fprintf(stderr, "%s must hold whole tiles, at most %d.\n", seed_tiles_filename, TILES_PER_BANK);
+			exit(EXIT_FAILURE);
+		}
+	}
+	uint8_t *seed_palettes = NULL;
+	size_t seed_palettes_len = 0;
+	if (seed_palettes_filename) {
+		seed_palettes = read_file(seed_palettes_filename, &seed_palettes_len);
+		if (!seed_palettes) {
+			exit(EXIT_FAILURE);
+		}
+		if (seed_palettes_len % 8 || seed_palettes_len > 8 * MAX_PALETTES) {
+			fprintf(stderr, "%s must hold whole palettes, at most %d.\n", seed_palettes_filename, MAX_PALETTES);
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	struct tile *tiles = calloc(MAX_TILES, sizeof(*tiles));
-	uint8_t *tile_data = calloc(16 * MAX_TILES, sizeof(*tile_data));
-	uint8_t palettes[MAX_PALETTES][8] = {0};
-	uint8_t used_colours_in_palettes[MAX_PALETTES] = {0};
+	struct bitmap image;
+	if (!load_png(filename, &png_limits, &image)) {
+		exit(EXIT_FAILURE);
+	}
+	struct bitmap sheets[MAX_SPRITE_SHEETS];
+	for (int i = 0; i < n_sheets; i++) {
+		if (!load_png(sheet_filenames[i], &png_limits, &sheets[i])) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	struct bitmap bitmap = image;
+	struct bitmap priority = {0};
+	struct bitmap bank = {0};
+	struct bitmap priority_image = {0};
+	struct bitmap bank_image = {0};
 
-	int n_tiles = 0;
-	int n_palettes = 0;
+	if (layers && !split_layers(layers, &bitmap, &priority, &bank)) {
+		exit(EXIT_FAILURE);
+	}
 
-	for (uint8_t ty = 0; ty < bitmap.height / 8; ty++) {
-		for (uint8_t tx = 0; tx < bitmap.width / 8; tx++) {
-			uint32_t base_idx = 8 * ty * bitmap.width + 8 * tx;
-			uint32_t colours[4] = {bitmap.data[base_idx]};
-			int n_colours = 1;
-			for (uint8_t y = 0; y < 8; y++) {
-				for (uint8_t x = 0; x < 8; x++) {
-					uint32_t idx = base_idx + y * bitmap.width + x;
-					uint32_t px = bitmap.data[idx];
-					int c_idx = -1;
-					for (int i = 0; i < 4; i++) {
-						if (px == colours[i]) {
-							c_idx = i;
-							break;
-						}
-					}
-					if (c_idx < 0) {
-						if (n_colours == 4) {
-							fprintf(stderr, "Error: More than 4 colours in tile (%u, %u).\n", tx, ty);
-							fprintf(stderr, "0: 0x%08X\n", colours[0]);
-							fprintf(stderr, "1: 0x%08X\n", colours[1]);
-							fprintf(stderr, "2: 0x%08X\n", colours[2]);
-							fprintf(stderr, "3: 0x%08X\n", colours[3]);
-							fprintf(stderr, "4: 0x%08X\n", px);
-							exit(EXIT_FAILURE);
-						}
-						colours[n_colours] = px;
-						n_colours++;
-					}
-				}
-			}
+	printf("%s: %ux%u\n", filename, bitmap.width, bitmap.height);
+	if (!regions_filename && !tilemap_filename && (8 * (bitmap.width / 8) != bitmap.width
+			|| 8 * (bitmap.height / 8) != bitmap.height)) {
+		fprintf(stderr, "Width and height must be multiples of 8.\n");
+		exit(EXIT_FAILURE);
+	}
+	/* Tilemaps share the tileset, so it's dithered once; regions dither on their own. */
+	if (tilemap_filename) {
+		dither_bitmap(&bitmap, dither);
+	}
 
-			uint8_t cur_palette[8];
-			hex_to_palette(colours, cur_palette);
-			int p_idx = palette_in_list(cur_palette, n_colours, palettes, used_colours_in_palettes);
-			tiles[32 * ty + tx].palette_idx = p_idx;
-			n_palettes = MAX(n_palettes, p_idx + 1);
+	if (priority_filename) {
+		if (!load_mask(priority_filename, &png_limits, &bitmap, &priority_image)) {
+			exit(EXIT_FAILURE);
+		}
+		priority = priority_image;
+	}
+	if (bank_filename) {
+		if (!load_mask(bank_filename, &png_limits, &bitmap, &bank_image)) {
+			exit(EXIT_FAILURE);
 		}
+		bank = bank_image;
 	}
-	for (int p_idx = 0; p_idx < n_palettes; p_idx++) {
-		sort_palette(palettes[p_idx]);
+
+	struct region whole = {
+		.width = bitmap.width,
+		.height = bitmap.height
+	};
+	struct region *regions = &whole;
+	int n_regions = 1;
+	if (regions_filename) {
+		regions = load_regions(regions_filename, &n_regions);
+		if (!regions) {
+			exit(EXIT_FAILURE);
+		}
 	}
-	for (uint8_t ty = 0; ty < bitmap.height / 8; ty++) {
-		for (uint8_t tx = 0; tx < bitmap.width / 8; tx++) {
-			uint32_t base_idx = 8 * ty * bitmap.width + 8 * tx;
-			uint8_t cur_data[16];
 
-			int p_idx = tiles[32 * ty + tx].palette_idx;
-			for (uint8_t y = 0; y < 8; y++) {
-				uint8_t upper = 0;
-				uint8_t lower = 0;
-				for (uint8_t x = 0; x < 8; x++) {
-					uint32_t idx = base_idx + y * bitmap.width + x;
-					uint32_t px = bitmap.data[idx];
-					int c_idx = colour_in_palette(px, palettes[p_idx]);
-					lower <<= 1;
-					upper <<= 1;
-					lower |= c_idx & 1;
-					upper |= (c_idx & 2) >> 1;
-				}
-				cur_data[2 * y] = lower;
-				cur_data[2 * y + 1] = upper;
+	struct tilemap *tilemaps = NULL;
+	int n_tilemaps = 0;
+	if (tilemap_filename) {
+		tilemaps = load_tilemaps(tilemap_filename, bitmap.width / 8, &n_tilemaps);
+		if (!tilemaps) {
+			exit(EXIT_FAILURE);
+		}
+		for (int i = 0; i < n_tilemaps; i++) {
+			if (!gather_tiles(&tilemaps[i], &bitmap)) {
+				exit(EXIT_FAILURE);
 			}
-			struct tile t = tile_in_list(cur_data, tile_data, n_tiles);
-			tiles[32 * ty + tx].data_idx = t.data_idx;
-			tiles[32 * ty + tx].hflip = t.hflip;
-			tiles[32 * ty + tx].vflip = t.vflip;
-			n_tiles = MAX(n_tiles, t.data_idx + 1);
-		}
-	}
-	for (int p_idx = 0; p_idx < n_palettes; p_idx++) {
-		uint8_t *cur_palette = palettes[p_idx];
-		printf("Palette%d:\n", p_idx);
-		for (int i = 0; i < 4; i++) {
-			printf("  db $%02X, $%02X\n", cur_palette[2 * i], cur_palette[2 * i+1]);
-		}
-	}
-	printf("TileData:\n");
-	for (int i = 0; i < n_tiles; i++) {
-		printf("  db ");
-		for (int j = 0; j < 15; j++) {
-			printf("$%02X,", tile_data[16 * i + j]);
-		}
-		printf("$%02X\n", tile_data[16 * i + 15]);
-	}
-	printf("Map:\n");
-	for (uint8_t ty = 0; ty < 32; ty++) {
-		printf("  db ");
-		for (uint8_t tx = 0; tx < 31; tx++) {
-			printf("$%02X,", tiles[32 * ty + tx].data_idx);
-		}
-		printf("$%02X\n", tiles[32 * ty + 31].data_idx);
-	}
-	printf("Attributes:\n");
-	for (uint8_t ty = 0; ty < 32; ty++) {
-		printf("  db ");
-		for (uint8_t tx = 0; tx < 31; tx++) {
-			uint8_t byte = tiles[32 * ty + tx].palette_idx;
-			byte |= tiles[32 * ty + tx].hflip << 5;
-			byte |= tiles[32 * ty + tx].vflip << 6;
-			printf("$%02X,", byte);
-		}
-		uint8_t byte = tiles[32 * ty + 31].palette_idx;
-		byte |= tiles[32 * ty + 31].hflip << 5;
-		byte |= tiles[32 * ty + 31].vflip << 6;
-		printf("$%02X\n", byte);
+		}
 	}
+	int n_jobs = tilemaps ? n_tilemaps : n_regions;
 
-	printf("Found %d tiles\n", n_tiles);
-	free(tiles);
-	free(tile_data);
-}
+	struct tile_dict dict;
+	if (dict_path && !dict_open(dict_path, &dict)) {
+		exit(EXIT_FAILURE);
+	}
+	struct object object = {0};
+	struct layout layout = {.first_bank = first_bank};
+	struct report report = {0};
+	struct rom rom = {0};
+	if (patch_filename && !load_rom(patch_filename, sym_filename, &rom)) {
+		exit(EXIT_FAILURE);
+	}
 
-void hex_to_palette(uint32_t hex[4], uint8_t palette[8])
-{
-	for (int c_idx = 0; c_idx < 4; c_idx++) {
-		uint16_t colour = hex_to_gb(hex[c_idx]);
+	/* Share the cores between the jobs running at once. */
+	long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int n_parallel = n_threads < n_jobs ? n_threads : n_jobs;
+	int solve_threads = n_cores > n_parallel ? n_cores / n_parallel : 1;
 
-		palette[2 * c_idx] = colour & 0xFFu;
-		palette[2 * c_idx + 1] = (colour >> 8u) & 0xFFu;
+	struct job *jobs = calloc(n_jobs, sizeof(*jobs));
+	for (int i = 0; i < n_jobs; i++) {
+		struct job *job = &jobs[i];
+		if (tilemaps) {
+			job->name = tilemaps[i].name[0] ? tilemaps[i].name : NULL;
+			job->bitmap = tilemaps[i].tiles;
+		} else {
+			struct region *region = &regions[i];
+			if (regions_filename && !region_in_bitmap(region, &bitmap)) {
+				exit(EXIT_FAILURE);
+			}
+			job->name = regions_filename ? region->name : NULL;
+			job->bitmap = bitmap_view(&bitmap, region->x, region->y, region->width, region->height);
+			job->priority = mask_view(&priority, region);
+			job->bank = mask_view(&bank, region);
+		}
+		job->opts.masks.priority = priority.data ? &job->priority : NULL;
+		job->opts.masks.bank = bank.data ? &job->bank : NULL;
+		job->opts.max_tiles = max_tiles;
+		job->opts.hblank_writes = hblank_writes;
+		job->opts.seed_tiles = seed_tiles;
+		job->opts.n_seed_tiles = seed_tiles_len / 16;
+		job->opts.seed_palettes = (const uint8_t (*)[8])seed_palettes;
+		job->opts.n_seed_palettes = seed_palettes_len / 8;
+		job->opts.extract = extract;
+		job->opts.solve_ms = solve_ms;
+		job->opts.solve_threads = solve_threads;
+		job->chunk_width = chunk_width;
+		job->chunk_height = chunk_height;
+		job->dmg_output = dmg;
+		job->sgb_output = sgb;
+		job->dither = tilemaps ? DITHER_NONE : dither;
 	}
-}
 
-uint16_t hex_to_gb(uint32_t hex)
-{
-	uint8_t r = (hex >> 3u) & 0x1Fu;
-	uint8_t g = (hex >> 11u) & 0x1Fu;
-	uint8_t b = (hex >> 19u) & 0x1Fu;
+	run_jobs(jobs, n_jobs, n_threads);
 
-	return r | (g << 5u) | (b << 10u);
-}
+	char *usage_buf = NULL;
+	size_t usage_len = 0;
+	FILE *usage_fp = usage_filename ? open_memstream(&usage_buf, &usage_len) : NULL;
+	struct bitmap heatmap = {0};
+	if (heatmap_filename) {
+		heatmap.width = bitmap.width;
+		heatmap.height = bitmap.height;
+		heatmap.stride = bitmap.width;
+		heatmap.data = calloc((size_t)heatmap.width * heatmap.height, sizeof(*heatmap.data));
+	}
 
-int colour_in_palette(uint32_t hex, uint8_t palette[8])
-{
-	uint16_t colour = hex_to_gb(hex);
-	uint8_t lo = colour & 0xFFu;
-	uint8_t hi = colour >> 8u;
-	for (int i = 0; i < 4; i++) {
-		if (lo == palette[2 * i] && hi == palette[2 * i + 1]) {
-			return i;
+	bool ok = true;
+	for (int i = 0; i < n_jobs; i++) {
+		struct job *job = &jobs[i];
+		if (!job->ok) {
+			ok = false;
+			continue;
+		}
+		if (tilemaps) {
+			printf("%s: %ux%u tiles, using %d from the tileset\n",
+					job->name ? job->name : tilemap_filename,
+					tilemaps[i].width, tilemaps[i].height, tilemaps[i].n_used);
+		} else if (job->name) {
+			printf("%s: %ux%u at (%u, %u)\n", job->name,
+					regions[i].width, regions[i].height,
+					regions[i].x, regions[i].y);
+		}
+		if (chunk_width) {
+			char *prefix = binary_prefix ? join(binary_prefix, job->name ? job->name : "") : NULL;
+			if (binary_prefix) {
+				if (!write_chunking(&job->chunking, prefix)) {
+					ok = false;
+				}
+			} else {
+				print_chunking(stdout, &job->chunking, job->name);
+			}
+			printf("Split into %d chunks\n", job->chunking.n_chunks);
+			if (dict_path) {
+				/* Each chunk's IDs go with it, and the shared tiles' after them. */
+				int n_known = 0;
+				int n_new = 0;
+				uint32_t ids[MAX_TILES];
+				char label[MAX_REGION_NAME + 32];
+				for (int c = 0; c < job->chunking.n_chunks; c++) {
+					int known, new;
+					int n_ids = dict_add_conversion(&dict, &job->chunking.chunks[c].conv, ids, &known, &new);
+					n_known += known;
+					n_new += new;
+					if (binary_prefix) {
+						snprintf(label, sizeof(label), ".chunk%d.ids", c);
+						if (!write_tile_ids(prefix, label, ids, n_ids)) {
+							ok = false;
+						}
+					} else {
+						snprintf(label, sizeof(label), "%s%sChunk%d", job->name ? job->name : "", job->name ? "_" : "", c);
+						print_tile_ids(stdout, label, "TileIds", ids, n_ids);
+					}
+				}
+				int n_shared = job->chunking.n_shared_tiles;
+				dict_add_tiles(&dict, job->chunking.shared_tiles, n_shared, ids, &n_known, &n_new);
+				if (n_shared && binary_prefix) {
+					if (!write_tile_ids(prefix, ".chunkshared.ids", ids, n_shared)) {
+						ok = false;
+					}
+				} else if (n_shared) {
+					print_tile_ids(stdout, job->name, "ChunkSharedTileIds", ids, n_shared);
+				}
+				printf("Dictionary: %d tiles already known, %d new\n", n_known, n_new);
+			}
+			free(prefix);
+			chunking_destroy(&job->chunking);
+			continue;
 		}
-	}
-	return -1;
-}
 
-int palette_in_list(uint8_t palette[8], int n_colours, uint8_t list[MAX_PALETTES][8], uint8_t colours_in_palettes[MAX_PALETTES])
-{
-	for (int i = 0; i < MAX_PALETTES; i++) {
-		bool palettes_equal = true;
-		for (int j = 0; j < 4 && j < n_colours; j++) {
-			bool found = false;
-			uint8_t c_in_p = colours_in_palettes[i];
-			for (int k = 0; k < 4 && k < c_in_p; k++) {
-				if (palette[2 * j] == list[i][2 * k] && palette[2 * j + 1] == list[i][2 * k + 1]) {
-					found = true;
+		struct sprites sprites;
+		if (n_sheets && !convert_sprites(sheets, n_sheets, &job->conv, &sprites)) {
+			ok = false;
+			conversion_destroy(&job->conv);
+			continue;
+		}
+		if (tilemaps) {
+			apply_tilemap(&tilemaps[i], &job->conv);
+		}
+		if (verify) {
+			/* A tilemap is checked against the world drawn from the tileset. */
+			struct bitmap world = {0};
+			if (tilemaps) {
+				draw_tilemap(&tilemaps[i], &bitmap, &world);
+			}
+			int n_mismatched = verify_conversion(tilemaps ? &world : &job->bitmap, &job->conv, false);
+			free(world.data);
+			if (n_mismatched != 0) {
+				fprintf(stderr, "Error: %d of %d tiles don't match the source.\n",
+						n_mismatched, job->conv.tiles_width * job->conv.tiles_height);
+				ok = false;
+				conversion_destroy(&job->conv);
+				continue;
+			}
+		}
+
+		struct screens screens;
+		if (screen_width) {
+			if (!dedup_screens(&job->conv, screen_width, screen_height, &screens)) {
+				ok = false;
+				conversion_destroy(&job->conv);
+				continue;
+			}
+		}
+		int first_section = object.n_sections;
+		if (patch_filename) {
+			int n_patched = patch_conversion(&rom, &job->conv, screen_width ? &screens : NULL, job->name);
+			if (n_patched < 0) {
+				ok = false;
+			} else {
+				printf("Patched %d blocks\n", n_patched);
+			}
+		} else if (object_filename) {
+			object_add_conversion(&object, &job->conv, screen_width ? &screens : NULL, job->name);
+		} else if (n_sheets && binary_prefix) {
+			if (!write_sprites(&sprites, &job->conv, binary_prefix)) {
+				ok = false;
+			}
+		} else if (n_sheets) {
+			print_sprites(stdout, &sprites, &job->conv);
+		} else if (extract && binary_prefix) {
+			char *prefix = join(binary_prefix, job->name ? job->name : "");
+			if (!write_tileset(&job->conv, prefix)) {
+				ok = false;
+			}
+			free(prefix);
+		} else if (extract) {
+			print_tileset(stdout, &job->conv, job->name);
+		} else if (binary_prefix) {
+			char *prefix = join(binary_prefix, job->name ? job->name : "");
+			if (!write_conversion(&job->conv, screen_width ? &screens : NULL, prefix)) {
+				ok = false;
+			}
+			free(prefix);
+		} else {
+			print_conversion(stdout, &job->conv, screen_width ? &screens : NULL, job->name);
+		}
+		if (pack) {
+			if (!object_filename) {
+				object_add_conversion(&object, &job->conv, screen_width ? &screens : NULL, job->name);
+			}
+			layout_add_sections(&layout, &object, first_section);
+		}
+		if (report_filename || budgeted) {
+			report_add(&report, job->name, regions_filename ? regions[i].area : NULL,
+					&job->conv, screen_width ? &screens : NULL, pack ? layout.n_groups - 1 : -1);
+		}
+		if (dmg) {
+			if (binary_prefix) {
+				char *prefix = join(binary_prefix, job->name ? job->name : "");
+				if (!write_dmg(&job->dmg, &job->conv, prefix)) {
+					ok = false;
 				}
+				free(prefix);
+			} else {
+				print_dmg(stdout, &job->dmg, &job->conv, job->name);
 			}
-			if (!found) {
-				if (c_in_p < 4) {
-					list[i][2 * c_in_p] = palette[2 * j];
-					list[i][2 * c_in_p + 1] = palette[2 * j + 1];
-					colours_in_palettes[i]++;
-				} else {
-					palettes_equal = false;
-					break;
+		}
+		if (seed_tiles) {
+			printf("Found %d tiles, %d new\n", job->conv.n_tiles, job->conv.n_tiles - job->conv.n_seed_tiles);
+		} else {
+			printf("Found %d tiles\n", job->conv.n_tiles);
+		}
+		if (dict_path) {
+			int n_known, n_new;
+			uint32_t ids[MAX_TILES];
+			int n_ids = dict_add_conversion(&dict, &job->conv, ids, &n_known, &n_new);
+			if (binary_prefix) {
+				char *prefix = join(binary_prefix, job->name ? job->name : "");
+				if (!write_tile_ids(prefix, ".ids", ids, n_ids)) {
+					ok = false;
 				}
+				free(prefix);
+			} else {
+				print_tile_ids(stdout, job->name, "TileIds", ids, n_ids);
 			}
+			printf("Dictionary: %d tiles already known, %d new\n", n_known, n_new);
+		}
+		if (hblank_writes) {
+			printf("Scheduled %d palettes with %d colour writes\n",
+					job->conv.n_raster_palettes,
+					job->conv.schedule_len / SCHEDULE_ENTRY_SIZE);
+		}
+		if (dmg) {
+			printf("Found %d DMG tiles, %d shared with CGB\n",
+					job->dmg.n_shared + job->dmg.n_tiles, job->dmg.n_shared);
+			dmg_destroy(&job->dmg);
 		}
-		if (palettes_equal) {
-			return i;
+		if (verify) {
+			printf("Verified %d tiles\n", job->conv.tiles_width * job->conv.tiles_height);
 		}
+		if (n_sheets) {
+			printf("Found %d OBJ tiles, %d shared with the BG\n", sprites.n_obj_tiles, sprites.n_shared);
+			sprites_destroy(&sprites);
+		}
+		if (load_costs) {
+			print_load_costs(stdout, &job->conv, screen_width ? &screens : NULL, job->name);
+		}
+		if (usage_fp) {
+			print_usage(usage_fp, &job->conv, job->name);
+		}
+		if (heatmap.data) {
+			paint_heatmap(&heatmap, &job->conv, regions[i].x, regions[i].y);
+		}
+		if (screen_width) {
+			printf("Found %d unique screens out of %d\n", screens.n_screens,
+					screens.world_width * screens.world_height);
+			screens_destroy(&screens);
+		}
+		conversion_destroy(&job->conv);
 	}
-	return -1;
-}
 
-int cmp(const void *a, const void *b)
-{
-	uint32_t sums[2] = {0};
-	uint8_t tmp[4];
-	memcpy(tmp, a, 2);
-	memcpy(tmp + 2, b, 2);
-	for (int i = 0; i < 2; i++) {
-		int r = tmp[2 * i] & 0x1Fu;
-		int g = (tmp[2 * i] & 0x70u) >> 5u;
-		g |= (tmp[2 * i + 1] & 0x03u) << 3u;
-		int b = (tmp[2 * i + 1] & 0x7Cu) >> 2u;
-		sums[i] = r + b + g;
-	}
-	return sums[0] - sums[1];
-}
-
-void sort_palette(uint8_t palette[8]) {
-	uint16_t tmp[4];
-	memcpy(tmp, palette, sizeof(tmp));
-	qsort(tmp, 4, sizeof(*tmp), cmp);
-	memcpy(palette, tmp, sizeof(tmp));
+	if (dict_path) {
+		printf("Dictionary holds %u tiles\n", dict.n_file_tiles + dict.n_new_tiles);
+		if (!dict_close(&dict)) {
+			ok = false;
+		}
+	}
+	if (pack) {
+		if (ok && pack_banks(&layout)) {
+			printf("Packed %d sections into %d banks\n", layout.n_items, layout.n_banks);
+			if ((bank_map_filename && !write_bank_map(&layout, bank_map_filename))
+					|| (linker_script_filename && !write_linker_script(&layout, linker_script_filename))) {
+				ok = false;
+			}
+		} else {
+			ok = false;
+		}
+	}
+	if (budgeted && !check_budgets(&report, &budget)) {
+		ok = false;
+	}
+	if (report_filename && !write_report(&report, &budget, pack ? &layout : NULL, report_filename)) {
+		ok = false;
+	}
+	report_destroy(&report);
+	layout_destroy(&layout);
+	if (object_filename && ok && !write_object(&object, object_filename, filename)) {
+		ok = false;
+	}
+	object_destroy(&object);
+	if (patch_filename) {
+		if (ok && !save_rom(&rom, patch_filename)) {
+			ok = false;
+		}
+		rom_destroy(&rom);
+	}
+	if (usage_fp) {
+		fclose(usage_fp);
+		if (ok && !write_file(usage_filename, (const uint8_t *)usage_buf, usage_len)) {
+			ok = false;
+		}
+		free(usage_buf);
+	}
+	if (heatmap.data) {
+		if (ok && !save_png(heatmap_filename, &heatmap)) {
+			ok = false;
+		}
+		free(heatmap.data);
+	}
+	if (depfile && ok && !write_depfile(depfile, dep_target)) {
+		ok = false;
+	}
+	for (int i = 0; i < n_jobs; i++) {
+		free(jobs[i].dithered);
+	}
+	free(jobs);
+	if (regions != &whole) {
+		free(regions);
+	}
+	if (tilemaps) {
+		tilemaps_destroy(tilemaps, n_tilemaps);
+	}
+	free(image.data);
+	free(seed_tiles);
+	free(seed_palettes);
+	free(priority_image.data);
+	free(bank_image.data);
+	for (int i = 0; i < n_sheets; i++) {
+		free(sheets[i].data);
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-struct tile tile_in_list(const uint8_t tile[16], uint8_t list[MAX_TILES * 16], int n_tiles)
+void usage(void)
 {
-	struct tile ret = {0};
-	uint8_t tmp[16];
-	bool found = false;
-	for (int i = 0; i < n_tiles; i++) {
-		memcpy(tmp, tile, 16);
-		if (tiles_equal(tmp, &list[16 * i])) {
-			ret.data_idx = i;
-			found = true;
-			break;
-		}
-		flip_tile_horizontal(tmp);
-		if (tiles_equal(tmp, &list[16 * i])) {
-			ret.data_idx = i;
-			ret.hflip = true;
-			found = true;
-			break;
-		}
-		flip_tile_horizontal(tmp);
-		flip_tile_vertical(tmp);
-		if (tiles_equal(tmp, &list[16 * i])) {
-			ret.data_idx = i;
-			ret.vflip = true;
-			found = true;
-			break;
-		}
-		flip_tile_horizontal(tmp);
-		if (tiles_equal(tmp, &list[16 * i])) {
-			ret.data_idx = i;
-			ret.hflip = true;
-			ret.vflip = true;
-			found = true;
-			break;
-		}
-	}
-	if (!found) {
-		memcpy(&list[16 * n_tiles], tile, 16);
-		ret.data_idx = n_tiles;
-	}
-	return ret;
+	fprintf(stderr,
+"Usage: gbctc [options] input.png\n"
+"\n"
+"By default, palettes, tile data, map and attributes are printed to stdout\n"
+"as assembly.\n"
+"\n"
+"Options:\n"
+"  -b, --binary PREFIX     Write raw binaries to PREFIX.pal, PREFIX.2bpp,\n"
+"                          PREFIX.tilemap and PREFIX.attrmap instead.\n"
+"  -o, --object FILE       Write an RGBDS object file instead, with a section\n"
+"                          and an exported label for each block.\n"
+"      --priority-mask FILE\n"
+"                          Set the BG-to-OAM priority bit for tiles with any\n"
+"                          opaque, non-black pixel in FILE.\n"
+"      --bank-mask FILE    Place tiles marked in FILE in VRAM bank 1.\n"
+"      --layers LIST       Read masks from the input image itself. The image\n"
+"                          is split vertically into equal layers: colour\n"
+"                          first, then the comma-separated LIST of\n"
+"                          \"priority\" and \"bank\" layers in order.\n"
+"  -r, --regions FILE      Convert each region listed in FILE separately,\n"
+"                          with labels and filenames prefixed by its name.\n"
+"                          Each line of FILE is \"name x y width height\",\n"
+"                          optionally followed by the name of an area.\n"
+"      --tilemap FILE      Convert the map in a Tiled (TMX or JSON) file or\n"
+"                          each level of an LDtk project, with the input\n"
+"                          image as its tileset.\n"
+"  -j, --jobs N            Convert up to N regions in parallel.\n"
+"  -s, --screens WxH       Split the map into screens of W by H tiles, and\n"
+"                          output each distinct screen once, plus a world\n"
+"                          map of screen indices.\n"
+"  -c, --chunks WxH        Split an image too big for VRAM into chunks of\n"
+"                          whole W by H tile screens, each of which fits the\n"
+"                          tile and palette budget on its own.\n"
+"  -d, --dither MODE       Quantise a full-colour image to 8 palettes of 4\n"
+"                          RGB555 colours first, dithering each tile with\n"
+"                          its palette's colours. MODE is \"ordered\" or\n"
+"                          \"floyd-steinberg\".\n"
+"      --max-tiles N       Limit the number of unique tiles (default 512).\n"
+"      --hblank-writes N   Allow more than 8 palettes, as long as each row\n"
+"                          of tiles needs at most 8, by rewriting palettes\n"
+"                          in HBlank with up to N colour writes per line.\n"
+"                          The writes are output as a PaletteSchedule.\n"
+"      --dmg               Also output DMG tile data and map, using BGP\n"
+"                          $1B and sharing tiles with the CGB tile data.\n"
+"      --sgb               As --dmg, plus 4 SGB palettes and an attribute\n"
+"                          file. The image must be 160x144.\n"
+"      --patch ROM         Write the palettes, tile data, map and attributes\n"
+"                          straight into ROM at the labels of the same\n"
+"                          names, then fix the header checksums.\n"
+"      --sym FILE          The RGBDS symbol file for the ROM being patched.\n"
+"      --dict PATH         Look up each tile, in any orientation, in the\n"
+"                          tile dictionary PATH.dat and PATH.idx shared\n"
+"                          between conversions, adding any new ones, and\n"
+"                          output each tile's global ID as TileIds.\n"
+"      --seed-tiles FILE   Start from the tiles in FILE, as raw 2bpp data\n"
+"                          already in VRAM at tile 0 onwards. They are\n"
+"                          reused, and only new tiles are output.\n"
+"      --seed-palettes FILE\n"
+"                          Start from the palettes in FILE, fixed as the\n"
+"                          first palettes, and reuse them where possible.\n"
+"      --depfile FILE      Write a make rule to FILE, with every output file\n"
+"                          depending on every input file.\n"
+"      --dep-target NAME   Add NAME to the targets of the rule, e.g. for\n"
+"                          output printed to stdout.\n"
+"      --verify            Render the result back from the palettes, tiles,\n"
+"                          map and attributes, and check it matches the\n"
+"                          image, including any palette schedule.\n"
+"      --usage FILE        Write each tile's use count, flips and palettes\n"
+"                          to FILE, most used first.\n"
+"      --heatmap FILE      Write a PNG the size of the image to FILE, with\n"
+"                          each tile red if it's used once, or green,\n"
+"                          brighter the more it's reused.\n"
+"      --solve MS          Search for the palette assignment with the fewest\n"
+"                          palettes and colours for up to MS milliseconds,\n"
+"                          on every core, instead of assigning greedily.\n"
+"      --bank-map FILE     Pack the output blocks into 16 KiB ROMX banks,\n"
+"                          keeping each conversion in one bank where it\n"
+"                          fits, and write where each one goes to FILE.\n"
+"      --linker-script FILE\n"
+"                          Write the same placement as an rgblink linker\n"
+"                          script, for the sections of --object.\n"
+"      --first-bank N      Start packing from ROM bank N (default 1).\n"
+"      --load-costs        Estimate the CPU cycles and frames needed to load\n"
+"                          each block into VRAM by copying in VBlank, GDMA,\n"
+"                          HDMA and RLE decoding.\n"
+"      --sprites FILE      Also convert the sprite sheet FILE, sharing tiles\n"
+"                          with the BG in the $8800 block. The BG then uses\n"
+"                          $8800 addressing. Can be given up to 8 times.\n"
+"      --report FILE       Write the tiles, palettes and bytes of each\n"
+"                          conversion and each area to FILE as JSON, with\n"
+"                          their banks if packed.\n"
+"      --budget LIST       Fail if any conversion or area goes over a limit\n"
+"                          in the comma-separated LIST of tiles=N,\n"
+"                          palettes=N, map=BYTES, asset=BYTES and\n"
+"                          area=BYTES.\n"
+"      --png-limits LIST   Refuse PNGs over any limit in the comma-separated\n"
+"                          LIST of width=N, height=N, pixels=N and\n"
+"                          bytes=N (decoded), before decoding them.\n"
+"      --extract           Only output the palettes and unique tiles, with\n"
+"                          no limit on their number and no map.\n"
+"  -h, --help              Show this help.\n"
+);
 }
 
-bool tiles_equal(const uint8_t a[16], const uint8_t b[16])
+bool load_mask(const char *filename, const struct png_limits *limits, const struct bitmap *bitmap, struct bitmap *mask)
 {
-	for (int i = 0; i < 16; i++) {
-		if (a[i] != b[i]) {
-			return false;
-		}
+	if (!load_png(filename, limits, mask)) {
+		return false;
+	}
+	if (mask->width != bitmap->width || mask->height != bitmap->height) {
+		fprintf(stderr, "Mask %s is %ux%u, but the image is %ux%u.\n",
+				filename, mask->width, mask->height,
+				bitmap->width, bitmap->height);
+		return false;
 	}
 	return true;
 }
 
-void flip_tile_horizontal(uint8_t tile[16])
+/*
+ * Split a vertically stacked image into its colour layer and the mask
+ * layers named in the comma-separated list. The layers are views into
+ * the same image data.
+ */
+bool split_layers(char *layers, struct bitmap *image, struct bitmap *priority, struct bitmap *bank)
 {
-	for (int i = 0; i < 16; i++) {
-		for (int b = 0; b < 4; b++) {
-			uint8_t tmp1 = (tile[i] >> b) & 1u;
-			uint8_t tmp2 = (tile[i] >> (7 - b)) & 1u;
-			tile[i] &= ~(1 << b);
-			tile[i] &= ~(1 << (7 - b));
-			tile[i] |= tmp1 << (7 - b);
-			tile[i] |= tmp2 << b;
+	struct bitmap *order[2];
+	int n_layers = 0;
+	for (char *name = strtok(layers, ","); name; name = strtok(NULL, ",")) {
+		struct bitmap *layer;
+		if (strcmp(name, "priority") == 0) {
+			layer = priority;
+		} else if (strcmp(name, "bank") == 0) {
+			layer = bank;
+		} else {
+			fprintf(stderr, "Unknown layer \"%s\".\n", name);
+			return false;
 		}
-	}
-}
-
-void flip_tile_vertical(uint8_t tile[16])
-{
-	uint16_t tmp[8];
-	memcpy(tmp, tile, 16);
-	for (int i = 0; i < 4; i++) {
-		uint16_t t = tmp[i];
-		tmp[i] = tmp[7 - i];
-		tmp[7 - i] = t;
-	}
-	memcpy(tile, tmp, 16);
-}
-
-#define HEADER_BYTES 8
-
-struct bitmap load_png(const char *filename)
-{
-	FILE *fp = fopen(filename, "rb");
-	uint8_t header[HEADER_BYTES];
-	struct bitmap bitmap = {0};
-	if (!fp) {
-		fprintf(stderr, "Couldn't open %s: %s\n", filename, strerror(errno));
-		return bitmap;
-	}
-	if (fread(header, 1, HEADER_BYTES, fp) == 0) {
-		fprintf(stderr, "Failed to read fontmap data: %s\n", filename);
-		fclose(fp);
-		return bitmap;
-	}
-	if (png_sig_cmp(header, 0, HEADER_BYTES)) {
-		fprintf(stderr, "Not a PNG file: %s\n", filename);
-		fclose(fp);
-		return bitmap;
+		for (int i = 0; i < n_layers; i++) {
+			if (order[i] == layer) {
+				fprintf(stderr, "Layer \"%s\" given twice.\n", name);
+				return false;
+			}
+		}
+		order[n_layers++] = layer;
 	}
 
-	png_structp png_ptr = png_create_read_struct(
-			PNG_LIBPNG_VER_STRING,
-			NULL, NULL, NULL);
-	if (!png_ptr) {
-		fprintf(stderr, "Couldn't create PNG read struct.\n");
-		fclose(fp);
-		return bitmap;
+	uint32_t height = image->height / (n_layers + 1);
+	if (height * (n_layers + 1) != image->height) {
+		fprintf(stderr, "Image height %u can't be split into %d layers.\n",
+				image->height, n_layers + 1);
+		return false;
 	}
-
-	png_infop info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr) {
-		png_destroy_read_struct(&png_ptr, NULL, NULL);
-		fclose(fp);
-		fprintf(stderr, "Couldn't create PNG info struct.\n");
-		return bitmap;
+	for (int i = 0; i < n_layers; i++) {
+		*order[i] = bitmap_view(image, 0, height * (i + 1), image->width, height);
 	}
+	*image = bitmap_view(image, 0, 0, image->width, height);
+	return true;
+}
 
-	if (setjmp(png_jmpbuf(png_ptr)) != 0) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		fclose(fp);
-		fprintf(stderr, "Couldn't setjmp for libpng.\n");
-		return bitmap;
+bool region_in_bitmap(const struct region *region, const struct bitmap *bitmap)
+{
+	if (region->x % 8 || region->y % 8 || region->width % 8 || region->height % 8) {
+		fprintf(stderr, "Region %s must be aligned to 8 pixels.\n", region->name);
+		return false;
 	}
-
-	png_init_io(png_ptr, fp);
-	png_set_sig_bytes(png_ptr, HEADER_BYTES);
-	png_read_info(png_ptr, info_ptr);
-
-	bitmap.width = png_get_image_width(png_ptr, info_ptr);
-	bitmap.height = png_get_image_height(png_ptr, info_ptr);
-	uint32_t bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-	uint32_t colour_type = png_get_color_type(png_ptr, info_ptr);
-	
-	bitmap.data = calloc(bitmap.width * bitmap.height, sizeof(*bitmap.data));
-
-	png_bytepp row_pointers = calloc(bitmap.height, sizeof(png_bytep));
-	for (uint32_t y = 0; y < bitmap.height; y++) {
-		row_pointers[y] = (unsigned char *)&bitmap.data[y * bitmap.width];
+	if ((uint32_t)region->x + region->width > bitmap->width
+			|| (uint32_t)region->y + region->height > bitmap->height) {
+		fprintf(stderr, "Region %s is outside of the %ux%u image.\n",
+				region->name, bitmap->width, bitmap->height);
+		return false;
 	}
+	return true;
+}
 
-	if (bit_depth < 8) {
-		png_set_packing(png_ptr);
-	}
-	if (colour_type == PNG_COLOR_TYPE_RGB) {
-		png_set_filler(png_ptr, 0xFFu, PNG_FILLER_AFTER);
+struct bitmap mask_view(const struct bitmap *mask, const struct region *region)
+{
+	if (!mask->data) {
+		return *mask;
 	}
-	png_read_image(png_ptr, row_pointers);
-	png_read_end(png_ptr, NULL);
+	return bitmap_view(mask, region->x, region->y, region->width, region->height);
+}
 
-	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-	free(row_pointers);
-	fclose(fp);
-	return bitmap;
+char *join(const char *a, const char *b)
+{
+	size_t size = strlen(a) + strlen(b) + 1;
+	char *str = malloc(size);
+	snprintf(str, size, "%s%s", a, b);
+	return str;
 }
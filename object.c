@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "object.h"
+#include "output.h"
+
+#define SYMBOL_EXPORT 2
+#define SECTION_ROMX 2
+#define NODE_FILE 1
+
+static int add_section(struct object *object, const char *name);
+static void add_symbol(struct object *object, const char *name, int section, uint32_t value);
+static void append(struct object_section *section, const uint8_t *data, size_t len);
+static void put_long(FILE *fp, uint32_t value);
+static void put_string(FILE *fp, const char *str);
+
+/*
+ * Add the blocks of a conversion, labelled as in the assembly output.
+ */
+void object_add_conversion(struct object *object, const struct conversion *conv, const struct screens *screens, const char *name)
+{
+	struct block blocks[MAX_BLOCKS];
+	int n_blocks = list_blocks(conv, screens, blocks);
+	int palettes = -1;
+	for (int i = 0; i < n_blocks; i++) {
+		char label[MAX_OBJECT_NAME];
+		snprintf(label, sizeof(label), "%s%s%s", name ? name : "", name ? "_" : "", blocks[i].label);
+		int section;
+		if (strncmp(blocks[i].label, "Palette", 7) == 0 && strcmp(blocks[i].label, "PaletteSchedule") != 0) {
+			if (palettes < 0) {
+				char section_name[MAX_OBJECT_NAME];
+				snprintf(section_name, sizeof(section_name), "%s%sPalettes", name ? name : "", name ? "_" : "");
+				palettes = add_section(object, section_name);
+			}
+			section = palettes;
+		} else {
+			section = add_section(object, label);
+		}
+		add_symbol(object, label, section, object->sections[section].size);
+		append(&object->sections[section], blocks[i].data, blocks[i].len);
+	}
+}
+
+/*
+ * Write the object file, with source as the name of the file it came
+ * from. Sections are floating, and have no patches. The file is built in
+ * memory first, so it is only rewritten if it changed.
+ */
+bool write_object(const struct object *object, const char *filename, const char *source)
+{
+	char *buf;
+	size_t len;
+	FILE *fp = open_memstream(&buf, &len);
+	fwrite(OBJECT_MAGIC, 1, 4, fp);
+	put_long(fp, OBJECT_REVISION);
+	put_long(fp, object->n_symbols);
+	put_long(fp, object->n_sections);
+
+	/* A single file node, for the input image. */
+	put_long(fp, 1);
+	put_long(fp, UINT32_MAX);
+	put_long(fp, 0);
+	fputc(NODE_FILE, fp);
+	put_string(fp, source);
+
+	for (int i = 0; i < object->n_symbols; i++) {
+		const struct object_symbol *symbol = &object->symbols[i];
+		put_string(fp, symbol->name);
+		fputc(SYMBOL_EXPORT, fp);
+		put_long(fp, 0);
+		put_long(fp, 0);
+		put_long(fp, symbol->section);
+		put_long(fp, symbol->value);
+	}
+
+	for (int i = 0; i < object->n_sections; i++) {
+		const struct object_section *section = &object->sections[i];
+		put_string(fp, section->name);
+		put_long(fp, section->size);
+		fputc(SECTION_ROMX, fp);
+		put_long(fp, UINT32_MAX);
+		put_long(fp, UINT32_MAX);
+		fputc(0, fp);
+		put_long(fp, 0);
+		fwrite(section->data, 1, section->size, fp);
+		put_long(fp, 0);
+	}
+
+	/* No assertions. */
+	put_long(fp, 0);
+
+	fclose(fp);
+	bool ret = write_file(filename, (uint8_t *)buf, len);
+	free(buf);
+	return ret;
+}
+
+void object_destroy(struct object *object)
+{
+	for (int i = 0; i < object->n_sections; i++) {
+		free(object->sections[i].data);
+	}
+	free(object->sections);
+	free(object->symbols);
+	object->sections = NULL;
+	object->symbols = NULL;
+	object->n_sections = 0;
+	object->n_symbols = 0;
+}
+
+int add_section(struct object *object, const char *name)
+{
+	object->sections = realloc(object->sections, (object->n_sections + 1) * sizeof(*object->sections));
+	struct object_section *section = &object->sections[object->n_sections];
+	snprintf(section->name, sizeof(section->name), "%s", name);
+	section->data = NULL;
+	section->size = 0;
+	return object->n_sections++;
+}
+
+void add_symbol(struct object *object, const char *name, int section, uint32_t value)
+{
+	object->symbols = realloc(object->symbols, (object->n_symbols + 1) * sizeof(*object->symbols));
+	struct object_symbol *symbol = &object->symbols[object->n_symbols++];
+	snprintf(symbol->name, sizeof(symbol->name), "%s", name);
+	symbol->section = section;
+	symbol->value = value;
+}
+
+void append(struct object_section *section, const uint8_t *data, size_t len)
+{
+	section->data = realloc(section->data, section->size + len);
+	memcpy(&section->data[section->size], data, len);
+	section->size += len;
+}
+
+void put_long(FILE *fp, uint32_t value)
+{
+	for (int i = 0; i < 4; i++) {
+		fputc((value >> (8 * i)) & 0xFFu, fp);
+	}
+}
+
+void put_string(FILE *fp, const char *str)
+{
+	fwrite(str, 1, strlen(str) + 1, fp);
+}
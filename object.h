@@ -0,0 +1,44 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "convert.h"
+#include "screen.h"
+
+/* RGBDS 0.6 object files. */
+#define OBJECT_MAGIC "RGB9"
+#define OBJECT_REVISION 9
+#define MAX_OBJECT_NAME 96
+
+struct object_section {
+	char name[MAX_OBJECT_NAME];
+	uint8_t *data;
+	size_t size;
+};
+
+struct object_symbol {
+	char name[MAX_OBJECT_NAME];
+	int section;
+	uint32_t value;
+};
+
+/*
+ * An RGBDS object file being built up from conversions. Each block gets
+ * its own floating ROMX section and an exported label at its start,
+ * except the palettes, which share one section. Data is copied in, so
+ * conversions can be destroyed before the file is written.
+ */
+struct object {
+	struct object_section *sections;
+	int n_sections;
+	struct object_symbol *symbols;
+	int n_symbols;
+};
+
+void object_add_conversion(struct object *object, const struct conversion *conv, const struct screens *screens, const char *name);
+bool write_object(const struct object *object, const char *filename, const char *source);
+void object_destroy(struct object *object);
+
+#endif /* OBJECT_H */
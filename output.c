@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "deps.h"
+#include "output.h"
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+static void print_table(FILE *fp, const char *name, const char *label, const uint8_t *data, size_t len, size_t row_len);
+static bool file_unchanged(const char *filename, const uint8_t *data, size_t len);
+static bool write_part(const char *prefix, const char *extension, const uint8_t *data, size_t len);
+
+/*
+ * Print the conversion as assembly. If name is given, labels are prefixed
+ * with it, e.g. name_TileData. If screens are given, they replace the
+ * map and attributes. Seeded tiles are left out of TileData, which goes
+ * in VRAM straight after them.
+ */
+void print_conversion(FILE *fp, const struct conversion *conv, const struct screens *screens, const char *name)
+{
+	for (int p_idx = 0; p_idx < conv->n_palettes; p_idx++) {
+		const uint8_t *cur_palette = conv->palettes[p_idx];
+		fprintf(fp, "%s%sPalette%d:\n", name ? name : "", name ? "_" : "", p_idx);
+		for (int i = 0; i < 4; i++) {
+			fprintf(fp, "  db $%02X, $%02X\n", cur_palette[2 * i], cur_palette[2 * i+1]);
+		}
+	}
+	if (conv->schedule) {
+		print_table(fp, name, "PaletteSchedule", conv->schedule, conv->schedule_len - 1, SCHEDULE_ENTRY_SIZE);
+		fprintf(fp, "  db $%02X\n", SCHEDULE_END);
+	}
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	print_table(fp, name, "TileData", &conv->tile_data[16 * conv->n_seed_tiles], 16 * (conv->bank_tiles[0] - conv->n_seed_tiles), 16);
+	if (conv->bank_tiles[1] > 0) {
+		print_table(fp, name, "TileDataBank1", &conv->tile_data[16 * TILES_PER_BANK], 16 * conv->bank_tiles[1], 16);
+	}
+	if (screens) {
+		size_t screens_size = (size_t)screens->n_screens * screens->width * screens->height;
+		size_t world_size = (size_t)screens->world_width * screens->world_height;
+		print_table(fp, name, "ScreenMaps", screens->map, screens_size, screens->width);
+		print_table(fp, name, "ScreenAttributes", screens->attributes, screens_size, screens->width);
+		print_table(fp, name, "WorldMap", screens->world, world_size, screens->world_width);
+		return;
+	}
+	print_table(fp, name, "Map", conv->map, map_size, conv->map_width);
+	print_table(fp, name, "Attributes", conv->attributes, map_size, conv->map_width);
+}
+
+/*
+ * Write the conversion as raw binaries next to each other, named
+ * prefix.pal, prefix.2bpp, prefix.tilemap and prefix.attrmap. Tiles in
+ * VRAM bank 1, if any, go in prefix.bank1.2bpp.
+ *
+ * A palette schedule, if any, goes in prefix.schedule.
+ *
+ * With screens, the map and attributes are replaced by the unique
+ * screens in prefix.screens.tilemap and prefix.screens.attrmap, and the
+ * screen indices in prefix.world.
+ */
+bool write_conversion(const struct conversion *conv, const struct screens *screens, const char *prefix)
+{
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	if (conv->bank_tiles[1] > 0
+			&& !write_part(prefix, ".bank1.2bpp", &conv->tile_data[16 * TILES_PER_BANK], 16 * conv->bank_tiles[1])) {
+		return false;
+	}
+	if (conv->schedule
+			&& !write_part(prefix, ".schedule", conv->schedule, conv->schedule_len)) {
+		return false;
+	}
+	if (!write_part(prefix, ".pal", &conv->palettes[0][0], 8 * conv->n_palettes)
+			|| !write_part(prefix, ".2bpp", &conv->tile_data[16 * conv->n_seed_tiles], 16 * (conv->bank_tiles[0] - conv->n_seed_tiles))) {
+		return false;
+	}
+	if (screens) {
+		size_t screens_size = (size_t)screens->n_screens * screens->width * screens->height;
+		size_t world_size = (size_t)screens->world_width * screens->world_height;
+		return write_part(prefix, ".screens.tilemap", screens->map, screens_size)
+			&& write_part(prefix, ".screens.attrmap", screens->attributes, screens_size)
+			&& write_part(prefix, ".world", screens->world, world_size);
+	}
+	return write_part(prefix, ".tilemap", conv->map, map_size)
+		&& write_part(prefix, ".attrmap", conv->attributes, map_size);
+}
+
+/*
+ * Output the palettes and the unique tiles of an extracted tileset.
+ */
+void print_tileset(FILE *fp, const struct conversion *conv, const char *name)
+{
+	for (int p_idx = 0; p_idx < conv->n_palettes; p_idx++) {
+		const uint8_t *cur_palette = conv->palettes[p_idx];
+		fprintf(fp, "%s%sPalette%d:\n", name ? name : "", name ? "_" : "", p_idx);
+		for (int i = 0; i < 4; i++) {
+			fprintf(fp, "  db $%02X, $%02X\n", cur_palette[2 * i], cur_palette[2 * i+1]);
+		}
+	}
+	uint8_t *tile_data = store_flatten(&conv->store);
+	print_table(fp, name, "TileData", tile_data, 16 * (size_t)conv->store.n_tiles, 16);
+	free(tile_data);
+}
+
+bool write_tileset(const struct conversion *conv, const char *prefix)
+{
+	uint8_t *tile_data = store_flatten(&conv->store);
+	bool ok = write_part(prefix, ".pal", &conv->palettes[0][0], 8 * conv->n_palettes)
+		&& write_part(prefix, ".2bpp", tile_data, 16 * (size_t)conv->store.n_tiles);
+	free(tile_data);
+	return ok;
+}
+
+/*
+ * Output a background converted with sprite sheets: its palettes, tiles
+ * for the $9000 and $8800 blocks, map and attributes, then the OBJ
+ * palettes, tiles for the $8000 block, and the OAM tile indices and
+ * attributes of each sheet.
+ */
+void print_sprites(FILE *fp, const struct sprites *sprites, const struct conversion *conv)
+{
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	for (int p_idx = 0; p_idx < conv->n_palettes; p_idx++) {
+		const uint8_t *cur_palette = conv->palettes[p_idx];
+		fprintf(fp, "Palette%d:\n", p_idx);
+		for (int i = 0; i < 4; i++) {
+			fprintf(fp, "  db $%02X, $%02X\n", cur_palette[2 * i], cur_palette[2 * i+1]);
+		}
+	}
+	if (conv->schedule) {
+		print_table(fp, NULL, "PaletteSchedule", conv->schedule, conv->schedule_len - 1, SCHEDULE_ENTRY_SIZE);
+		fprintf(fp, "  db $%02X\n", SCHEDULE_END);
+	}
+	print_table(fp, NULL, "TileData9000", &sprites->block_data[2 * 16 * TILES_PER_BLOCK], 16 * sprites->block_tiles[2], 16);
+	print_table(fp, NULL, "TileData8800", &sprites->block_data[16 * TILES_PER_BLOCK], 16 * sprites->block_tiles[1], 16);
+	if (conv->bank_tiles[1] > 0) {
+		print_table(fp, NULL, "TileDataBank1", &conv->tile_data[16 * TILES_PER_BANK], 16 * conv->bank_tiles[1], 16);
+	}
+	print_table(fp, NULL, "Map", conv->map, map_size, conv->map_width);
+	print_table(fp, NULL, "Attributes", conv->attributes, map_size, conv->map_width);
+
+	for (int p_idx = 0; p_idx < sprites->n_palettes; p_idx++) {
+		const uint8_t *cur_palette = sprites->palettes[p_idx];
+		fprintf(fp, "ObjPalette%d:\n", p_idx);
+		for (int i = 0; i < 4; i++) {
+			fprintf(fp, "  db $%02X, $%02X\n", cur_palette[2 * i], cur_palette[2 * i+1]);
+		}
+	}
+	print_table(fp, NULL, "TileData8000", sprites->block_data, 16 * sprites->block_tiles[0], 16);
+	for (int s = 0; s < sprites->n_sheets; s++) {
+		const struct sprite_sheet *sheet = &sprites->sheets[s];
+		size_t sheet_size = (size_t)sheet->tiles_width * sheet->tiles_height;
+		char label[32];
+		snprintf(label, sizeof(label), "Sheet%dTiles", s);
+		print_table(fp, NULL, label, sheet->tiles, sheet_size, sheet->tiles_width);
+		snprintf(label, sizeof(label), "Sheet%dAttributes", s);
+		print_table(fp, NULL, label, sheet->attributes, sheet_size, sheet->tiles_width);
+	}
+}
+
+bool write_sprites(const struct sprites *sprites, const struct conversion *conv, const char *prefix)
+{
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	if (conv->bank_tiles[1] > 0
+			&& !write_part(prefix, ".bank1.2bpp", &conv->tile_data[16 * TILES_PER_BANK], 16 * conv->bank_tiles[1])) {
+		return false;
+	}
+	if (conv->schedule
+			&& !write_part(prefix, ".schedule", conv->schedule, conv->schedule_len)) {
+		return false;
+	}
+	if (!write_part(prefix, ".pal", &conv->palettes[0][0], 8 * conv->n_palettes)
+			|| !write_part(prefix, ".9000.2bpp", &sprites->block_data[2 * 16 * TILES_PER_BLOCK], 16 * sprites->block_tiles[2])
+			|| !write_part(prefix, ".8800.2bpp", &sprites->block_data[16 * TILES_PER_BLOCK], 16 * sprites->block_tiles[1])
+			|| !write_part(prefix, ".tilemap", conv->map, map_size)
+			|| !write_part(prefix, ".attrmap", conv->attributes, map_size)
+			|| !write_part(prefix, ".obj.pal", &sprites->palettes[0][0], 8 * sprites->n_palettes)
+			|| !write_part(prefix, ".8000.2bpp", sprites->block_data, 16 * sprites->block_tiles[0])) {
+		return false;
+	}
+	for (int s = 0; s < sprites->n_sheets; s++) {
+		const struct sprite_sheet *sheet = &sprites->sheets[s];
+		size_t sheet_size = (size_t)sheet->tiles_width * sheet->tiles_height;
+		char extension[32];
+		snprintf(extension, sizeof(extension), ".sheet%d.tiles", s);
+		if (!write_part(prefix, extension, sheet->tiles, sheet_size)) {
+			return false;
+		}
+		snprintf(extension, sizeof(extension), ".sheet%d.attrs", s);
+		if (!write_part(prefix, extension, sheet->attributes, sheet_size)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Print each chunk as its own conversion, labelled name_ChunkN, followed
+ * by any tiles shared by the chunks and the chunk and slot of each screen.
+ */
+void print_chunking(FILE *fp, const struct chunking *chunking, const char *name)
+{
+	size_t world_size = (size_t)chunking->world_width * chunking->world_height;
+	for (int i = 0; i < chunking->n_chunks; i++) {
+		const struct chunk *chunk = &chunking->chunks[i];
+		size_t size = (name ? strlen(name) + 1 : 0) + 16;
+		char *chunk_name = malloc(size);
+		snprintf(chunk_name, size, "%s%sChunk%d", name ? name : "", name ? "_" : "", i);
+		print_conversion(fp, &chunk->conv, &chunk->screens, chunk_name);
+		free(chunk_name);
+	}
+	if (chunking->n_shared_tiles) {
+		print_table(fp, name, "ChunkSharedTiles", chunking->shared_tiles, 16 * chunking->n_shared_tiles, 16);
+	}
+	print_table(fp, name, "ChunkIndex", chunking->chunk_index, world_size, chunking->world_width);
+	print_table(fp, name, "ChunkSlots", chunking->chunk_slots, world_size, chunking->world_width);
+}
+
+/*
+ * Write each chunk as its own conversion, with prefixes prefix.chunkN,
+ * plus any tiles shared by the chunks in prefix.chunkshared.2bpp and the
+ * chunk and slot of each screen in prefix.chunkindex and prefix.chunkslots.
+ */
+bool write_chunking(const struct chunking *chunking, const char *prefix)
+{
+	size_t world_size = (size_t)chunking->world_width * chunking->world_height;
+	for (int i = 0; i < chunking->n_chunks; i++) {
+		const struct chunk *chunk = &chunking->chunks[i];
+		size_t size = strlen(prefix) + 16;
+		char *chunk_prefix = malloc(size);
+		snprintf(chunk_prefix, size, "%s.chunk%d", prefix, i);
+		bool ok = write_conversion(&chunk->conv, &chunk->screens, chunk_prefix);
+		free(chunk_prefix);
+		if (!ok) {
+			return false;
+		}
+	}
+	if (chunking->n_shared_tiles
+			&& !write_part(prefix, ".chunkshared.2bpp", chunking->shared_tiles, 16 * chunking->n_shared_tiles)) {
+		return false;
+	}
+	return write_part(prefix, ".chunkindex", chunking->chunk_index, world_size)
+		&& write_part(prefix, ".chunkslots", chunking->chunk_slots, world_size);
+}
+
+/*
+ * Fill in the blocks making up a conversion, in the same order and with
+ * the same labels as print_conversion uses, without any name prefix.
+ * Returns the number of blocks.
+ */
+int list_blocks(const struct conversion *conv, const struct screens *screens, struct block blocks[MAX_BLOCKS])
+{
+	int n = 0;
+	for (int p_idx = 0; p_idx < conv->n_palettes; p_idx++) {
+		snprintf(blocks[n].label, sizeof(blocks[n].label), "Palette%d", p_idx);
+		blocks[n].data = conv->palettes[p_idx];
+		blocks[n].len = 8;
+		n++;
+	}
+	if (conv->schedule) {
+		blocks[n++] = (struct block){"PaletteSchedule", conv->schedule, conv->schedule_len};
+	}
+	blocks[n++] = (struct block){"TileData", &conv->tile_data[16 * conv->n_seed_tiles], 16 * (conv->bank_tiles[0] - conv->n_seed_tiles)};
+	if (conv->bank_tiles[1] > 0) {
+		blocks[n++] = (struct block){"TileDataBank1", &conv->tile_data[16 * TILES_PER_BANK], 16 * conv->bank_tiles[1]};
+	}
+	if (screens) {
+		size_t screens_size = (size_t)screens->n_screens * screens->width * screens->height;
+		size_t world_size = (size_t)screens->world_width * screens->world_height;
+		blocks[n++] = (struct block){"ScreenMaps", screens->map, screens_size};
+		blocks[n++] = (struct block){"ScreenAttributes", screens->attributes, screens_size};
+		blocks[n++] = (struct block){"WorldMap", screens->world, world_size};
+		return n;
+	}
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	blocks[n++] = (struct block){"Map", conv->map, map_size};
+	blocks[n++] = (struct block){"Attributes", conv->attributes, map_size};
+	return n;
+}
+
+/*
+ * Print the DMG version of a conversion: the BGP value, how many CGB tiles
+ * it shares, the tiles not already in the CGB TileData, which follow the
+ * shared ones in VRAM, and the map.
+ * SGB palettes and the attribute file follow if made.
+ */
+void print_dmg(FILE *fp, const struct dmg *dmg, const struct conversion *conv, const char *name)
+{
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	fprintf(fp, "%s%sDmgPalette:\n", name ? name : "", name ? "_" : "");
+	fprintf(fp, "  db $%02X\n", DMG_BGP);
+	fprintf(fp, "%s%sDmgSharedTiles:\n", name ? name : "", name ? "_" : "");
+	fprintf(fp, "  dw %d\n", dmg->n_shared);
+	print_table(fp, name, "DmgTileData", dmg->tile_data, 16 * dmg->n_tiles, 16);
+	print_table(fp, name, "DmgMap", dmg->map, map_size, conv->map_width);
+	if (!dmg->sgb) {
+		return;
+	}
+	for (int p_idx = 0; p_idx < SGB_PALETTES; p_idx++) {
+		const uint8_t *cur_palette = dmg->sgb_palettes[p_idx];
+		fprintf(fp, "%s%sSgbPalette%d:\n", name ? name : "", name ? "_" : "", p_idx);
+		for (int i = 0; i < 4; i++) {
+			fprintf(fp, "  db $%02X, $%02X\n", cur_palette[2 * i], cur_palette[2 * i+1]);
+		}
+	}
+	print_table(fp, name, "SgbAttributes", dmg->atf, SGB_ATF_SIZE, SGB_ATF_WIDTH / 4);
+}
+
+/*
+ * Write the DMG version of a conversion to prefix.dmg.2bpp and
+ * prefix.dmg.tilemap, and SGB palettes and attributes, if made, to
+ * prefix.sgb.pal and prefix.sgb.atf.
+ */
+bool write_dmg(const struct dmg *dmg, const struct conversion *conv, const char *prefix)
+{
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	if (!write_part(prefix, ".dmg.2bpp", dmg->tile_data, 16 * dmg->n_tiles)
+			|| !write_part(prefix, ".dmg.tilemap", dmg->map, map_size)) {
+		return false;
+	}
+	if (!dmg->sgb) {
+		return true;
+	}
+	return write_part(prefix, ".sgb.pal", &dmg->sgb_palettes[0][0], 8 * SGB_PALETTES)
+		&& write_part(prefix, ".sgb.atf", dmg->atf, SGB_ATF_SIZE);
+}
+
+/*
+ * Print the tile dictionary's global ID of each tile, as 32-bit values.
+ */
+void print_tile_ids(FILE *fp, const char *name, const char *label, const uint32_t *ids, int n_ids)
+{
+	fprintf(fp, "%s%s%s:\n", name ? name : "", name ? "_" : "", label);
+	for (int i = 0; i < n_ids; i += 8) {
+		fprintf(fp, "  dl ");
+		for (int j = i; j < n_ids && j < i + 8; j++) {
+			fprintf(fp, "%s%u", j > i ? ", " : "", ids[j]);
+		}
+		fprintf(fp, "\n");
+	}
+}
+
+/*
+ * Write the global IDs of the tiles to prefix + extension, 4 bytes each,
+ * little-endian.
+ */
+bool write_tile_ids(const char *prefix, const char *extension, const uint32_t *ids, int n_ids)
+{
+	uint8_t *data = malloc(4 * (size_t)n_ids + 1);
+	for (int i = 0; i < n_ids; i++) {
+		for (int b = 0; b < 4; b++) {
+			data[4 * i + b] = ids[i] >> (8u * b);
+		}
+	}
+	bool ok = write_part(prefix, extension, data, 4 * (size_t)n_ids);
+	free(data);
+	return ok;
+}
+
+/*
+ * Read a whole file into memory. Returns NULL on failure.
+ */
+uint8_t *read_file(const char *filename, size_t *len)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		fprintf(stderr, "Couldn't open %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	uint8_t *data = NULL;
+	size_t size = 0;
+	*len = 0;
+	for (;;) {
+		if (*len == size) {
+			size = size ? 2 * size : 0x8000;
+			data = realloc(data, size);
+		}
+		size_t n = fread(&data[*len], 1, size - *len, fp);
+		*len += n;
+		if (n == 0) {
+			break;
+		}
+	}
+	if (ferror(fp)) {
+		fprintf(stderr, "Failed to read %s: %s\n", filename, strerror(errno));
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	return data;
+}
+
+/*
+ * Write data to filename, unless the file already holds exactly that, so
+ * that its timestamp doesn't change and builds depending on it don't rerun.
+ */
+bool write_file(const char *filename, const uint8_t *data, size_t len)
+{
+	depend_output(filename);
+	if (file_unchanged(filename, data, len)) {
+		return true;
+	}
+	FILE *fp = fopen(filename, "wb");
+	if (!fp) {
+		fprintf(stderr, "Couldn't open %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	if (fwrite(data, 1, len, fp) != len) {
+		fprintf(stderr, "Failed to write %s: %s\n", filename, strerror(errno));
+		fclose(fp);
+		return false;
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Failed to write %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Whether the file has the same length and FNV-1a hash as data. The file
+ * is hashed as it's read, so it isn't held in memory.
+ */
+bool file_unchanged(const char *filename, const uint8_t *data, size_t len)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		return false;
+	}
+	uint64_t hash = FNV_OFFSET;
+	size_t file_len = 0;
+	uint8_t buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			hash ^= buf[i];
+			hash *= FNV_PRIME;
+		}
+		file_len += n;
+	}
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if (!ok || file_len != len) {
+		return false;
+	}
+	uint64_t data_hash = FNV_OFFSET;
+	for (size_t i = 0; i < len; i++) {
+		data_hash ^= data[i];
+		data_hash *= FNV_PRIME;
+	}
+	return hash == data_hash;
+}
+
+void print_table(FILE *fp, const char *name, const char *label, const uint8_t *data, size_t len, size_t row_len)
+{
+	fprintf(fp, "%s%s%s:\n", name ? name : "", name ? "_" : "", label);
+	for (size_t i = 0; i < len; i += row_len) {
+		fprintf(fp, "  db ");
+		for (size_t j = 0; j < row_len - 1; j++) {
+			fprintf(fp, "$%02X,", data[i + j]);
+		}
+		fprintf(fp, "$%02X\n", data[i + row_len - 1]);
+	}
+}
+
+bool write_part(const char *prefix, const char *extension, const uint8_t *data, size_t len)
+{
+	size_t size = strlen(prefix) + strlen(extension) + 1;
+	char *filename = malloc(size);
+	snprintf(filename, size, "%s%s", prefix, extension);
+	bool ret = write_file(filename, data, len);
+	free(filename);
+	return ret;
+}
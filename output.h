@@ -0,0 +1,42 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include "chunk.h"
+#include "convert.h"
+#include "dmg.h"
+#include "screen.h"
+#include "sprite.h"
+
+#define MAX_BLOCKS (MAX_PALETTES + 6)
+
+/*
+ * One labelled run of bytes of a conversion, as it appears in the
+ * assembly output.
+ */
+struct block {
+	char label[32];
+	const uint8_t *data;
+	size_t len;
+};
+
+int list_blocks(const struct conversion *conv, const struct screens *screens, struct block blocks[MAX_BLOCKS]);
+void print_conversion(FILE *fp, const struct conversion *conv, const struct screens *screens, const char *name);
+bool write_conversion(const struct conversion *conv, const struct screens *screens, const char *prefix);
+void print_tileset(FILE *fp, const struct conversion *conv, const char *name);
+bool write_tileset(const struct conversion *conv, const char *prefix);
+void print_sprites(FILE *fp, const struct sprites *sprites, const struct conversion *conv);
+bool write_sprites(const struct sprites *sprites, const struct conversion *conv, const char *prefix);
+void print_chunking(FILE *fp, const struct chunking *chunking, const char *name);
+bool write_chunking(const struct chunking *chunking, const char *prefix);
+void print_dmg(FILE *fp, const struct dmg *dmg, const struct conversion *conv, const char *name);
+bool write_dmg(const struct dmg *dmg, const struct conversion *conv, const char *prefix);
+void print_tile_ids(FILE *fp, const char *name, const char *label, const uint32_t *ids, int n_ids);
+bool write_tile_ids(const char *prefix, const char *extension, const uint32_t *ids, int n_ids);
+uint8_t *read_file(const char *filename, size_t *len);
+bool write_file(const char *filename, const uint8_t *data, size_t len);
+
+#endif /* OUTPUT_H */
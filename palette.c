@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "palette.h"
+
+void hex_to_palette(uint32_t hex[4], uint8_t palette[8])
+{
+	for (int c_idx = 0; c_idx < 4; c_idx++) {
+		uint16_t colour = hex_to_gb(hex[c_idx]);
+
+		palette[2 * c_idx] = colour & 0xFFu;
+		palette[2 * c_idx + 1] = (colour >> 8u) & 0xFFu;
+	}
+}
+
+uint16_t hex_to_gb(uint32_t hex)
+{
+	uint8_t r = (hex >> 3u) & 0x1Fu;
+	uint8_t g = (hex >> 11u) & 0x1Fu;
+	uint8_t b = (hex >> 19u) & 0x1Fu;
+
+	return r | (g << 5u) | (b << 10u);
+}
+
+int colour_in_palette(uint32_t hex, uint8_t palette[8])
+{
+	uint16_t colour = hex_to_gb(hex);
+	uint8_t lo = colour & 0xFFu;
+	uint8_t hi = colour >> 8u;
+	for (int i = 0; i < 4; i++) {
+		if (lo == palette[2 * i] && hi == palette[2 * i + 1]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int palette_in_list(uint8_t palette[8], int n_colours, uint8_t list[MAX_PALETTES][8], uint8_t colours_in_palettes[MAX_PALETTES])
+{
+	for (int i = 0; i < MAX_PALETTES; i++) {
+		bool palettes_equal = true;
+		for (int j = 0; j < 4 && j < n_colours; j++) {
+			bool found = false;
+			uint8_t c_in_p = colours_in_palettes[i];
+			for (int k = 0; k < 4 && k < c_in_p; k++) {
+				if (palette[2 * j] == list[i][2 * k] && palette[2 * j + 1] == list[i][2 * k + 1]) {
+					found = true;
+				}
+			}
+			if (!found) {
+				if (c_in_p < 4) {
+					list[i][2 * c_in_p] = palette[2 * j];
+					list[i][2 * c_in_p + 1] = palette[2 * j + 1];
+					colours_in_palettes[i]++;
+				} else {
+					palettes_equal = false;
+					break;
+				}
+			}
+		}
+		if (palettes_equal) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	uint32_t sums[2] = {0};
+	uint8_t tmp[4];
+	memcpy(tmp, a, 2);
+	memcpy(tmp + 2, b, 2);
+	for (int i = 0; i < 2; i++) {
+		int r = tmp[2 * i] & 0x1Fu;
+		int g = (tmp[2 * i] & 0x70u) >> 5u;
+		g |= (tmp[2 * i + 1] & 0x03u) << 3u;
+		int b = (tmp[2 * i + 1] & 0x7Cu) >> 2u;
+		sums[i] = r + b + g;
+	}
+	return sums[0] - sums[1];
+}
+
+void sort_palette(uint8_t palette[8]) {
+	uint16_t tmp[4];
+	memcpy(tmp, palette, sizeof(tmp));
+	qsort(tmp, 4, sizeof(*tmp), cmp);
+	memcpy(palette, tmp, sizeof(tmp));
+}
@@ -0,0 +1,14 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+
+#define MAX_PALETTES 8
+
+void hex_to_palette(uint32_t hex[4], uint8_t palette[8]);
+int colour_in_palette(uint32_t hex, uint8_t palette[8]);
+uint16_t hex_to_gb(uint32_t hex);
+int palette_in_list(uint8_t palette[8], int n_colours, uint8_t list[MAX_PALETTES][8], uint8_t colours_in_palettes[MAX_PALETTES]);
+void sort_palette(uint8_t palette[8]);
+
+#endif /* PALETTE_H */
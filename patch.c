@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "output.h"
+#include "patch.h"
+
+#define BANK_SIZE 0x4000u
+#define HEADER_START 0x134u
+#define HEADER_END 0x14Du
+#define HEADER_CHECKSUM 0x14Du
+#define GLOBAL_CHECKSUM 0x14Eu
+
+static bool load_symbols(const char *filename, struct rom *rom);
+static const struct symbol *find_symbol(const struct rom *rom, const char *name);
+static int cmp_symbols(const void *a, const void *b);
+
+/*
+ * Load a ROM and the .sym file written for it by rgblink. Only labels in
+ * ROM are kept.
+ */
+bool load_rom(const char *rom_filename, const char *sym_filename, struct rom *rom)
+{
+	memset(rom, 0, sizeof(*rom));
+	rom->data = read_file(rom_filename, &rom->size);
+	if (!rom->data) {
+		return false;
+	}
+	if (rom->size < 2 * BANK_SIZE || rom->size % BANK_SIZE) {
+		fprintf(stderr, "%s isn't a valid ROM.\n", rom_filename);
+		rom_destroy(rom);
+		return false;
+	}
+	if (!load_symbols(sym_filename, rom)) {
+		rom_destroy(rom);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Write each block of the conversion over the data at the label of the
+ * same name, prefixed with name_ if given. Returns the number of blocks
+ * written, or -1 if a block has no label or doesn't fit before the next
+ * label.
+ */
+int patch_conversion(struct rom *rom, const struct conversion *conv, const struct screens *screens, const char *name)
+{
+	struct block blocks[MAX_BLOCKS];
+	int n_blocks = list_blocks(conv, screens, blocks);
+	int n_patched = 0;
+	for (int i = 0; i < n_blocks; i++) {
+		char label[MAX_SYMBOL_NAME];
+		snprintf(label, sizeof(label), "%s%s%s", name ? name : "", name ? "_" : "", blocks[i].label);
+		const struct symbol *symbol = find_symbol(rom, label);
+		if (!symbol) {
+			fprintf(stderr, "Error: There is no %s label in the symbol file.\n", label);
+			return -1;
+		}
+		if (blocks[i].len > symbol->size) {
+			fprintf(stderr, "Error: %s is %zu bytes, but only %zu fit at %02X:%04X.\n",
+					label, blocks[i].len, symbol->size, symbol->bank, symbol->address);
+			return -1;
+		}
+		memcpy(&rom->data[symbol->offset], blocks[i].data, blocks[i].len);
+		n_patched++;
+	}
+	return n_patched;
+}
+
+/*
+ * Fix the header and global checksums, and write the ROM back out.
+ */
+bool save_rom(struct rom *rom, const char *filename)
+{
+	uint8_t header = 0;
+	for (size_t i = HEADER_START; i < HEADER_END; i++) {
+		header = header - rom->data[i] - 1;
+	}
+	rom->data[HEADER_CHECKSUM] = header;
+
+	uint16_t global = 0;
+	for (size_t i = 0; i < rom->size; i++) {
+		if (i != GLOBAL_CHECKSUM && i != GLOBAL_CHECKSUM + 1) {
+			global += rom->data[i];
+		}
+	}
+	rom->data[GLOBAL_CHECKSUM] = global >> 8u;
+	rom->data[GLOBAL_CHECKSUM + 1] = global & 0xFFu;
+	return write_file(filename, rom->data, rom->size);
+}
+
+void rom_destroy(struct rom *rom)
+{
+	for (int i = 0; i < rom->n_symbols; i++) {
+		free(rom->symbols[i].name);
+	}
+	free(rom->symbols);
+	free(rom->data);
+	rom->symbols = NULL;
+	rom->data = NULL;
+}
+
+/*
+ * Each line of a .sym file is "BB:AAAA Name", with the bank and address
+ * in hex. Comments start with a semicolon.
+ */
+bool load_symbols(const char *filename, struct rom *rom)
+{
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "Couldn't open %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	int size = 0;
+	char line[MAX_SYMBOL_NAME + 16];
+	int line_no = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		line_no++;
+		char *start = line;
+		while (isspace((unsigned char)*start)) {
+			start++;
+		}
+		if (*start == '\0' || *start == ';') {
+			continue;
+		}
+		unsigned int bank, address;
+		char name[MAX_SYMBOL_NAME];
+		if (sscanf(start, "%x:%x %255s", &bank, &address, name) != 3 || bank > 0x1FF) {
+			fprintf(stderr, "%s:%d: Invalid symbol.\n", filename, line_no);
+			fclose(fp);
+			return false;
+		}
+		if (address >= 2 * BANK_SIZE || (bank > 0 && address < BANK_SIZE)) {
+			continue;
+		}
+		size_t offset = bank > 0 ? bank * BANK_SIZE + (address - BANK_SIZE) : address;
+		if (offset >= rom->size) {
+			continue;
+		}
+		if (rom->n_symbols == size) {
+			size = size ? 2 * size : 256;
+			rom->symbols = realloc(rom->symbols, size * sizeof(*rom->symbols));
+		}
+		struct symbol *symbol = &rom->symbols[rom->n_symbols++];
+		symbol->name = strdup(name);
+		symbol->bank = bank;
+		symbol->address = address;
+		symbol->offset = offset;
+	}
+	fclose(fp);
+
+	/* A label's data runs up to the next label, or the end of its bank. */
+	qsort(rom->symbols, rom->n_symbols, sizeof(*rom->symbols), cmp_symbols);
+	for (int i = 0; i < rom->n_symbols; i++) {
+		struct symbol *symbol = &rom->symbols[i];
+		size_t end = (symbol->offset / BANK_SIZE + 1) * BANK_SIZE;
+		for (int j = i + 1; j < rom->n_symbols; j++) {
+			if (rom->symbols[j].offset >= end) {
+				break;
+			}
+			if (rom->symbols[j].offset > symbol->offset) {
+				end = rom->symbols[j].offset;
+				break;
+			}
+		}
+		symbol->size = end - symbol->offset;
+	}
+	return true;
+}
+
+const struct symbol *find_symbol(const struct rom *rom, const char *name)
+{
+	for (int i = 0; i < rom->n_symbols; i++) {
+		if (strcmp(rom->symbols[i].name, name) == 0) {
+			return &rom->symbols[i];
+		}
+	}
+	return NULL;
+}
+
+int cmp_symbols(const void *a, const void *b)
+{
+	const struct symbol *sa = a;
+	const struct symbol *sb = b;
+	if (sa->offset != sb->offset) {
+		return sa->offset < sb->offset ? -1 : 1;
+	}
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef PATCH_H
+#define PATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "convert.h"
+#include "screen.h"
+
+#define MAX_SYMBOL_NAME 256
+
+/*
+ * A label from an RGBDS .sym file. size is the number of bytes up to the
+ * next label in the same bank, or the end of the bank.
+ */
+struct symbol {
+	char *name;
+	uint16_t bank;
+	uint16_t address;
+	size_t offset;
+	size_t size;
+};
+
+/*
+ * A built ROM image and its symbols, to write conversions straight into.
+ */
+struct rom {
+	uint8_t *data;
+	size_t size;
+	struct symbol *symbols;
+	int n_symbols;
+};
+
+bool load_rom(const char *rom_filename, const char *sym_filename, struct rom *rom);
+int patch_conversion(struct rom *rom, const struct conversion *conv, const struct screens *screens, const char *name);
+bool save_rom(struct rom *rom, const char *filename);
+void rom_destroy(struct rom *rom);
+
+#endif /* PATCH_H */
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+ * Palette assignment for images that need more than 8 palettes in total,
+ * but no more than 8 on any one row of tiles. Palettes are rewritten
+ * during HBlank between rows, and the writes needed are emitted as a
+ * per-scanline schedule.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "convert.h"
+#include "raster.h"
+
+#define MAX_INSTANCES 4096
+
+/*
+ * The state of one hardware palette slot. instance is the palette it
+ * currently holds, created is the tile row that palette was first shown
+ * on, and last_row the latest row that uses it.
+ */
+struct slot {
+	int instance;
+	int count;
+	int created;
+	int last_row;
+};
+
+static bool contains(const uint8_t palette[8], int count, const uint8_t colour[2]);
+static int missing_colours(const uint8_t palette[8], int count, const uint8_t *colours, int n_colours);
+static void add_write(struct conversion *conv, int line, int slot, int index, const uint8_t colour[2]);
+
+/*
+ * Assign each tile to one of the 8 palette slots, changing what the slots
+ * hold from one tile row to the next as needed. Slots used by the
+ * previous row can only be rewritten in the HBlank just before the new
+ * row; other slots can be rewritten in any HBlank of the previous row.
+ * At most hblank_writes colours can be written per HBlank.
+ *
+ * On success, conv->palettes holds the palettes to load before the frame
+ * starts, conv->schedule the writes to make during it, and each tile's
+ * palette is given by instances[tile_instances[tile]].
+ */
+bool schedule_palettes(const struct census *census, int hblank_writes, bool quiet,
+		struct conversion *conv, uint8_t (**instances)[8], uint16_t **tile_instances)
+{
+	if (census->tiles_height > 32) {
+		if (!quiet) {
+			fprintf(stderr, "Error: Palette scheduling needs an image at most 256 pixels tall.\n");
+		}
+		return false;
+	}
+	int n_tiles = census->tiles_width * census->tiles_height;
+	uint8_t (*palettes)[8] = calloc(MAX_INSTANCES, sizeof(*palettes));
+	uint16_t *tile_inst = calloc(n_tiles, sizeof(*tile_inst));
+	int n_instances = 0;
+
+	struct slot slots[MAX_PALETTES];
+	for (int i = 0; i < MAX_PALETTES; i++) {
+		slots[i] = (struct slot){.instance = -1, .last_row = -1};
+	}
+
+	for (int ty = 0; ty < census->tiles_height; ty++) {
+		for (int tx = 0; tx < census->tiles_width; tx++) {
+			int t_idx = ty * census->tiles_width + tx;
+			uint32_t *colours = census->tile_colours[t_idx];
+			int n_colours = census->n_tile_colours[t_idx];
+			uint8_t cur_palette[8];
+			hex_to_palette(colours, cur_palette);
+
+			/*
+			 * In order of preference: a slot that already has all
+			 * the colours, a slot first shown on this row that can
+			 * take the missing ones, or the least recently used
+			 * slot that this row hasn't touched yet.
+			 */
+			int best = -1;
+			for (int i = 0; i < MAX_PALETTES && best < 0; i++) {
+				if (slots[i].instance >= 0
+						&& missing_colours(palettes[slots[i].instance], slots[i].count, cur_palette, n_colours) == 0) {
+					best = i;
+				}
+			}
+			for (int i = 0; i < MAX_PALETTES && best < 0; i++) {
+				if (slots[i].instance >= 0 && slots[i].created == ty
+						&& slots[i].count + missing_colours(palettes[slots[i].instance], slots[i].count, cur_palette, n_colours) <= 4) {
+					best = i;
+				}
+			}
+			if (best < 0) {
+				for (int i = 0; i < MAX_PALETTES; i++) {
+					if (slots[i].last_row == ty) {
+						continue;
+					}
+					if (best < 0 || slots[i].last_row < slots[best].last_row) {
+						best = i;
+					}
+				}
+				if (best < 0) {
+					if (!quiet) {
+						fprintf(stderr, "Error: More than %d palettes needed on tile row %d, at tile (%d, %d).\n", MAX_PALETTES, ty, tx, ty);
+					}
+					goto fail;
+				}
+				if (n_instances == MAX_INSTANCES) {
+					if (!quiet) {
+						fprintf(stderr, "Error: More than %d palettes needed in total.\n", MAX_INSTANCES);
+					}
+					goto fail;
+				}
+				slots[best] = (struct slot){
+					.instance = n_instances++,
+					.count = 0,
+					.created = ty
+				};
+			}
+
+			struct slot *slot = &slots[best];
+			uint8_t *palette = palettes[slot->instance];
+			for (int j = 0; j < n_colours; j++) {
+				if (!contains(palette, slot->count, &cur_palette[2 * j])) {
+					memcpy(&palette[2 * slot->count], &cur_palette[2 * j], 2);
+					slot->count++;
+				}
+			}
+			slot->last_row = ty;
+			tile_inst[t_idx] = slot->instance;
+			conv->attributes[ty * conv->map_width + tx] = best | census->tile_flags[t_idx];
+		}
+
+		/*
+		 * The palettes first shown on this row are now complete, so
+		 * sort them and schedule their writes.
+		 */
+		int free_writes = 0;
+		int free_line = 8 * ty - 8;
+		int last_writes = 0;
+		for (int i = 0; i < MAX_PALETTES; i++) {
+			if (slots[i].instance < 0 || slots[i].created != ty) {
+				continue;
+			}
+			uint8_t *palette = palettes[slots[i].instance];
+			sort_palette(palette);
+			if (ty == 0) {
+				memcpy(conv->palettes[i], palette, 8);
+				conv->n_palettes = i + 1 > conv->n_palettes ? i + 1 : conv->n_palettes;
+				continue;
+			}
+			/* Slots shown on the previous row wait for the last HBlank. */
+			bool busy = false;
+			for (int tx = 0; tx < census->tiles_width && !busy; tx++) {
+				int prev = (ty - 1) * conv->map_width + tx;
+				busy = (int)(conv->attributes[prev] & ATTR_PALETTE) == i;
+			}
+			for (int c = 0; c < 4; c++) {
+				int line;
+				if (busy) {
+					line = 8 * ty - 1;
+					last_writes++;
+				} else {
+					while (free_writes >= hblank_writes) {
+						free_line++;
+						free_writes = 0;
+					}
+					line = free_line;
+					free_writes++;
+					if (line == 8 * ty - 1) {
+						last_writes++;
+					}
+				}
+				if (line > 8 * ty - 1 || last_writes > hblank_writes) {
+					if (!quiet) {
+						fprintf(stderr, "Error: Too many palette writes before tile row %d, at most %d colours can be written per HBlank.\n", ty, hblank_writes);
+					}
+					goto fail;
+				}
+				add_write(conv, line, i, c, &palette[2 * c]);
+			}
+		}
+	}
+
+	/* The schedule is in slot order within each row, so sort by line. */
+	for (int i = 1; i < conv->schedule_len / SCHEDULE_ENTRY_SIZE; i++) {
+		uint8_t entry[SCHEDULE_ENTRY_SIZE];
+		memcpy(entry, &conv->schedule[SCHEDULE_ENTRY_SIZE * i], SCHEDULE_ENTRY_SIZE);
+		int j = i;
+		while (j > 0 && conv->schedule[SCHEDULE_ENTRY_SIZE * (j - 1)] > entry[0]) {
+			memcpy(&conv->schedule[SCHEDULE_ENTRY_SIZE * j], &conv->schedule[SCHEDULE_ENTRY_SIZE * (j - 1)], SCHEDULE_ENTRY_SIZE);
+			j--;
+		}
+		memcpy(&conv->schedule[SCHEDULE_ENTRY_SIZE * j], entry, SCHEDULE_ENTRY_SIZE);
+	}
+	conv->schedule = realloc(conv->schedule, conv->schedule_len + 1);
+	conv->schedule[conv->schedule_len++] = SCHEDULE_END;
+	conv->n_raster_palettes = n_instances;
+
+	*instances = palettes;
+	*tile_instances = tile_inst;
+	return true;
+fail:
+	free(palettes);
+	free(tile_inst);
+	return false;
+}
+
+bool contains(const uint8_t palette[8], int count, const uint8_t colour[2])
+{
+	for (int k = 0; k < count; k++) {
+		if (palette[2 * k] == colour[0] && palette[2 * k + 1] == colour[1]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int missing_colours(const uint8_t palette[8], int count, const uint8_t *colours, int n_colours)
+{
+	uint8_t tmp[8];
+	int n_tmp = count;
+	memcpy(tmp, palette, 2 * count);
+	int missing = 0;
+	for (int j = 0; j < n_colours; j++) {
+		if (!contains(tmp, n_tmp, &colours[2 * j])) {
+			missing++;
+			if (n_tmp < 4) {
+				memcpy(&tmp[2 * n_tmp], &colours[2 * j], 2);
+				n_tmp++;
+			}
+		}
+	}
+	return missing;
+}
+
+/*
+ * Append a write of one colour to the schedule. The index is the value to
+ * write to BCPS, without auto-increment.
+ */
+void add_write(struct conversion *conv, int line, int slot, int index, const uint8_t colour[2])
+{
+	conv->schedule = realloc(conv->schedule, conv->schedule_len + SCHEDULE_ENTRY_SIZE);
+	uint8_t *entry = &conv->schedule[conv->schedule_len];
+	entry[0] = line;
+	entry[1] = 8 * slot + 2 * index;
+	entry[2] = colour[0];
+	entry[3] = colour[1];
+	conv->schedule_len += SCHEDULE_ENTRY_SIZE;
+}
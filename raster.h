@@ -0,0 +1,17 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "census.h"
+
+struct conversion;
+
+/* Each write in a schedule is: scanline, BCPS index, colour lo, colour hi. */
+#define SCHEDULE_ENTRY_SIZE 4
+#define SCHEDULE_END 0xFFu
+
+bool schedule_palettes(const struct census *census, int hblank_writes, bool quiet,
+		struct conversion *conv, uint8_t (**instances)[8], uint16_t **tile_instances);
+
+#endif /* RASTER_H */
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "render.h"
+
+#define MAX_REPORTED 10
+
+static void decode_row(uint8_t lower, uint8_t upper, bool hflip, uint8_t idx[8]);
+static uint32_t gb_to_hex(uint8_t lo, uint8_t hi);
+
+/*
+ * Draw the conversion back into an opaque RGBA bitmap the size of the
+ * image, as the hardware would show it: tiles from either bank, flipped
+ * as the attributes say, in the palette the attributes select. If there
+ * is a palette schedule, its writes are applied after the line each is
+ * for, so the schedule is checked too.
+ */
+bool render_conversion(const struct conversion *conv, struct bitmap *bitmap)
+{
+	bitmap->width = 8 * conv->tiles_width;
+	bitmap->height = 8 * conv->tiles_height;
+	bitmap->stride = bitmap->width;
+	bitmap->data = calloc((size_t)bitmap->width * bitmap->height, sizeof(*bitmap->data));
+	if (!bitmap->data) {
+		return false;
+	}
+
+	/* The palettes as RGBA, updated by the schedule as lines are drawn. */
+	uint32_t colours[MAX_PALETTES][4];
+	for (int p_idx = 0; p_idx < MAX_PALETTES; p_idx++) {
+		for (int c = 0; c < 4; c++) {
+			colours[p_idx][c] = gb_to_hex(conv->palettes[p_idx][2 * c], conv->palettes[p_idx][2 * c + 1]);
+		}
+	}
+	const uint8_t *entry = conv->schedule;
+
+	for (int y = 0; y < 8 * conv->tiles_height; y++) {
+		while (entry && entry[0] != SCHEDULE_END && entry[0] < y) {
+			uint8_t index = entry[1];
+			colours[index / 8][(index % 8) / 2] = gb_to_hex(entry[2], entry[3]);
+			entry += SCHEDULE_ENTRY_SIZE;
+		}
+		uint32_t *row = &bitmap->data[(size_t)y * bitmap->stride];
+		int ty = y / 8;
+		for (int tx = 0; tx < conv->tiles_width; tx++) {
+			uint8_t tile_idx = conv->map[ty * conv->map_width + tx];
+			uint8_t attr = conv->attributes[ty * conv->map_width + tx];
+			int bank = (attr & ATTR_BANK) ? 1 : 0;
+			const uint8_t *tile = &conv->tile_data[16 * (TILES_PER_BANK * bank + tile_idx)];
+			int line = (attr & ATTR_VFLIP) ? 7 - y % 8 : y % 8;
+			uint8_t idx[8];
+			decode_row(tile[2 * line], tile[2 * line + 1], attr & ATTR_HFLIP, idx);
+			const uint32_t *palette = colours[attr & ATTR_PALETTE];
+			for (int x = 0; x < 8; x++) {
+				row[8 * tx + x] = palette[idx[x]];
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * Render the conversion and compare it with the source image in RGB555,
+ * reporting the first few tiles that differ. Returns the number of tiles
+ * that differ, or -1 if rendering failed.
+ */
+int verify_conversion(const struct bitmap *source, const struct conversion *conv, bool quiet)
+{
+	struct bitmap rendered;
+	if (!render_conversion(conv, &rendered)) {
+		return -1;
+	}
+	int n_mismatched = 0;
+	for (int ty = 0; ty < conv->tiles_height; ty++) {
+		for (int tx = 0; tx < conv->tiles_width; tx++) {
+			uint32_t diff = 0;
+			for (int y = 0; y < 8; y++) {
+				const uint32_t *a = &source->data[(size_t)(8 * ty + y) * source->stride + 8 * tx];
+				const uint32_t *b = &rendered.data[(size_t)(8 * ty + y) * rendered.stride + 8 * tx];
+				for (int x = 0; x < 8; x++) {
+					/* Compare only the top 5 bits of each channel. */
+					diff |= (a[x] ^ b[x]) & 0x00F8F8F8u;
+				}
+			}
+			if (diff) {
+				if (!quiet && n_mismatched < MAX_REPORTED) {
+					fprintf(stderr, "Error: tile (%d, %d) doesn't match the source.\n", tx, ty);
+				}
+				n_mismatched++;
+			}
+		}
+	}
+	free(rendered.data);
+	return n_mismatched;
+}
+
+/*
+ * Unpack one row of 2bpp data into 8 colour indices, left to right.
+ */
+void decode_row(uint8_t lower, uint8_t upper, bool hflip, uint8_t idx[8])
+{
+	for (int x = 0; x < 8; x++) {
+		int bit = hflip ? x : 7 - x;
+		idx[x] = ((lower >> bit) & 1u) | (((upper >> bit) & 1u) << 1u);
+	}
+}
+
+uint32_t gb_to_hex(uint8_t lo, uint8_t hi)
+{
+	uint16_t colour = lo | (hi << 8u);
+	uint32_t r = colour & 0x1Fu;
+	uint32_t g = (colour >> 5u) & 0x1Fu;
+	uint32_t b = (colour >> 10u) & 0x1Fu;
+	r = (r << 3u) | (r >> 2u);
+	g = (g << 3u) | (g >> 2u);
+	b = (b << 3u) | (b >> 2u);
+	return 0xFF000000u | (b << 16u) | (g << 8u) | r;
+}
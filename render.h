@@ -0,0 +1,11 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include "convert.h"
+#include "image.h"
+
+bool render_conversion(const struct conversion *conv, struct bitmap *bitmap);
+int verify_conversion(const struct bitmap *source, const struct conversion *conv, bool quiet);
+
+#endif /* RENDER_H */
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loadcost.h"
+#include "output.h"
+#include "report.h"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* The totals for one named area. */
+struct area_totals {
+	const char *name;
+	int n_assets;
+	int n_tiles;
+	size_t bytes;
+	size_t rle_bytes;
+};
+
+static size_t asset_bytes(const struct asset_report *asset);
+static int collect_areas(const struct report *report, struct area_totals *areas);
+static void print_banks(FILE *fp, const struct layout *layout, const struct report *report, const char *area, int group);
+static void print_violations(FILE *fp, const struct budget *budget, const struct asset_report *asset, const struct area_totals *area);
+
+/*
+ * Parse a comma-separated list of limits, each "key=value" with key one
+ * of tiles, palettes, map, asset or area.
+ */
+bool parse_budget(const char *spec, struct budget *budget)
+{
+	char *copy = strdup(spec);
+	bool ok = true;
+	for (char *item = strtok(copy, ","); item && ok; item = strtok(NULL, ",")) {
+		char *value = strchr(item, '=');
+		char *end = NULL;
+		long n = value ? strtol(value + 1, &end, 0) : -1;
+		if (!value || end == value + 1 || *end != '\0' || n < 0) {
+			fprintf(stderr, "Invalid budget \"%s\".\n", item);
+			ok = false;
+			break;
+		}
+		*value = '\0';
+		if (strcmp(item, "tiles") == 0) {
+			budget->max_tiles = n;
+		} else if (strcmp(item, "palettes") == 0) {
+			budget->max_palettes = n;
+		} else if (strcmp(item, "map") == 0) {
+			budget->max_map_bytes = n;
+		} else if (strcmp(item, "asset") == 0) {
+			budget->max_asset_bytes = n;
+		} else if (strcmp(item, "area") == 0) {
+			budget->max_area_bytes = n;
+		} else {
+			fprintf(stderr, "Unknown budget \"%s\".\n", item);
+			ok = false;
+		}
+	}
+	free(copy);
+	return ok;
+}
+
+/*
+ * Record the sizes of a conversion's blocks, as output, and how small
+ * they would be with RLE.
+ */
+void report_add(struct report *report, const char *name, const char *area, const struct conversion *conv, const struct screens *screens, int group)
+{
+	report->assets = realloc(report->assets, (report->n_assets + 1) * sizeof(*report->assets));
+	struct asset_report *asset = &report->assets[report->n_assets++];
+	memset(asset, 0, sizeof(*asset));
+	snprintf(asset->name, sizeof(asset->name), "%s", name ? name : "");
+	snprintf(asset->area, sizeof(asset->area), "%s", area ? area : "");
+	asset->n_tiles = conv->n_tiles;
+	asset->n_palettes = conv->n_palettes;
+	asset->group = group;
+
+	struct block blocks[MAX_BLOCKS];
+	int n_blocks = list_blocks(conv, screens, blocks);
+	for (int i = 0; i < n_blocks; i++) {
+		if (strncmp(blocks[i].label, "TileData", 8) == 0) {
+			asset->tile_bytes += blocks[i].len;
+		} else if (strncmp(blocks[i].label, "Palette", 7) == 0) {
+			asset->palette_bytes += blocks[i].len;
+			continue;
+		} else {
+			asset->map_bytes += blocks[i].len;
+		}
+		struct load_cost cost;
+		estimate_load(blocks[i].data, blocks[i].len, &cost);
+		asset->rle_bytes += cost.rle_size;
+	}
+}
+
+/*
+ * Print an error for each limit an asset or area goes over. Returns
+ * whether everything is within budget.
+ */
+bool check_budgets(const struct report *report, const struct budget *budget)
+{
+	bool ok = true;
+	for (int i = 0; i < report->n_assets; i++) {
+		const struct asset_report *asset = &report->assets[i];
+		const char *name = asset->name[0] ? asset->name : "The image";
+		if (budget->max_tiles && asset->n_tiles > budget->max_tiles) {
+			fprintf(stderr, "Error: %s has %d tiles, over the budget of %d.\n", name, asset->n_tiles, budget->max_tiles);
+			ok = false;
+		}
+		if (budget->max_palettes && asset->n_palettes > budget->max_palettes) {
+			fprintf(stderr, "Error: %s has %d palettes, over the budget of %d.\n", name, asset->n_palettes, budget->max_palettes);
+			ok = false;
+		}
+		if (budget->max_map_bytes && asset->map_bytes > budget->max_map_bytes) {
+			fprintf(stderr, "Error: %s has %zu bytes of maps, over the budget of %zu.\n", name, asset->map_bytes, budget->max_map_bytes);
+			ok = false;
+		}
+		if (budget->max_asset_bytes && asset_bytes(asset) > budget->max_asset_bytes) {
+			fprintf(stderr, "Error: %s is %zu bytes, over the budget of %zu.\n", name, asset_bytes(asset), budget->max_asset_bytes);
+			ok = false;
+		}
+	}
+	struct area_totals *areas = calloc(MAX(report->n_assets, 1), sizeof(*areas));
+	int n_areas = collect_areas(report, areas);
+	for (int a = 0; a < n_areas; a++) {
+		if (budget->max_area_bytes && areas[a].bytes > budget->max_area_bytes) {
+			fprintf(stderr, "Error: Area %s is %zu bytes, over the budget of %zu.\n",
+					areas[a].name, areas[a].bytes, budget->max_area_bytes);
+			ok = false;
+		}
+	}
+	free(areas);
+	return ok;
+}
+
+/*
+ * Write the report as JSON: the budget, then each asset and each area,
+ * with the ROM banks they use if they were packed, and the limits they
+ * go over.
+ */
+bool write_report(const struct report *report, const struct budget *budget, const struct layout *layout, const char *filename)
+{
+	char *buf;
+	size_t len;
+	FILE *fp = open_memstream(&buf, &len);
+	fprintf(fp, "{\n  \"budget\": {\"tiles\": %d, \"palettes\": %d, \"map\": %zu, \"asset\": %zu, \"area\": %zu},\n",
+			budget->max_tiles, budget->max_palettes, budget->max_map_bytes,
+			budget->max_asset_bytes, budget->max_area_bytes);
+
+	fprintf(fp, "  \"assets\": [");
+	for (int i = 0; i < report->n_assets; i++) {
+		const struct asset_report *asset = &report->assets[i];
+		fprintf(fp, "%s\n    {\"name\": \"%s\", \"area\": \"%s\", \"tiles\": %d, \"palettes\": %d, "
+				"\"tile_bytes\": %zu, \"map_bytes\": %zu, \"palette_bytes\": %zu, "
+				"\"bytes\": %zu, \"rle_bytes\": %zu, \"banks\": [",
+				i ? "," : "", asset->name, asset->area, asset->n_tiles, asset->n_palettes,
+				asset->tile_bytes, asset->map_bytes, asset->palette_bytes,
+				asset_bytes(asset), asset->rle_bytes);
+		print_banks(fp, layout, report, NULL, asset->group);
+		fprintf(fp, "], \"over\": [");
+		print_violations(fp, budget, asset, NULL);
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "\n  ],\n");
+
+	struct area_totals *areas = calloc(MAX(report->n_assets, 1), sizeof(*areas));
+	int n_areas = collect_areas(report, areas);
+	fprintf(fp, "  \"areas\": [");
+	for (int a = 0; a < n_areas; a++) {
+		fprintf(fp, "%s\n    {\"name\": \"%s\", \"assets\": %d, \"tiles\": %d, \"bytes\": %zu, \"rle_bytes\": %zu, \"banks\": [",
+				a ? "," : "", areas[a].name, areas[a].n_assets, areas[a].n_tiles,
+				areas[a].bytes, areas[a].rle_bytes);
+		print_banks(fp, layout, report, areas[a].name, -1);
+		fprintf(fp, "], \"over\": [");
+		print_violations(fp, budget, NULL, &areas[a]);
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "\n  ]");
+	if (layout) {
+		fprintf(fp, ",\n  \"banks\": %d", layout->n_banks);
+	}
+	fprintf(fp, "\n}\n");
+	free(areas);
+
+	fclose(fp);
+	bool ok = write_file(filename, (uint8_t *)buf, len);
+	free(buf);
+	return ok;
+}
+
+void report_destroy(struct report *report)
+{
+	free(report->assets);
+	report->assets = NULL;
+	report->n_assets = 0;
+}
+
+size_t asset_bytes(const struct asset_report *asset)
+{
+	return asset->tile_bytes + asset->map_bytes + asset->palette_bytes;
+}
+
+/*
+ * Total the assets of each named area, in order of first appearance.
+ * Returns the number of areas.
+ */
+int collect_areas(const struct report *report, struct area_totals *areas)
+{
+	int n_areas = 0;
+	for (int i = 0; i < report->n_assets; i++) {
+		const struct asset_report *asset = &report->assets[i];
+		if (!asset->area[0]) {
+			continue;
+		}
+		int a = 0;
+		while (a < n_areas && strcmp(areas[a].name, asset->area) != 0) {
+			a++;
+		}
+		if (a == n_areas) {
+			areas[n_areas++].name = asset->area;
+		}
+		areas[a].n_assets++;
+		areas[a].n_tiles += asset->n_tiles;
+		areas[a].bytes += asset_bytes(asset);
+		areas[a].rle_bytes += asset->rle_bytes;
+	}
+	return n_areas;
+}
+
+/*
+ * List the banks holding an asset's group, or every asset of an area,
+ * in ascending order.
+ */
+void print_banks(FILE *fp, const struct layout *layout, const struct report *report, const char *area, int group)
+{
+	if (!layout) {
+		return;
+	}
+	bool first = true;
+	for (int bank = layout->first_bank; bank < layout->first_bank + layout->n_banks; bank++) {
+		bool used = false;
+		for (int i = 0; i < layout->n_items && !used; i++) {
+			const struct layout_item *item = &layout->items[i];
+			if (item->bank != bank) {
+				continue;
+			}
+			if (area) {
+				for (int a = 0; a < report->n_assets && !used; a++) {
+					used = report->assets[a].group == item->group && strcmp(report->assets[a].area, area) == 0;
+				}
+			} else {
+				used = item->group == group;
+			}
+		}
+		if (used) {
+			fprintf(fp, "%s%d", first ? "" : ", ", bank);
+			first = false;
+		}
+	}
+}
+
+/*
+ * Print the limits an asset, or an area, goes over, as a comma-separated
+ * list of JSON strings.
+ */
+void print_violations(FILE *fp, const struct budget *budget, const struct asset_report *asset, const struct area_totals *area)
+{
+	const char *sep = "";
+	if (area) {
+		if (budget->max_area_bytes && area->bytes > budget->max_area_bytes) {
+			fprintf(fp, "\"area\"");
+		}
+		return;
+	}
+	if (budget->max_tiles && asset->n_tiles > budget->max_tiles) {
+		fprintf(fp, "%s\"tiles\"", sep);
+		sep = ", ";
+	}
+	if (budget->max_palettes && asset->n_palettes > budget->max_palettes) {
+		fprintf(fp, "%s\"palettes\"", sep);
+		sep = ", ";
+	}
+	if (budget->max_map_bytes && asset->map_bytes > budget->max_map_bytes) {
+		fprintf(fp, "%s\"map\"", sep);
+		sep = ", ";
+	}
+	if (budget->max_asset_bytes && asset_bytes(asset) > budget->max_asset_bytes) {
+		fprintf(fp, "%s\"asset\"", sep);
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "batch.h"
+#include "convert.h"
+#include "layout.h"
+#include "screen.h"
+
+/*
+ * Limits to check each asset, and each area's assets together, against.
+ * Zero means no limit.
+ */
+struct budget {
+	int max_tiles;
+	int max_palettes;
+	size_t max_map_bytes;
+	size_t max_asset_bytes;
+	size_t max_area_bytes;
+};
+
+/*
+ * The sizes of one converted asset, from the counts the conversion
+ * already has. group is its group in the ROM layout, or -1 if it
+ * wasn't packed.
+ */
+struct asset_report {
+	char name[MAX_REGION_NAME];
+	char area[MAX_REGION_NAME];
+	int n_tiles;
+	int n_palettes;
+	size_t tile_bytes;
+	size_t map_bytes;
+	size_t palette_bytes;
+	size_t rle_bytes;
+	int group;
+};
+
+struct report {
+	struct asset_report *assets;
+	int n_assets;
+};
+
+bool parse_budget(const char *spec, struct budget *budget);
+void report_add(struct report *report, const char *name, const char *area, const struct conversion *conv, const struct screens *screens, int group);
+bool check_budgets(const struct report *report, const struct budget *budget);
+bool write_report(const struct report *report, const struct budget *budget, const struct layout *layout, const char *filename);
+void report_destroy(struct report *report);
+
+#endif /* REPORT_H */
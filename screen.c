@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "screen.h"
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+static uint64_t hash_block(const uint8_t *data, int stride, int width, int height, uint64_t hash);
+static void copy_block(uint8_t *dest, const uint8_t *src, int stride, int width, int height);
+
+/*
+ * Split the map into width x height tile screens, and store each distinct
+ * screen only once. Screens are looked up by a hash of their map and
+ * attribute blocks, so this is linear in the size of the map.
+ */
+bool dedup_screens(const struct conversion *conv, int width, int height, struct screens *screens)
+{
+	memset(screens, 0, sizeof(*screens));
+	if (width <= 0 || height <= 0
+			|| conv->tiles_width % width || conv->tiles_height % height) {
+		fprintf(stderr, "Error: A %dx%d tile image can't be split into %dx%d tile screens.\n",
+				conv->tiles_width, conv->tiles_height, width, height);
+		return false;
+	}
+	screens->width = width;
+	screens->height = height;
+	screens->world_width = conv->tiles_width / width;
+	screens->world_height = conv->tiles_height / height;
+
+	int n_world = screens->world_width * screens->world_height;
+	size_t block_size = (size_t)width * height;
+	int max_screens = n_world < MAX_SCREENS ? n_world : MAX_SCREENS;
+	screens->map = calloc(max_screens, block_size);
+	screens->attributes = calloc(max_screens, block_size);
+	screens->world = calloc(n_world, sizeof(*screens->world));
+
+	/* Open addressing, kept at most half full. */
+	int table_size = 1;
+	while (table_size < 2 * max_screens) {
+		table_size *= 2;
+	}
+	int *table = malloc(table_size * sizeof(*table));
+	uint64_t *hashes = malloc(max_screens * sizeof(*hashes));
+	memset(table, -1, table_size * sizeof(*table));
+
+	for (int sy = 0; sy < screens->world_height; sy++) {
+		for (int sx = 0; sx < screens->world_width; sx++) {
+			size_t offset = (size_t)sy * height * conv->map_width + sx * width;
+			const uint8_t *map = &conv->map[offset];
+			const uint8_t *attributes = &conv->attributes[offset];
+			uint64_t hash = hash_block(map, conv->map_width, width, height, FNV_OFFSET);
+			hash = hash_block(attributes, conv->map_width, width, height, hash);
+
+			int slot = hash & (table_size - 1);
+			int idx = -1;
+			while (table[slot] >= 0) {
+				int i = table[slot];
+				if (hashes[i] == hash) {
+					uint8_t *m = &screens->map[i * block_size];
+					uint8_t *a = &screens->attributes[i * block_size];
+					bool equal = true;
+					for (int y = 0; y < height && equal; y++) {
+						equal = memcmp(&m[y * width], &map[y * conv->map_width], width) == 0
+							&& memcmp(&a[y * width], &attributes[y * conv->map_width], width) == 0;
+					}
+					if (equal) {
+						idx = i;
+						break;
+					}
+				}
+				slot = (slot + 1) & (table_size - 1);
+			}
+			if (idx < 0) {
+				if (screens->n_screens == MAX_SCREENS) {
+					fprintf(stderr, "Error: More than %d unique screens, at screen (%d, %d).\n", MAX_SCREENS, sx, sy);
+					free(table);
+					free(hashes);
+					screens_destroy(screens);
+					return false;
+				}
+				idx = screens->n_screens++;
+				table[slot] = idx;
+				hashes[idx] = hash;
+				copy_block(&screens->map[idx * block_size], map, conv->map_width, width, height);
+				copy_block(&screens->attributes[idx * block_size], attributes, conv->map_width, width, height);
+			}
+			screens->world[sy * screens->world_width + sx] = idx;
+		}
+	}
+	free(table);
+	free(hashes);
+	return true;
+}
+
+void screens_destroy(struct screens *screens)
+{
+	free(screens->map);
+	free(screens->attributes);
+	free(screens->world);
+	screens->map = NULL;
+	screens->attributes = NULL;
+	screens->world = NULL;
+}
+
+uint64_t hash_block(const uint8_t *data, int stride, int width, int height, uint64_t hash)
+{
+	for (int y = 0; y < height; y++) {
+		const uint8_t *row = &data[y * stride];
+		for (int x = 0; x < width; x++) {
+			hash ^= row[x];
+			hash *= FNV_PRIME;
+		}
+	}
+	return hash;
+}
+
+void copy_block(uint8_t *dest, const uint8_t *src, int stride, int width, int height)
+{
+	for (int y = 0; y < height; y++) {
+		memcpy(&dest[y * width], &src[y * stride], width);
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "convert.h"
+
+#define MAX_SCREENS 256
+
+/*
+ * A converted map split into fixed-size screens, with repeated screens
+ * stored once. map and attributes hold each unique screen's block back to
+ * back, and world holds the index of the screen at each position.
+ */
+struct screens {
+	int width;
+	int height;
+	int world_width;
+	int world_height;
+	int n_screens;
+	uint8_t *map;
+	uint8_t *attributes;
+	uint8_t *world;
+};
+
+bool dedup_screens(const struct conversion *conv, int width, int height, struct screens *screens);
+void screens_destroy(struct screens *screens);
+
+#endif /* SCREEN_H */
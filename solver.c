@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "convert.h"
+#include "solver.h"
+
+#define MAX_SOLVER_THREADS 64
+
+/*
+ * A tile's colours as a set of bits, one for each colour of the image's
+ * colour universe. There are at most MAX_UNIQUE_COLOURS of them.
+ */
+struct colour_set {
+	uint32_t mask;
+	uint8_t n;
+};
+
+/* Palettes being packed, as sets of colours. */
+struct packing {
+	uint32_t masks[MAX_PALETTES];
+	int n_palettes;
+	int n_slots;
+};
+
+struct solver_state {
+	uint16_t universe[MAX_UNIQUE_COLOURS];
+	const struct colour_set *sets;
+	int n_sets;
+	int n_colours;
+	struct timespec deadline;
+	atomic_bool done;
+	atomic_uint next_attempt;
+	pthread_mutex_t lock;
+	bool found;
+	struct packing best;
+	unsigned best_attempt;
+};
+
+static int collect_sets(const struct census *census, uint16_t *universe, struct colour_set **sets, int *n_colours);
+static uint32_t tile_mask(const struct census *census, const uint16_t *universe, int n_colours, int t_idx);
+static int cmp_sets(const void *a, const void *b);
+static void *solve_worker(void *data);
+static bool pack(const struct colour_set *sets, const int *order, int n_sets, uint64_t *rng, bool first_fit, struct packing *packing);
+static int missing_colours(uint32_t set, uint32_t palette);
+static bool better(const struct packing *a, const struct packing *b);
+static bool past(const struct timespec *deadline);
+static uint64_t next_random(uint64_t *rng);
+
+/*
+ * Assign palettes by packing the distinct tile colour sets many times
+ * over, in different orders on max_threads threads (or one per core if
+ * zero), until deadline_ms have passed or the packing can't be improved
+ * on. The packing with the fewest palettes, then the fewest colours in
+ * them, then the earliest attempt, wins. The first two attempts take the
+ * largest sets first, best fit and first fit; the rest are shuffled with
+ * a seed fixed by the attempt number, so results only differ between runs
+ * if the deadline is hit.
+ */
+bool solve_palettes(const struct census *census, int deadline_ms, int max_threads, bool quiet, struct conversion *conv)
+{
+	struct solver_state state = {0};
+	struct colour_set *sets;
+	state.n_sets = collect_sets(census, state.universe, &sets, &state.n_colours);
+	state.sets = sets;
+	clock_gettime(CLOCK_MONOTONIC, &state.deadline);
+	state.deadline.tv_sec += deadline_ms / 1000;
+	state.deadline.tv_nsec += (deadline_ms % 1000) * 1000000L;
+	if (state.deadline.tv_nsec >= 1000000000L) {
+		state.deadline.tv_sec++;
+		state.deadline.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_init(&state.lock, NULL);
+
+	long n_threads = max_threads ? max_threads : sysconf(_SC_NPROCESSORS_ONLN);
+	n_threads = n_threads < 1 ? 1 : n_threads > MAX_SOLVER_THREADS ? MAX_SOLVER_THREADS : n_threads;
+	pthread_t threads[MAX_SOLVER_THREADS];
+	int n_started = 0;
+	for (long i = 1; i < n_threads; i++) {
+		if (pthread_create(&threads[n_started], NULL, solve_worker, &state) != 0) {
+			break;
+		}
+		n_started++;
+	}
+	solve_worker(&state);
+	for (int i = 0; i < n_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&state.lock);
+	free(sets);
+
+	if (!state.found) {
+		if (!quiet) {
+			fprintf(stderr, "Error: No way found to fit the tiles' colours in %d palettes.\n", MAX_PALETTES);
+		}
+		return false;
+	}
+
+	conv->n_palettes = state.best.n_palettes;
+	for (int p_idx = 0; p_idx < state.best.n_palettes; p_idx++) {
+		int i = 0;
+		for (int c = 0; c < state.n_colours; c++) {
+			if (state.best.masks[p_idx] & (1u << c)) {
+				conv->palettes[p_idx][2 * i] = state.universe[c] & 0xFFu;
+				conv->palettes[p_idx][2 * i + 1] = state.universe[c] >> 8u;
+				i++;
+			}
+		}
+	}
+	for (int ty = 0; ty < census->tiles_height; ty++) {
+		for (int tx = 0; tx < census->tiles_width; tx++) {
+			int t_idx = ty * census->tiles_width + tx;
+			uint32_t mask = tile_mask(census, state.universe, state.n_colours, t_idx);
+			int p_idx = 0;
+			while (missing_colours(mask, state.best.masks[p_idx])) {
+				p_idx++;
+			}
+			conv->attributes[ty * conv->map_width + tx] = p_idx | census->tile_flags[t_idx];
+		}
+	}
+	for (int p_idx = 0; p_idx < conv->n_palettes; p_idx++) {
+		sort_palette(conv->palettes[p_idx]);
+	}
+	return true;
+}
+
+/*
+ * Number the colours of the census's colour universe in RGB555 order,
+ * then gather the distinct colour sets of the tiles as sets of those,
+ * leaving out any that are contained in another, since whatever palette
+ * holds the larger set holds them too. Returns the number of sets.
+ */
+int collect_sets(const struct census *census, uint16_t *universe, struct colour_set **sets, int *n_colours)
+{
+	int n = 0;
+	for (uint32_t colour = 0; colour < N_GB_COLOURS && n < census->n_colours; colour++) {
+		if (census_has_colour(census, colour)) {
+			universe[n++] = colour;
+		}
+	}
+	*n_colours = n;
+
+	/* Colours that only differ below RGB555 become the same bit. */
+	int n_tiles = census->tiles_width * census->tiles_height;
+	struct colour_set *all = calloc(n_tiles, sizeof(*all));
+	for (int t_idx = 0; t_idx < n_tiles; t_idx++) {
+		all[t_idx].mask = tile_mask(census, universe, n, t_idx);
+		all[t_idx].n = __builtin_popcount(all[t_idx].mask);
+	}
+	qsort(all, n_tiles, sizeof(*all), cmp_sets);
+
+	int n_distinct = 0;
+	for (int i = 0; i < n_tiles; i++) {
+		if (n_distinct == 0 || all[i].mask != all[n_distinct - 1].mask) {
+			all[n_distinct++] = all[i];
+		}
+	}
+	/* Sorted largest first, so a set can only be inside an earlier one. */
+	int n_kept = 0;
+	for (int i = 0; i < n_distinct; i++) {
+		bool contained = false;
+		for (int j = 0; j < n_kept && !contained; j++) {
+			contained = all[j].n > all[i].n && missing_colours(all[i].mask, all[j].mask) == 0;
+		}
+		if (!contained) {
+			all[n_kept++] = all[i];
+		}
+	}
+	*sets = all;
+	return n_kept;
+}
+
+/* The set of a tile's colours, each found in the universe by bisection. */
+uint32_t tile_mask(const struct census *census, const uint16_t *universe, int n_colours, int t_idx)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < census->n_tile_colours[t_idx]; i++) {
+		uint16_t colour = hex_to_gb(census->tile_colours[t_idx][i]);
+		int lo = 0;
+		int hi = n_colours - 1;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (universe[mid] < colour) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		mask |= 1u << lo;
+	}
+	return mask;
+}
+
+/* Largest sets first, then by colour. */
+int cmp_sets(const void *a, const void *b)
+{
+	const struct colour_set *sa = a;
+	const struct colour_set *sb = b;
+	if (sa->n != sb->n) {
+		return sb->n - sa->n;
+	}
+	return (sa->mask > sb->mask) - (sa->mask < sb->mask);
+}
+
+void *solve_worker(void *data)
+{
+	struct solver_state *state = data;
+	int *order = malloc(state->n_sets * sizeof(*order));
+	struct packing packing;
+	int min_palettes = (state->n_colours + 3) / 4;
+	min_palettes = min_palettes < 1 ? 1 : min_palettes;
+
+	while (!atomic_load(&state->done)) {
+		unsigned attempt = atomic_fetch_add(&state->next_attempt, 1);
+		uint64_t rng = 0x9E3779B97F4A7C15ULL * (attempt + 1);
+		for (int i = 0; i < state->n_sets; i++) {
+			order[i] = i;
+		}
+		if (attempt > 1) {
+			for (int i = state->n_sets - 1; i > 0; i--) {
+				int j = next_random(&rng) % (i + 1);
+				int tmp = order[i];
+				order[i] = order[j];
+				order[j] = tmp;
+			}
+		}
+		bool first_fit = attempt % 4 == 1;
+		if (pack(state->sets, order, state->n_sets, attempt > 1 ? &rng : NULL, first_fit, &packing)) {
+			pthread_mutex_lock(&state->lock);
+			/*
+			 * Every earlier attempt was claimed before this one and is
+			 * finished before its thread stops, so preferring the earliest
+			 * of equal packings gives the same result on every run.
+			 */
+			if (!state->found || better(&packing, &state->best)
+					|| (!better(&state->best, &packing) && attempt < state->best_attempt)) {
+				state->best = packing;
+				state->best_attempt = attempt;
+				state->found = true;
+				if (packing.n_palettes <= min_palettes && packing.n_slots <= state->n_colours) {
+					atomic_store(&state->done, true);
+				}
+			}
+			pthread_mutex_unlock(&state->lock);
+		}
+		if (state->n_sets <= 1 || ((attempt & 0xFu) == 0xFu && past(&state->deadline))) {
+			atomic_store(&state->done, true);
+		}
+	}
+	free(order);
+	return NULL;
+}
+
+/*
+ * Pack the sets in the given order, each into the palette that needs the
+ * fewest new colours for it, or the first that has room if first_fit is
+ * set. With rng, ties are broken at random. Fails if more than
+ * MAX_PALETTES palettes are needed.
+ */
+bool pack(const struct colour_set *sets, const int *order, int n_sets, uint64_t *rng, bool first_fit, struct packing *packing)
+{
+	memset(packing, 0, sizeof(*packing));
+	for (int i = 0; i < n_sets; i++) {
+		const struct colour_set *set = &sets[order[i]];
+		int best = -1;
+		int best_missing = 5;
+		int n_ties = 0;
+		for (int p_idx = 0; p_idx < packing->n_palettes; p_idx++) {
+			int missing = missing_colours(set->mask, packing->masks[p_idx]);
+			if (__builtin_popcount(packing->masks[p_idx]) + missing > 4) {
+				continue;
+			}
+			if (missing < best_missing) {
+				best = p_idx;
+				best_missing = missing;
+				n_ties = 1;
+			} else if (missing == best_missing && rng && next_random(rng) % ++n_ties == 0) {
+				best = p_idx;
+			}
+			if (first_fit || missing == 0) {
+				break;
+			}
+		}
+		if (best < 0) {
+			if (packing->n_palettes == MAX_PALETTES) {
+				return false;
+			}
+			best = packing->n_palettes++;
+		}
+		packing->n_slots += missing_colours(set->mask, packing->masks[best]);
+		packing->masks[best] |= set->mask;
+	}
+	return true;
+}
+
+/* How many of the set's colours aren't in the palette. */
+int missing_colours(uint32_t set, uint32_t palette)
+{
+	return __builtin_popcount(set & ~palette);
+}
+
+bool better(const struct packing *a, const struct packing *b)
+{
+	if (a->n_palettes != b->n_palettes) {
+		return a->n_palettes < b->n_palettes;
+	}
+	return a->n_slots < b->n_slots;
+}
+
+bool past(const struct timespec *deadline)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > deadline->tv_sec
+		|| (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/* xorshift64* */
+uint64_t next_random(uint64_t *rng)
+{
+	*rng ^= *rng >> 12u;
+	*rng ^= *rng << 25u;
+	*rng ^= *rng >> 27u;
+	return *rng * 0x2545F4914F6CDD1DULL;
+}
@@ -0,0 +1,11 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <stdbool.h>
+#include "census.h"
+
+struct conversion;
+
+bool solve_palettes(const struct census *census, int deadline_ms, int max_threads, bool quiet, struct conversion *conv);
+
+#endif /* SOLVER_H */
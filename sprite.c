@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sprite.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* OBJ palettes being built, without the transparent colour 0. */
+struct obj_palettes {
+	uint16_t colours[MAX_PALETTES][3];
+	int n[MAX_PALETTES];
+	int n_palettes;
+};
+
+static bool cell_colours(const struct bitmap *sheet, int tx, int ty, uint16_t colours[3], int *n_colours);
+static int obj_palette_for(struct obj_palettes *palettes, const uint16_t *colours, int n_colours);
+static void sort_obj_palette(uint16_t *colours, int n);
+static void encode_cell(const struct bitmap *sheet, int tx, int ty, const uint16_t *colours, int n_colours, uint8_t tile[16]);
+
+/*
+ * Convert the sprite sheets to OBJ tiles and palettes, deduplicating the
+ * tiles against each other and against the BG tiles in VRAM bank 0, with
+ * flips. The BG tiles are then moved into $8800 addressing order, and its
+ * map rewritten to match. Fully transparent pixels, with alpha below
+ * $80, become colour 0.
+ */
+bool convert_sprites(const struct bitmap *sheets, int n_sheets, struct conversion *conv, struct sprites *sprites)
+{
+	memset(sprites, 0, sizeof(*sprites));
+	struct obj_palettes palettes = {0};
+	int n_cells = 0;
+	for (int s = 0; s < n_sheets; s++) {
+		if (sheets[s].width % 8 || sheets[s].height % 8) {
+			fprintf(stderr, "Error: Sprite sheet %d is %ux%u, not a multiple of 8.\n", s, sheets[s].width, sheets[s].height);
+			return false;
+		}
+		struct sprite_sheet *sheet = &sprites->sheets[s];
+		sheet->tiles_width = sheets[s].width / 8;
+		sheet->tiles_height = sheets[s].height / 8;
+		sheet->tiles = calloc((size_t)sheet->tiles_width * sheet->tiles_height, 1);
+		sheet->attributes = calloc((size_t)sheet->tiles_width * sheet->tiles_height, 1);
+		sprites->n_sheets++;
+		n_cells += sheet->tiles_width * sheet->tiles_height;
+	}
+
+	/* Assign every cell a palette first, so they can be sorted. */
+	for (int s = 0; s < n_sheets; s++) {
+		struct sprite_sheet *sheet = &sprites->sheets[s];
+		for (int ty = 0; ty < sheet->tiles_height; ty++) {
+			for (int tx = 0; tx < sheet->tiles_width; tx++) {
+				uint16_t colours[3];
+				int n_colours;
+				if (!cell_colours(&sheets[s], tx, ty, colours, &n_colours)) {
+					fprintf(stderr, "Error: More than 3 colours in sprite sheet %d at tile (%d, %d).\n", s, tx, ty);
+					sprites_destroy(sprites);
+					return false;
+				}
+				int p_idx = obj_palette_for(&palettes, colours, n_colours);
+				if (p_idx < 0) {
+					fprintf(stderr, "Error: More than %d OBJ palettes needed in sprite sheet %d at tile (%d, %d).\n", MAX_PALETTES, s, tx, ty);
+					sprites_destroy(sprites);
+					return false;
+				}
+				sheet->attributes[ty * sheet->tiles_width + tx] = p_idx;
+			}
+		}
+	}
+	sprites->n_palettes = palettes.n_palettes;
+	for (int p_idx = 0; p_idx < palettes.n_palettes; p_idx++) {
+		sort_obj_palette(palettes.colours[p_idx], palettes.n[p_idx]);
+		for (int i = 0; i < palettes.n[p_idx]; i++) {
+			sprites->palettes[p_idx][2 * i + 2] = palettes.colours[p_idx][i] & 0xFFu;
+			sprites->palettes[p_idx][2 * i + 3] = palettes.colours[p_idx][i] >> 8u;
+		}
+	}
+
+	/* Deduplicate the OBJ tiles, recording which each cell uses. */
+	uint8_t *obj_data = malloc(16 * (size_t)n_cells);
+	int *cell_tile = malloc(n_cells * sizeof(*cell_tile));
+	int n_obj = 0;
+	int cell = 0;
+	for (int s = 0; s < n_sheets; s++) {
+		struct sprite_sheet *sheet = &sprites->sheets[s];
+		for (int ty = 0; ty < sheet->tiles_height; ty++) {
+			for (int tx = 0; tx < sheet->tiles_width; tx++) {
+				uint8_t *attr = &sheet->attributes[ty * sheet->tiles_width + tx];
+				uint8_t tile[16];
+				encode_cell(&sheets[s], tx, ty, palettes.colours[*attr], palettes.n[*attr], tile);
+				uint8_t flips;
+				int idx = tile_in_list(tile, obj_data, n_obj, &flips);
+				if (idx < 0) {
+					idx = n_obj++;
+					memcpy(&obj_data[16 * idx], tile, 16);
+					flips = 0;
+				}
+				*attr |= flips;
+				cell_tile[cell++] = idx;
+			}
+		}
+	}
+	sprites->n_obj_tiles = n_obj;
+
+	/*
+	 * Match OBJ tiles with BG tiles. Each BG tile matches at most one,
+	 * since the OBJ tiles are already unique up to flips.
+	 */
+	int n_bg = conv->bank_tiles[0];
+	int *bg_match = malloc(n_bg * sizeof(*bg_match));
+	int *obj_match = malloc(n_obj * sizeof(*obj_match));
+	uint8_t *match_flips = calloc(n_obj, 1);
+	for (int i = 0; i < n_bg; i++) {
+		bg_match[i] = -1;
+	}
+	int n_matched = 0;
+	for (int j = 0; j < n_obj; j++) {
+		obj_match[j] = tile_in_list(&obj_data[16 * j], conv->tile_data, n_bg, &match_flips[j]);
+		if (obj_match[j] >= 0) {
+			bg_match[obj_match[j]] = j;
+			n_matched++;
+		}
+	}
+
+	/*
+	 * Fill each block from its own users first. Whatever doesn't fit
+	 * overflows into the shared block, and matched tiles fill what's
+	 * left of it. Any matches that still don't fit get a copy in each of
+	 * the other blocks.
+	 */
+	int n_bg_only = n_bg - n_matched;
+	int n_obj_only = n_obj - n_matched;
+	int bg_over = MAX(0, n_bg_only - TILES_PER_BLOCK);
+	int obj_over = MAX(0, n_obj_only - TILES_PER_BLOCK);
+	int n_shared = MIN(n_matched, TILES_PER_BLOCK - bg_over - obj_over);
+	int n_copied = n_matched - n_shared;
+	int bg_low = MIN(n_bg_only, TILES_PER_BLOCK);
+	int obj_low = MIN(n_obj_only, TILES_PER_BLOCK);
+	if (bg_over + obj_over > TILES_PER_BLOCK
+			|| bg_low + n_copied > TILES_PER_BLOCK || obj_low + n_copied > TILES_PER_BLOCK) {
+		fprintf(stderr, "Error: %d BG and %d OBJ tiles, %d of them shared, don't fit in VRAM bank 0.\n",
+				n_bg, n_obj, n_matched);
+		free(obj_data);
+		free(cell_tile);
+		free(bg_match);
+		free(obj_match);
+		free(match_flips);
+		sprites_destroy(sprites);
+		return false;
+	}
+
+	int *bg_index = malloc(n_bg * sizeof(*bg_index));
+	int *obj_index = malloc(n_obj * sizeof(*obj_index));
+	for (int j = 0; j < n_obj; j++) {
+		obj_index[j] = -1;
+	}
+	int n_low_bg = 0;
+	int n_low_obj = 0;
+	int n_high = 0;
+	int n_high_bg = 0;
+	for (int i = 0; i < n_bg; i++) {
+		int j = bg_match[i];
+		if (j >= 0 && n_high < n_shared) {
+			bg_index[i] = obj_index[j] = TILES_PER_BLOCK + n_high++;
+		} else if (j >= 0) {
+			/* Copied, so the OBJ tile keeps its own orientation. */
+			bg_index[i] = n_low_bg++;
+			obj_index[j] = n_low_obj++;
+			obj_match[j] = -1;
+		} else if (n_low_bg < TILES_PER_BLOCK) {
+			bg_index[i] = n_low_bg++;
+		} else {
+			bg_index[i] = TILES_PER_BLOCK + n_shared + n_high_bg++;
+		}
+	}
+	int n_high_obj = 0;
+	for (int j = 0; j < n_obj; j++) {
+		if (obj_index[j] >= 0) {
+			continue;
+		}
+		if (n_low_obj < TILES_PER_BLOCK) {
+			obj_index[j] = n_low_obj++;
+		} else {
+			obj_index[j] = TILES_PER_BLOCK + n_shared + n_high_bg + n_high_obj++;
+		}
+	}
+
+	/* Lay out the blocks, $8000 first, so each index is a tile offset. */
+	sprites->block_data = calloc(3 * 16 * TILES_PER_BLOCK, 1);
+	uint8_t *low_bg = &sprites->block_data[2 * 16 * TILES_PER_BLOCK];
+	for (int i = 0; i < n_bg; i++) {
+		uint8_t *dest = bg_index[i] < TILES_PER_BLOCK ? &low_bg[16 * bg_index[i]] : &sprites->block_data[16 * bg_index[i]];
+		memcpy(dest, &conv->tile_data[16 * i], 16);
+	}
+	for (int j = 0; j < n_obj; j++) {
+		if (obj_match[j] < 0) {
+			memcpy(&sprites->block_data[16 * obj_index[j]], &obj_data[16 * j], 16);
+		}
+	}
+	sprites->block_tiles[0] = n_low_obj;
+	sprites->block_tiles[1] = n_high + n_high_bg + n_high_obj;
+	sprites->block_tiles[2] = n_low_bg;
+	sprites->n_shared = n_shared;
+
+	cell = 0;
+	for (int s = 0; s < n_sheets; s++) {
+		struct sprite_sheet *sheet = &sprites->sheets[s];
+		for (int t = 0; t < sheet->tiles_width * sheet->tiles_height; t++) {
+			int j = cell_tile[cell++];
+			sheet->tiles[t] = obj_index[j];
+			if (obj_match[j] >= 0) {
+				sheet->attributes[t] ^= match_flips[j];
+			}
+		}
+	}
+
+	/* Rewrite the BG tiles and map in $8800 order. */
+	memset(conv->tile_data, 0, 16 * TILES_PER_BANK);
+	memcpy(conv->tile_data, low_bg, 16 * TILES_PER_BLOCK);
+	memcpy(&conv->tile_data[16 * TILES_PER_BLOCK], &sprites->block_data[16 * TILES_PER_BLOCK], 16 * TILES_PER_BLOCK);
+	conv->bank_tiles[0] = sprites->block_tiles[1] ? TILES_PER_BLOCK + sprites->block_tiles[1] : sprites->block_tiles[2];
+	for (int ty = 0; ty < conv->tiles_height; ty++) {
+		for (int tx = 0; tx < conv->tiles_width; tx++) {
+			int idx = ty * conv->map_width + tx;
+			if (!(conv->attributes[idx] & ATTR_BANK)) {
+				conv->map[idx] = bg_index[conv->map[idx]];
+			}
+		}
+	}
+
+	free(obj_data);
+	free(cell_tile);
+	free(bg_match);
+	free(obj_match);
+	free(match_flips);
+	free(bg_index);
+	free(obj_index);
+	return true;
+}
+
+void sprites_destroy(struct sprites *sprites)
+{
+	for (int s = 0; s < sprites->n_sheets; s++) {
+		free(sprites->sheets[s].tiles);
+		free(sprites->sheets[s].attributes);
+	}
+	free(sprites->block_data);
+	memset(sprites, 0, sizeof(*sprites));
+}
+
+/*
+ * The distinct RGB555 colours of the opaque pixels in a cell. Fails if
+ * there are more than 3.
+ */
+bool cell_colours(const struct bitmap *sheet, int tx, int ty, uint16_t colours[3], int *n_colours)
+{
+	*n_colours = 0;
+	for (int y = 0; y < 8; y++) {
+		const uint32_t *row = &sheet->data[(size_t)(8 * ty + y) * sheet->stride + 8 * tx];
+		for (int x = 0; x < 8; x++) {
+			if ((row[x] >> 24u) < 0x80u) {
+				continue;
+			}
+			uint16_t colour = hex_to_gb(row[x]);
+			int i = 0;
+			while (i < *n_colours && colours[i] != colour) {
+				i++;
+			}
+			if (i < *n_colours) {
+				continue;
+			}
+			if (*n_colours == 3) {
+				return false;
+			}
+			colours[(*n_colours)++] = colour;
+		}
+	}
+	return true;
+}
+
+/*
+ * The first OBJ palette that has, or has room for, all of the colours,
+ * adding them to it. Returns -1 if none can take them.
+ */
+int obj_palette_for(struct obj_palettes *palettes, const uint16_t *colours, int n_colours)
+{
+	for (int p_idx = 0; p_idx < MAX_PALETTES; p_idx++) {
+		int missing = 0;
+		uint16_t new_colours[3];
+		for (int i = 0; i < n_colours; i++) {
+			bool found = false;
+			for (int k = 0; k < palettes->n[p_idx] && !found; k++) {
+				found = palettes->colours[p_idx][k] == colours[i];
+			}
+			if (!found) {
+				new_colours[missing++] = colours[i];
+			}
+		}
+		if (palettes->n[p_idx] + missing > 3) {
+			continue;
+		}
+		memcpy(&palettes->colours[p_idx][palettes->n[p_idx]], new_colours, missing * sizeof(*new_colours));
+		palettes->n[p_idx] += missing;
+		palettes->n_palettes = MAX(palettes->n_palettes, p_idx + 1);
+		return p_idx;
+	}
+	return -1;
+}
+
+/* Darkest first, as for BG palettes. */
+void sort_obj_palette(uint16_t *colours, int n)
+{
+	for (int i = 1; i < n; i++) {
+		uint16_t colour = colours[i];
+		int sum = (colour & 0x1Fu) + ((colour >> 5u) & 0x1Fu) + ((colour >> 10u) & 0x1Fu);
+		int k = i;
+		while (k > 0) {
+			uint16_t prev = colours[k - 1];
+			int prev_sum = (prev & 0x1Fu) + ((prev >> 5u) & 0x1Fu) + ((prev >> 10u) & 0x1Fu);
+			if (prev_sum <= sum) {
+				break;
+			}
+			colours[k] = prev;
+			k--;
+		}
+		colours[k] = colour;
+	}
+}
+
+/*
+ * Encode a cell as 2bpp with its OBJ palette, where transparent pixels are
+ * colour 0 and the palette's colours are 1 to 3.
+ */
+void encode_cell(const struct bitmap *sheet, int tx, int ty, const uint16_t *colours, int n_colours, uint8_t tile[16])
+{
+	for (int y = 0; y < 8; y++) {
+		const uint32_t *row = &sheet->data[(size_t)(8 * ty + y) * sheet->stride + 8 * tx];
+		uint8_t lower = 0;
+		uint8_t upper = 0;
+		for (int x = 0; x < 8; x++) {
+			int c_idx = 0;
+			if ((row[x] >> 24u) >= 0x80u) {
+				uint16_t colour = hex_to_gb(row[x]);
+				while (c_idx < n_colours && colours[c_idx] != colour) {
+					c_idx++;
+				}
+				c_idx++;
+			}
+			lower = (lower << 1u) | (c_idx & 1u);
+			upper = (upper << 1u) | ((c_idx & 2u) >> 1u);
+		}
+		tile[2 * y] = lower;
+		tile[2 * y + 1] = upper;
+	}
+}
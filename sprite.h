@@ -0,0 +1,57 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "convert.h"
+#include "image.h"
+
+#define MAX_SPRITE_SHEETS 8
+
+/* Tiles in each 2 KiB block of VRAM. */
+#define TILES_PER_BLOCK 128
+
+/* OAM attribute bits, as far as sprite sheets use them. */
+#define OAM_PALETTE 0x07u
+#define OAM_XFLIP 0x20u
+#define OAM_YFLIP 0x40u
+
+/*
+ * The OAM tile index and attributes for each 8x8 cell of a sprite sheet.
+ */
+struct sprite_sheet {
+	int tiles_width;
+	int tiles_height;
+	uint8_t *tiles;
+	uint8_t *attributes;
+};
+
+/*
+ * Sprite sheets converted alongside a background, sharing tiles with it.
+ * The BG uses $8800 addressing, so VRAM bank 0 is split into three
+ * blocks of TILES_PER_BLOCK tiles:
+ *
+ *   $8000  OBJ tiles 0-127, only usable by sprites
+ *   $8800  BG and OBJ tiles 128-255, shared
+ *   $9000  BG tiles 0-127, only usable by the BG
+ *
+ * Tiles used by both go in the shared block once, and everything else
+ * in the block only its user can see where there's room. block_data
+ * holds the three blocks in that order, with block_tiles in use in each.
+ * OBJ palettes have colour 0 transparent, so hold 3 colours each.
+ */
+struct sprites {
+	uint8_t palettes[MAX_PALETTES][8];
+	int n_palettes;
+	struct sprite_sheet sheets[MAX_SPRITE_SHEETS];
+	int n_sheets;
+	uint8_t *block_data;
+	int block_tiles[3];
+	int n_obj_tiles;
+	int n_shared;
+};
+
+bool convert_sprites(const struct bitmap *sheets, int n_sheets, struct conversion *conv, struct sprites *sprites);
+void sprites_destroy(struct sprites *sprites);
+
+#endif /* SPRITE_H */
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "store.h"
+#include "tile.h"
+
+#define MIN_SLOTS 1024
+
+static void grow_slots(struct tile_store *store);
+static void insert(struct tile_store *store, uint32_t idx);
+
+/*
+ * Returns the index of the tile, adding it if it's new. As with
+ * tile_in_list, the flips needed to match the stored tile are written to
+ * flips as attribute bits, and a new tile is stored as given.
+ */
+uint32_t store_add(struct tile_store *store, const uint8_t tile[16], uint8_t *flips)
+{
+	if (2 * (size_t)(store->n_tiles + 1) > store->n_slots) {
+		grow_slots(store);
+	}
+	uint8_t canonical[16];
+	canonical_tile(tile, canonical);
+	size_t mask = store->n_slots - 1;
+	for (size_t slot = hash_tile(canonical) & mask; store->slots[slot]; slot = (slot + 1) & mask) {
+		uint32_t idx = store->slots[slot] - 1;
+		if (tile_in_list(tile, store_tile(store, idx), 1, flips) == 0) {
+			return idx;
+		}
+	}
+
+	uint32_t idx = store->n_tiles;
+	if (idx % STORE_CHUNK_TILES == 0) {
+		size_t n_chunks = idx / STORE_CHUNK_TILES + 1;
+		if ((n_chunks & (n_chunks - 1)) == 0) {
+			store->chunks = realloc(store->chunks, 2 * n_chunks * sizeof(*store->chunks));
+		}
+		store->chunks[n_chunks - 1] = malloc(16 * STORE_CHUNK_TILES);
+		store->n_chunks = n_chunks;
+	}
+	store->n_tiles++;
+	memcpy((uint8_t *)store_tile(store, idx), tile, 16);
+	insert(store, idx);
+	*flips = 0;
+	return idx;
+}
+
+/*
+ * Returns a copy of every stored tile back to back, for output.
+ */
+uint8_t *store_flatten(const struct tile_store *store)
+{
+	uint8_t *data = malloc(16 * (size_t)store->n_tiles + 1);
+	for (size_t i = 0; i < store->n_chunks; i++) {
+		size_t first = i * STORE_CHUNK_TILES;
+		size_t n = store->n_tiles - first < STORE_CHUNK_TILES ? store->n_tiles - first : STORE_CHUNK_TILES;
+		memcpy(&data[16 * first], store->chunks[i], 16 * n);
+	}
+	return data;
+}
+
+void store_destroy(struct tile_store *store)
+{
+	for (size_t i = 0; i < store->n_chunks; i++) {
+		free(store->chunks[i]);
+	}
+	free(store->chunks);
+	free(store->slots);
+	memset(store, 0, sizeof(*store));
+}
+
+/*
+ * Double the hash table, or create it, and reinsert every tile.
+ */
+void grow_slots(struct tile_store *store)
+{
+	free(store->slots);
+	store->n_slots = store->n_slots ? 2 * store->n_slots : MIN_SLOTS;
+	store->slots = calloc(store->n_slots, sizeof(*store->slots));
+	for (uint32_t idx = 0; idx < store->n_tiles; idx++) {
+		insert(store, idx);
+	}
+}
+
+void insert(struct tile_store *store, uint32_t idx)
+{
+	uint8_t canonical[16];
+	canonical_tile(store_tile(store, idx), canonical);
+	size_t mask = store->n_slots - 1;
+	size_t slot = hash_tile(canonical) & mask;
+	while (store->slots[slot]) {
+		slot = (slot + 1) & mask;
+	}
+	store->slots[slot] = idx + 1;
+}
@@ -0,0 +1,33 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STORE_CHUNK_TILES 4096
+
+/*
+ * A growable set of unique tiles for extracting tilesets of any size.
+ * Tiles are kept in fixed-size chunks, so that growing never moves the
+ * tiles already stored, and found through an open addressing hash table
+ * of tile index + 1, or 0 for an empty slot, keyed on the canonical
+ * orientation of each tile so that a tile and its flips share a slot.
+ */
+struct tile_store {
+	uint8_t **chunks;
+	size_t n_chunks;
+	uint32_t n_tiles;
+	uint32_t *slots;
+	size_t n_slots;
+};
+
+uint32_t store_add(struct tile_store *store, const uint8_t tile[16], uint8_t *flips);
+uint8_t *store_flatten(const struct tile_store *store);
+void store_destroy(struct tile_store *store);
+
+static inline const uint8_t *store_tile(const struct tile_store *store, uint32_t idx)
+{
+	return &store->chunks[idx / STORE_CHUNK_TILES][16 * (idx % STORE_CHUNK_TILES)];
+}
+
+#endif /* STORE_H */
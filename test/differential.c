@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+ * Differential test: runs randomised and fuzzed images through both the
+ * frozen reference pipeline and the real one, and reports any divergence
+ * in the palettes, tile data, map or attributes.
+ *
+ * Usage: differential [iterations [seed]]
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../convert.h"
+#include "reference.h"
+
+#define DEFAULT_ITERATIONS 2000
+
+enum kind {
+	KIND_TILED,
+	KIND_FUZZED,
+	KIND_NOISE,
+	KIND_COUNT
+};
+
+static const char *kind_names[KIND_COUNT] = {
+	"tiled",
+	"fuzzed",
+	"noise"
+};
+
+static uint64_t rng_state;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static uint32_t rng_range(uint32_t n)
+{
+	return rng() % n;
+}
+
+static uint32_t random_colour(void)
+{
+	/*
+	 * Occasionally produce fully transparent black, which collides with
+	 * the zero-initialised colour slots in the tile scan.
+	 */
+	if (rng_range(16) == 0) {
+		return 0;
+	}
+	return rng() | 0xFFu;
+}
+
+/*
+ * Build an image out of a small pool of tile patterns and palettes, so
+ * that tile and palette deduplication (including flips) are exercised.
+ */
+static void generate_tiled(struct bitmap *bitmap)
+{
+	uint32_t palettes[12][4];
+	uint8_t patterns[48][64];
+	int n_palettes = 1 + rng_range(12);
+	int n_patterns = 1 + rng_range(48);
+
+	for (int i = 0; i < n_palettes; i++) {
+		for (int j = 0; j < 4; j++) {
+			palettes[i][j] = random_colour();
+		}
+	}
+	for (int i = 0; i < n_patterns; i++) {
+		int n_colours = 1 + rng_range(4);
+		bool symmetric = rng_range(8) == 0;
+		for (int y = 0; y < 8; y++) {
+			for (int x = 0; x < 8; x++) {
+				if (symmetric && x >= 4) {
+					patterns[i][8 * y + x] = patterns[i][8 * y + 7 - x];
+				} else {
+					patterns[i][8 * y + x] = rng_range(n_colours);
+				}
+			}
+		}
+	}
+
+	for (uint32_t ty = 0; ty < bitmap->height / 8; ty++) {
+		for (uint32_t tx = 0; tx < bitmap->width / 8; tx++) {
+			uint32_t *palette = palettes[rng_range(n_palettes)];
+			uint8_t *pattern = patterns[rng_range(n_patterns)];
+			bool hflip = rng_range(4) == 0;
+			bool vflip = rng_range(4) == 0;
+			for (int y = 0; y < 8; y++) {
+				for (int x = 0; x < 8; x++) {
+					int sx = hflip ? 7 - x : x;
+					int sy = vflip ? 7 - y : y;
+					uint32_t idx = (8 * ty + y) * bitmap->width + 8 * tx + x;
+					bitmap->data[idx] = palette[pattern[8 * sy + sx]];
+				}
+			}
+		}
+	}
+}
+
+static void generate_fuzzed(struct bitmap *bitmap)
+{
+	generate_tiled(bitmap);
+	uint32_t n_pixels = bitmap->width * bitmap->height;
+	uint32_t n_mutations = 1 + rng_range(8);
+	for (uint32_t i = 0; i < n_mutations; i++) {
+		uint32_t idx = rng_range(n_pixels);
+		switch (rng_range(3)) {
+			case 0:
+				bitmap->data[idx] = random_colour();
+				break;
+			case 1:
+				bitmap->data[idx] = bitmap->data[rng_range(n_pixels)];
+				break;
+			default:
+				/* Change only the bits that hex_to_gb() discards. */
+				bitmap->data[idx] ^= 0x07070700u >> (8 * rng_range(3));
+				break;
+		}
+	}
+}
+
+static void generate_noise(struct bitmap *bitmap)
+{
+	uint32_t colours[6];
+	int n_colours = 1 + rng_range(6);
+	for (int i = 0; i < n_colours; i++) {
+		colours[i] = random_colour();
+	}
+	for (uint32_t i = 0; i < (uint32_t)bitmap->width * bitmap->height; i++) {
+		bitmap->data[i] = colours[rng_range(n_colours)];
+	}
+}
+
+/*
+ * Lay the real pipeline's output out the same way as the reference,
+ * folding the bank bit back into the tile index.
+ */
+static void flatten(const struct conversion *conv, struct reference *out)
+{
+	memset(out, 0, sizeof(*out));
+	memcpy(out->palettes, conv->palettes, sizeof(out->palettes));
+	out->n_palettes = conv->n_palettes;
+	out->n_tiles = conv->n_tiles;
+	memcpy(out->tile_data, conv->tile_data, 16 * conv->n_tiles);
+	for (int i = 0; i < 32 * 32; i++) {
+		out->map[i] = conv->map[i];
+		out->attributes[i] = conv->attributes[i];
+		if (conv->attributes[i] & ATTR_BANK) {
+			out->map[i] += TILES_PER_BANK;
+			out->attributes[i] &= ~ATTR_BANK;
+		}
+	}
+}
+
+/*
+ * Returns a description of the first divergence, or NULL if none.
+ */
+static const char *compare(const struct reference *a, const struct reference *b)
+{
+	static char msg[128];
+	if (a->n_palettes != b->n_palettes) {
+		snprintf(msg, sizeof(msg), "palette count %d != %d", a->n_palettes, b->n_palettes);
+		return msg;
+	}
+	for (int i = 0; i < a->n_palettes; i++) {
+		if (memcmp(a->palettes[i], b->palettes[i], 8) != 0) {
+			snprintf(msg, sizeof(msg), "palette %d", i);
+			return msg;
+		}
+	}
+	if (a->n_tiles != b->n_tiles) {
+		snprintf(msg, sizeof(msg), "tile count %d != %d", a->n_tiles, b->n_tiles);
+		return msg;
+	}
+	for (int i = 0; i < a->n_tiles; i++) {
+		if (memcmp(&a->tile_data[16 * i], &b->tile_data[16 * i], 16) != 0) {
+			snprintf(msg, sizeof(msg), "tile data %d", i);
+			return msg;
+		}
+	}
+	for (int i = 0; i < 32 * 32; i++) {
+		if (a->map[i] != b->map[i]) {
+			snprintf(msg, sizeof(msg), "map (%d, %d): $%02X != $%02X", i % 32, i / 32, a->map[i], b->map[i]);
+			return msg;
+		}
+		if (a->attributes[i] != b->attributes[i]) {
+			snprintf(msg, sizeof(msg), "attributes (%d, %d): $%02X != $%02X", i % 32, i / 32, a->attributes[i], b->attributes[i]);
+			return msg;
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = DEFAULT_ITERATIONS;
+	uint64_t seed = 1;
+	if (argc > 1) {
+		iterations = strtol(argv[1], NULL, 0);
+	}
+	if (argc > 2) {
+		seed = strtoull(argv[2], NULL, 0);
+	}
+
+	/* Rejected inputs are expected; keep their diagnostics out of the way. */
+	if (!freopen("/dev/null", "w", stderr)) {
+		perror("freopen");
+	}
+
+	struct reference *expected = malloc(sizeof(*expected));
+	struct reference *actual = malloc(sizeof(*actual));
+	struct bitmap bitmap = {
+		.data = malloc(256 * 256 * sizeof(*bitmap.data))
+	};
+	long n_failures = 0;
+	long n_accepted = 0;
+
+	for (long i = 0; i < iterations; i++) {
+		uint64_t case_seed = seed + (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+		rng_state = case_seed | 1;
+		enum kind kind = rng_range(KIND_COUNT);
+		bitmap.width = 8 * (1 + rng_range(32));
+		bitmap.height = 8 * (1 + rng_range(32));
+		bitmap.stride = bitmap.width;
+		switch (kind) {
+			case KIND_TILED:
+				generate_tiled(&bitmap);
+				break;
+			case KIND_FUZZED:
+				generate_fuzzed(&bitmap);
+				break;
+			default:
+				generate_noise(&bitmap);
+				break;
+		}
+
+		struct conversion conv;
+		bool ref_ok = ref_convert(&bitmap, expected);
+		bool ok = convert(&bitmap, NULL, &conv);
+		const char *err = NULL;
+		if (ref_ok != ok) {
+			err = ref_ok ? "rejected by pipeline only" : "rejected by reference only";
+		} else if (ok) {
+			n_accepted++;
+			flatten(&conv, actual);
+			err = compare(expected, actual);
+		}
+		if (ok) {
+			conversion_destroy(&conv);
+		}
+		if (err) {
+			printf("FAIL case %ld (seed 0x%016" PRIX64 ", %s, %ux%u): %s\n",
+					i, case_seed, kind_names[kind],
+					bitmap.width, bitmap.height, err);
+			n_failures++;
+		}
+	}
+
+	printf("%ld cases, %ld accepted, %ld divergent\n", iterations, n_accepted, n_failures);
+	free(bitmap.data);
+	free(expected);
+	free(actual);
+	return n_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+ * Scalar reference implementation of the conversion pipeline, copied from
+ * the original single-file gbctc. Nothing in here should be optimised or
+ * otherwise changed; the differential test relies on it staying put.
+ *
+ * The only deviations are for inputs the original got wrong: a failed
+ * palette lookup is reported as an error, where the original silently
+ * stored palette 7, and data_idx is one bit wider so that running past
+ * 512 tiles can be reported rather than wrapping around.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reference.h"
+
+#define MAX_TILES 1024
+#define MAX_PALETTES 8
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+struct tile {
+	unsigned int data_idx: 10;
+	unsigned int palette_idx: 3;
+	bool hflip: 1;
+	bool vflip: 1;
+};
+
+static void hex_to_palette(uint32_t hex[4], uint8_t palette[8]);
+static int colour_in_palette(uint32_t hex, uint8_t palette[8]);
+static uint16_t hex_to_gb(uint32_t hex);
+static int palette_in_list(uint8_t palette[8], int n_colours, uint8_t list[MAX_PALETTES][8], uint8_t colours_in_palettes[MAX_PALETTES]);
+static void sort_palette(uint8_t palette[8]);
+static struct tile tile_in_list(const uint8_t tile[16], uint8_t list[MAX_TILES * 16], int n_tiles);
+static bool tiles_equal(const uint8_t a[16], const uint8_t b[16]);
+static void flip_tile_horizontal(uint8_t tile[16]);
+static void flip_tile_vertical(uint8_t tile[16]);
+
+bool ref_convert(const struct bitmap *bitmap, struct reference *ref)
+{
+	memset(ref, 0, sizeof(*ref));
+	struct tile *tiles = calloc(MAX_TILES, sizeof(*tiles));
+	uint8_t used_colours_in_palettes[MAX_PALETTES] = {0};
+
+	for (uint8_t ty = 0; ty < bitmap->height / 8; ty++) {
+		for (uint8_t tx = 0; tx < bitmap->width / 8; tx++) {
+			uint32_t base_idx = 8 * ty * bitmap->width + 8 * tx;
+			uint32_t colours[4] = {bitmap->data[base_idx]};
+			int n_colours = 1;
+			for (uint8_t y = 0; y < 8; y++) {
+				for (uint8_t x = 0; x < 8; x++) {
+					uint32_t idx = base_idx + y * bitmap->width + x;
+					uint32_t px = bitmap->data[idx];
+					int c_idx = -1;
+					for (int i = 0; i < 4; i++) {
+						if (px == colours[i]) {
+							c_idx = i;
+							break;
+						}
+					}
+					if (c_idx < 0) {
+						if (n_colours == 4) {
+							free(tiles);
+							return false;
+						}
+						colours[n_colours] = px;
+						n_colours++;
+					}
+				}
+			}
+
+			uint8_t cur_palette[8];
+			hex_to_palette(colours, cur_palette);
+			int p_idx = palette_in_list(cur_palette, n_colours, ref->palettes, used_colours_in_palettes);
+			if (p_idx < 0) {
+				free(tiles);
+				return false;
+			}
+			tiles[32 * ty + tx].palette_idx = p_idx;
+			ref->n_palettes = MAX(ref->n_palettes, p_idx + 1);
+		}
+	}
+	for (int p_idx = 0; p_idx < ref->n_palettes; p_idx++) {
+		sort_palette(ref->palettes[p_idx]);
+	}
+	for (uint8_t ty = 0; ty < bitmap->height / 8; ty++) {
+		for (uint8_t tx = 0; tx < bitmap->width / 8; tx++) {
+			uint32_t base_idx = 8 * ty * bitmap->width + 8 * tx;
+			uint8_t cur_data[16];
+
+			int p_idx = tiles[32 * ty + tx].palette_idx;
+			for (uint8_t y = 0; y < 8; y++) {
+				uint8_t upper = 0;
+				uint8_t lower = 0;
+				for (uint8_t x = 0; x < 8; x++) {
+					uint32_t idx = base_idx + y * bitmap->width + x;
+					uint32_t px = bitmap->data[idx];
+					int c_idx = colour_in_palette(px, ref->palettes[p_idx]);
+					lower <<= 1;
+					upper <<= 1;
+					lower |= c_idx & 1;
+					upper |= (c_idx & 2) >> 1;
+				}
+				cur_data[2 * y] = lower;
+				cur_data[2 * y + 1] = upper;
+			}
+			struct tile t = tile_in_list(cur_data, ref->tile_data, ref->n_tiles);
+			tiles[32 * ty + tx].data_idx = t.data_idx;
+			tiles[32 * ty + tx].hflip = t.hflip;
+			tiles[32 * ty + tx].vflip = t.vflip;
+			ref->n_tiles = MAX(ref->n_tiles, t.data_idx + 1);
+		}
+	}
+	if (ref->n_tiles > 512) {
+		free(tiles);
+		return false;
+	}
+	for (int i = 0; i < 32 * 32; i++) {
+		ref->map[i] = tiles[i].data_idx;
+		ref->attributes[i] = tiles[i].palette_idx;
+		ref->attributes[i] |= tiles[i].hflip << 5;
+		ref->attributes[i] |= tiles[i].vflip << 6;
+	}
+	free(tiles);
+	return true;
+}
+
+static void hex_to_palette(uint32_t hex[4], uint8_t palette[8])
+{
+	for (int c_idx = 0; c_idx < 4; c_idx++) {
+		uint16_t colour = hex_to_gb(hex[c_idx]);
+
+		palette[2 * c_idx] = colour & 0xFFu;
+		palette[2 * c_idx + 1] = (colour >> 8u) & 0xFFu;
+	}
+}
+
+static uint16_t hex_to_gb(uint32_t hex)
+{
+	uint8_t r = (hex >> 3u) & 0x1Fu;
+	uint8_t g = (hex >> 11u) & 0x1Fu;
+	uint8_t b = (hex >> 19u) & 0x1Fu;
+
+	return r | (g << 5u) | (b << 10u);
+}
+
+static int colour_in_palette(uint32_t hex, uint8_t palette[8])
+{
+	uint16_t colour = hex_to_gb(hex);
+	uint8_t lo = colour & 0xFFu;
+	uint8_t hi = colour >> 8u;
+	for (int i = 0; i < 4; i++) {
+		if (lo == palette[2 * i] && hi == palette[2 * i + 1]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int palette_in_list(uint8_t palette[8], int n_colours, uint8_t list[MAX_PALETTES][8], uint8_t colours_in_palettes[MAX_PALETTES])
+{
+	for (int i = 0; i < MAX_PALETTES; i++) {
+		bool palettes_equal = true;
+		for (int j = 0; j < 4 && j < n_colours; j++) {
+			bool found = false;
+			uint8_t c_in_p = colours_in_palettes[i];
+			for (int k = 0; k < 4 && k < c_in_p; k++) {
+				if (palette[2 * j] == list[i][2 * k] && palette[2 * j + 1] == list[i][2 * k + 1]) {
+					found = true;
+				}
+			}
+			if (!found) {
+				if (c_in_p < 4) {
+					list[i][2 * c_in_p] = palette[2 * j];
+					list[i][2 * c_in_p + 1] = palette[2 * j + 1];
+					colours_in_palettes[i]++;
+				} else {
+					palettes_equal = false;
+					break;
+				}
+			}
+		}
+		if (palettes_equal) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	uint32_t sums[2] = {0};
+	uint8_t tmp[4];
+	memcpy(tmp, a, 2);
+	memcpy(tmp + 2, b, 2);
+	for (int i = 0; i < 2; i++) {
+		int r = tmp[2 * i] & 0x1Fu;
+		int g = (tmp[2 * i] & 0x70u) >> 5u;
+		g |= (tmp[2 * i + 1] & 0x03u) << 3u;
+		int b = (tmp[2 * i + 1] & 0x7Cu) >> 2u;
+		sums[i] = r + b + g;
+	}
+	return sums[0] - sums[1];
+}
+
+static void sort_palette(uint8_t palette[8]) {
+	uint16_t tmp[4];
+	memcpy(tmp, palette, sizeof(tmp));
+	qsort(tmp, 4, sizeof(*tmp), cmp);
+	memcpy(palette, tmp, sizeof(tmp));
+}
+
+static struct tile tile_in_list(const uint8_t tile[16], uint8_t list[MAX_TILES * 16], int n_tiles)
+{
+	struct tile ret = {0};
+	uint8_t tmp[16];
+	bool found = false;
+	for (int i = 0; i < n_tiles; i++) {
+		memcpy(tmp, tile, 16);
+		if (tiles_equal(tmp, &list[16 * i])) {
+			ret.data_idx = i;
+			found = true;
+			break;
+		}
+		flip_tile_horizontal(tmp);
+		if (tiles_equal(tmp, &list[16 * i])) {
+			ret.data_idx = i;
+			ret.hflip = true;
+			found = true;
+			break;
+		}
+		flip_tile_horizontal(tmp);
+		flip_tile_vertical(tmp);
+		if (tiles_equal(tmp, &list[16 * i])) {
+			ret.data_idx = i;
+			ret.vflip = true;
+			found = true;
+			break;
+		}
+		flip_tile_horizontal(tmp);
+		if (tiles_equal(tmp, &list[16 * i])) {
+			ret.data_idx = i;
+			ret.hflip = true;
+			ret.vflip = true;
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		memcpy(&list[16 * n_tiles], tile, 16);
+		ret.data_idx = n_tiles;
+	}
+	return ret;
+}
+
+static bool tiles_equal(const uint8_t a[16], const uint8_t b[16])
+{
+	for (int i = 0; i < 16; i++) {
+		if (a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void flip_tile_horizontal(uint8_t tile[16])
+{
+	for (int i = 0; i < 16; i++) {
+		for (int b = 0; b < 4; b++) {
+			uint8_t tmp1 = (tile[i] >> b) & 1u;
+			uint8_t tmp2 = (tile[i] >> (7 - b)) & 1u;
+			tile[i] &= ~(1 << b);
+			tile[i] &= ~(1 << (7 - b));
+			tile[i] |= tmp1 << (7 - b);
+			tile[i] |= tmp2 << b;
+		}
+	}
+}
+
+static void flip_tile_vertical(uint8_t tile[16])
+{
+	uint16_t tmp[8];
+	memcpy(tmp, tile, 16);
+	for (int i = 0; i < 4; i++) {
+		uint16_t t = tmp[i];
+		tmp[i] = tmp[7 - i];
+		tmp[7 - i] = t;
+	}
+	memcpy(tile, tmp, 16);
+}
@@ -0,0 +1,24 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../image.h"
+
+/*
+ * Output of the frozen scalar pipeline, laid out the way the original
+ * text output prints it. Map entries are kept 16 bits wide so that tile
+ * indices above 255 are compared rather than truncated.
+ */
+struct reference {
+	uint8_t palettes[8][8];
+	int n_palettes;
+	uint8_t tile_data[16 * 1024];
+	int n_tiles;
+	uint16_t map[32 * 32];
+	uint8_t attributes[32 * 32];
+};
+
+bool ref_convert(const struct bitmap *bitmap, struct reference *ref);
+
+#endif /* REFERENCE_H */
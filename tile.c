@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "tile.h"
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+/*
+ * Returns the index of the tile in the list, or -1 if it isn't there.
+ * The flips needed to match the stored tile are written to flips as
+ * attribute bits.
+ */
+int tile_in_list(const uint8_t tile[16], const uint8_t *list, int n_tiles, uint8_t *flips)
+{
+	uint8_t tmp[16];
+	for (int i = 0; i < n_tiles; i++) {
+		memcpy(tmp, tile, 16);
+		if (tiles_equal(tmp, &list[16 * i])) {
+			*flips = 0;
+			return i;
+		}
+		flip_tile_horizontal(tmp);
+		if (tiles_equal(tmp, &list[16 * i])) {
+			*flips = ATTR_HFLIP;
+			return i;
+		}
+		flip_tile_horizontal(tmp);
+		flip_tile_vertical(tmp);
+		if (tiles_equal(tmp, &list[16 * i])) {
+			*flips = ATTR_VFLIP;
+			return i;
+		}
+		flip_tile_horizontal(tmp);
+		if (tiles_equal(tmp, &list[16 * i])) {
+			*flips = ATTR_HFLIP | ATTR_VFLIP;
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool tiles_equal(const uint8_t a[16], const uint8_t b[16])
+{
+	for (int i = 0; i < 16; i++) {
+		if (a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void flip_tile_horizontal(uint8_t tile[16])
+{
+	for (int i = 0; i < 16; i++) {
+		for (int b = 0; b < 4; b++) {
+			uint8_t tmp1 = (tile[i] >> b) & 1u;
+			uint8_t tmp2 = (tile[i] >> (7 - b)) & 1u;
+			tile[i] &= ~(1 << b);
+			tile[i] &= ~(1 << (7 - b));
+			tile[i] |= tmp1 << (7 - b);
+			tile[i] |= tmp2 << b;
+		}
+	}
+}
+
+void flip_tile_vertical(uint8_t tile[16])
+{
+	uint16_t tmp[8];
+	memcpy(tmp, tile, 16);
+	for (int i = 0; i < 4; i++) {
+		uint16_t t = tmp[i];
+		tmp[i] = tmp[7 - i];
+		tmp[7 - i] = t;
+	}
+	memcpy(tile, tmp, 16);
+}
+
+/*
+ * The smallest, by memcmp, of the tile and its three flips.
+ */
+void canonical_tile(const uint8_t tile[16], uint8_t canonical[16])
+{
+	uint8_t tmp[16];
+	memcpy(tmp, tile, 16);
+	memcpy(canonical, tile, 16);
+	for (int i = 0; i < 3; i++) {
+		if (i == 1) {
+			flip_tile_vertical(tmp);
+		} else {
+			flip_tile_horizontal(tmp);
+		}
+		if (memcmp(tmp, canonical, 16) < 0) {
+			memcpy(canonical, tmp, 16);
+		}
+	}
+}
+
+/*
+ * The FNV-1a hash of a tile's data.
+ */
+uint64_t hash_tile(const uint8_t tile[16])
+{
+	uint64_t hash = FNV_OFFSET;
+	for (int i = 0; i < 16; i++) {
+		hash ^= tile[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
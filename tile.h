@@ -0,0 +1,25 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TILES_PER_BANK 256
+#define N_BANKS 2
+#define MAX_TILES (N_BANKS * TILES_PER_BANK)
+
+/* BG map attribute bits, as laid out in VRAM bank 1. */
+#define ATTR_PALETTE 0x07u
+#define ATTR_BANK 0x08u
+#define ATTR_HFLIP 0x20u
+#define ATTR_VFLIP 0x40u
+#define ATTR_PRIORITY 0x80u
+
+int tile_in_list(const uint8_t tile[16], const uint8_t *list, int n_tiles, uint8_t *flips);
+bool tiles_equal(const uint8_t a[16], const uint8_t b[16]);
+void flip_tile_horizontal(uint8_t tile[16]);
+void flip_tile_vertical(uint8_t tile[16]);
+void canonical_tile(const uint8_t tile[16], uint8_t canonical[16]);
+uint64_t hash_tile(const uint8_t tile[16]);
+
+#endif /* TILE_H */
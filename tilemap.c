@@ -0,0 +1,640 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "json.h"
+#include "output.h"
+#include "tilemap.h"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Tiled's diagonal flip, which swaps x and y, so has no GBC equivalent. */
+#define TILED_DFLIP 0x20000000u
+
+/* How many tiles wide the bitmap of used tiles is. */
+#define STRIP_TILES 16
+
+static bool load_tmx(const char *filename, const char *text, struct tilemap *tilemap);
+static bool load_tiled_json(const char *filename, const struct json *json, struct tilemap *tilemap);
+static struct tilemap *load_ldtk(const char *filename, const struct json *json, uint32_t columns, int *n_tilemaps);
+static bool check_grid(const char *filename, long long tile_width, long long tile_height);
+static bool init_cells(const char *filename, struct tilemap *tilemap, long long width, long long height);
+static bool set_gid(const char *filename, struct tilemap *tilemap, uint32_t idx, uint32_t gid, uint32_t firstgid);
+static bool read_csv(const char *filename, const char *data, const char *end, uint32_t firstgid, struct tilemap *tilemap);
+static bool read_base64(const char *filename, const char *data, const char *end, const char *compression, uint32_t firstgid, struct tilemap *tilemap);
+static const char *find_tag(const char *xml, const char *name);
+static bool xml_attr(const char *tag, const char *attr, char *value, size_t size);
+static long long xml_int(const char *tag, const char *attr);
+
+/*
+ * Read the tile layers of a Tiled map (TMX or JSON) or of every level of
+ * an LDtk project. The tileset is assumed to be a grid of 8x8 tiles
+ * columns wide, with no margin or spacing.
+ */
+struct tilemap *load_tilemaps(const char *filename, uint32_t columns, int *n_tilemaps)
+{
+	size_t len;
+	uint8_t *data = read_file(filename, &len);
+	if (!data) {
+		return NULL;
+	}
+	char *text = realloc(data, len + 1);
+	text[len] = '\0';
+	const char *start = text;
+	while (isspace((unsigned char)*start)) {
+		start++;
+	}
+
+	struct tilemap *tilemaps = NULL;
+	if (*start == '<') {
+		tilemaps = calloc(1, sizeof(*tilemaps));
+		*n_tilemaps = 1;
+		if (!load_tmx(filename, text, tilemaps)) {
+			tilemaps_destroy(tilemaps, 1);
+			tilemaps = NULL;
+		}
+	} else {
+		struct json json;
+		if (!json_parse(text, len, &json)) {
+			fprintf(stderr, "Couldn't read %s.\n", filename);
+		} else if (json_get(&json, 0, "levels") >= 0) {
+			tilemaps = load_ldtk(filename, &json, columns, n_tilemaps);
+			json_destroy(&json);
+		} else {
+			tilemaps = calloc(1, sizeof(*tilemaps));
+			*n_tilemaps = 1;
+			if (!load_tiled_json(filename, &json, tilemaps)) {
+				tilemaps_destroy(tilemaps, 1);
+				tilemaps = NULL;
+			}
+			json_destroy(&json);
+		}
+	}
+	free(text);
+	return tilemaps;
+}
+
+/*
+ * Cut out the tileset tiles the map uses, in tileset order, into a strip
+ * to be converted in place of the whole world. The first tile stands in
+ * for empty cells. Padding at the end of the strip repeats a used tile,
+ * so it adds nothing to the conversion.
+ */
+bool gather_tiles(struct tilemap *tilemap, const struct bitmap *tileset)
+{
+	uint32_t columns = tileset->width / 8;
+	uint32_t n_tileset = columns * (tileset->height / 8);
+	tilemap->slots = malloc(MAX(n_tileset, 1) * sizeof(*tilemap->slots));
+	memset(tilemap->slots, 0xFF, MAX(n_tileset, 1) * sizeof(*tilemap->slots));
+
+	for (uint32_t i = 0; i < tilemap->width * tilemap->height; i++) {
+		uint32_t id = tilemap->cells[i] == TILEMAP_EMPTY ? 0 : tilemap->cells[i] & TILEMAP_ID;
+		if (id >= n_tileset) {
+			fprintf(stderr, "Error: Tile %u at (%u, %u)%s%s is outside the %u tile tileset.\n",
+					id, i % tilemap->width, i / tilemap->width,
+					tilemap->name[0] ? " in " : "", tilemap->name, n_tileset);
+			return false;
+		}
+		tilemap->slots[id] = 0;
+	}
+
+	uint32_t *used = malloc(n_tileset * sizeof(*used));
+	tilemap->n_used = 0;
+	for (uint32_t id = 0; id < n_tileset; id++) {
+		if (tilemap->slots[id] >= 0) {
+			used[tilemap->n_used] = id;
+			tilemap->slots[id] = tilemap->n_used++;
+		}
+	}
+
+	struct bitmap *tiles = &tilemap->tiles;
+	int rows = (tilemap->n_used + STRIP_TILES - 1) / STRIP_TILES;
+	tiles->width = 8 * STRIP_TILES;
+	tiles->height = 8 * rows;
+	tiles->stride = tiles->width;
+	tiles->data = malloc((size_t)tiles->width * tiles->height * sizeof(*tiles->data));
+	for (int k = 0; k < rows * STRIP_TILES; k++) {
+		uint32_t id = used[k < tilemap->n_used ? k : 0];
+		const uint32_t *src = &tileset->data[(size_t)8 * (id / columns) * tileset->stride + 8 * (id % columns)];
+		uint32_t *dst = &tiles->data[(size_t)8 * (k / STRIP_TILES) * tiles->stride + 8 * (k % STRIP_TILES)];
+		for (int y = 0; y < 8; y++) {
+			memcpy(&dst[y * tiles->stride], &src[y * tileset->stride], 8 * sizeof(*dst));
+		}
+	}
+	free(used);
+	return true;
+}
+
+/*
+ * Replace the map and attributes of the conversion of the used tiles with
+ * the whole world's, looking up each cell's tile and combining the
+ * editor's flips with those the conversion found, and recount the tile
+ * usage to match.
+ */
+void apply_tilemap(const struct tilemap *tilemap, struct conversion *conv)
+{
+	uint8_t *strip_map = conv->map;
+	uint8_t *strip_attributes = conv->attributes;
+	int strip_width = conv->map_width;
+
+	conv->tiles_width = tilemap->width;
+	conv->tiles_height = tilemap->height;
+	conv->map_width = MAX(32, conv->tiles_width);
+	conv->map_height = MAX(32, conv->tiles_height);
+	size_t map_size = (size_t)conv->map_width * conv->map_height;
+	conv->map = calloc(map_size, sizeof(*conv->map));
+	conv->attributes = calloc(map_size, sizeof(*conv->attributes));
+	memset(conv->tile_uses, 0, MAX_TILES * sizeof(*conv->tile_uses));
+	memset(conv->tile_flips, 0, MAX_TILES * sizeof(*conv->tile_flips));
+	memset(conv->tile_palettes, 0, MAX_TILES * sizeof(*conv->tile_palettes));
+
+	for (uint32_t ty = 0; ty < tilemap->height; ty++) {
+		for (uint32_t tx = 0; tx < tilemap->width; tx++) {
+			uint32_t cell = tilemap->cells[ty * tilemap->width + tx];
+			uint32_t k = tilemap->slots[cell == TILEMAP_EMPTY ? 0 : cell & TILEMAP_ID];
+			uint32_t src = (k / STRIP_TILES) * strip_width + k % STRIP_TILES;
+			uint8_t attr = strip_attributes[src];
+			if (cell != TILEMAP_EMPTY) {
+				attr ^= (cell & TILEMAP_HFLIP) ? ATTR_HFLIP : 0;
+				attr ^= (cell & TILEMAP_VFLIP) ? ATTR_VFLIP : 0;
+			}
+			size_t dst = (size_t)ty * conv->map_width + tx;
+			conv->map[dst] = strip_map[src];
+			conv->attributes[dst] = attr;
+
+			int idx = strip_map[src] + ((attr & ATTR_BANK) ? TILES_PER_BANK : 0);
+			conv->tile_uses[idx]++;
+			conv->tile_flips[idx] |= 1u << ((attr & (ATTR_HFLIP | ATTR_VFLIP)) >> 5u);
+			conv->tile_palettes[idx] |= 1u << (attr & ATTR_PALETTE);
+		}
+	}
+	free(strip_map);
+	free(strip_attributes);
+}
+
+/*
+ * Draw the whole world as the editor shows it, straight from the tileset,
+ * for checking a conversion against. Empty cells show the first tile.
+ */
+void draw_tilemap(const struct tilemap *tilemap, const struct bitmap *tileset, struct bitmap *world)
+{
+	uint32_t columns = tileset->width / 8;
+	world->width = 8 * tilemap->width;
+	world->height = 8 * tilemap->height;
+	world->stride = world->width;
+	world->data = malloc((size_t)world->width * world->height * sizeof(*world->data));
+	for (uint32_t ty = 0; ty < tilemap->height; ty++) {
+		for (uint32_t tx = 0; tx < tilemap->width; tx++) {
+			uint32_t cell = tilemap->cells[ty * tilemap->width + tx];
+			if (cell == TILEMAP_EMPTY) {
+				cell = 0;
+			}
+			uint32_t id = cell & TILEMAP_ID;
+			const uint32_t *src = &tileset->data[(size_t)8 * (id / columns) * tileset->stride + 8 * (id % columns)];
+			uint32_t *dst = &world->data[(size_t)8 * ty * world->stride + 8 * tx];
+			for (int y = 0; y < 8; y++) {
+				int sy = (cell & TILEMAP_VFLIP) ? 7 - y : y;
+				for (int x = 0; x < 8; x++) {
+					int sx = (cell & TILEMAP_HFLIP) ? 7 - x : x;
+					dst[y * world->stride + x] = src[sy * tileset->stride + sx];
+				}
+			}
+		}
+	}
+}
+
+void tilemaps_destroy(struct tilemap *tilemaps, int n_tilemaps)
+{
+	for (int i = 0; i < n_tilemaps; i++) {
+		free(tilemaps[i].cells);
+		free(tilemaps[i].tiles.data);
+		free(tilemaps[i].slots);
+	}
+	free(tilemaps);
+}
+
+/*
+ * Read the first tile layer of a TMX map, which must have CSV or Base64
+ * layer data, and a single tileset.
+ */
+bool load_tmx(const char *filename, const char *text, struct tilemap *tilemap)
+{
+	char value[64];
+	const char *map = find_tag(text, "map");
+	if (!map) {
+		fprintf(stderr, "Error: %s has no map.\n", filename);
+		return false;
+	}
+	if (xml_attr(map, "orientation", value, sizeof(value)) && strcmp(value, "orthogonal") != 0) {
+		fprintf(stderr, "Error: %s is %s, not orthogonal.\n", filename, value);
+		return false;
+	}
+	if (xml_attr(map, "infinite", value, sizeof(value)) && strcmp(value, "0") != 0) {
+		fprintf(stderr, "Error: %s is an infinite map.\n", filename);
+		return false;
+	}
+	if (!check_grid(filename, xml_int(map, "tilewidth"), xml_int(map, "tileheight"))) {
+		return false;
+	}
+	const char *tileset = find_tag(map, "tileset");
+	if (!tileset || find_tag(tileset + 1, "tileset")) {
+		fprintf(stderr, "Error: %s must use exactly one tileset.\n", filename);
+		return false;
+	}
+	long long firstgid = xml_int(tileset, "firstgid");
+	if (firstgid <= 0 || firstgid > TILEMAP_ID) {
+		fprintf(stderr, "Error: %s has an invalid tileset.\n", filename);
+		return false;
+	}
+
+	const char *layer = find_tag(map, "layer");
+	if (!layer) {
+		fprintf(stderr, "Error: %s has no tile layers.\n", filename);
+		return false;
+	}
+	if (!init_cells(filename, tilemap, xml_int(layer, "width"), xml_int(layer, "height"))) {
+		return false;
+	}
+	const char *data = find_tag(layer, "data");
+	char encoding[16] = "";
+	char compression[16] = "";
+	if (data) {
+		xml_attr(data, "encoding", encoding, sizeof(encoding));
+		xml_attr(data, "compression", compression, sizeof(compression));
+	}
+	const char *start = data ? strchr(data, '>') : NULL;
+	const char *end = start ? strstr(start, "</data>") : NULL;
+	if (!end) {
+		fprintf(stderr, "Error: %s has no layer data.\n", filename);
+		return false;
+	}
+	if (strcmp(encoding, "csv") == 0) {
+		return read_csv(filename, start + 1, end, firstgid, tilemap);
+	} else if (strcmp(encoding, "base64") == 0) {
+		return read_base64(filename, start + 1, end, compression, firstgid, tilemap);
+	}
+	fprintf(stderr, "Error: %s must store layers as CSV or Base64.\n", filename);
+	return false;
+}
+
+/*
+ * Read the first top-level tile layer of a Tiled JSON map, which must
+ * have a single tileset.
+ */
+bool load_tiled_json(const char *filename, const struct json *json, struct tilemap *tilemap)
+{
+	int orientation = json_get(json, 0, "orientation");
+	if (orientation >= 0 && !json_equals(json, orientation, "orthogonal")) {
+		fprintf(stderr, "Error: %s isn't orthogonal.\n", filename);
+		return false;
+	}
+	if (json_equals(json, json_get(json, 0, "infinite"), "true")) {
+		fprintf(stderr, "Error: %s is an infinite map.\n", filename);
+		return false;
+	}
+	if (!check_grid(filename, json_int(json, json_get(json, 0, "tilewidth")),
+			json_int(json, json_get(json, 0, "tileheight")))) {
+		return false;
+	}
+	int tilesets = json_get(json, 0, "tilesets");
+	if (json_count(json, tilesets) != 1) {
+		fprintf(stderr, "Error: %s must use exactly one tileset.\n", filename);
+		return false;
+	}
+	long long firstgid = json_int(json, json_get(json, tilesets + 1, "firstgid"));
+	if (firstgid <= 0 || firstgid > TILEMAP_ID) {
+		fprintf(stderr, "Error: %s has an invalid tileset.\n", filename);
+		return false;
+	}
+
+	int layers = json_get(json, 0, "layers");
+	int layer = -1;
+	if (json_count(json, layers) > 0) {
+		for (uint32_t i = layers + 1; i < json->tokens[layers].next; i = json->tokens[i].next) {
+			if (json_equals(json, json_get(json, i, "type"), "tilelayer")) {
+				layer = i;
+				break;
+			}
+		}
+	}
+	if (layer < 0) {
+		fprintf(stderr, "Error: %s has no tile layers.\n", filename);
+		return false;
+	}
+	if (!init_cells(filename, tilemap, json_int(json, json_get(json, layer, "width")),
+			json_int(json, json_get(json, layer, "height")))) {
+		return false;
+	}
+
+	int data = json_get(json, layer, "data");
+	if (json_equals(json, json_get(json, layer, "encoding"), "base64")) {
+		char compression[16];
+		json_string(json, json_get(json, layer, "compression"), compression, sizeof(compression));
+		if (data < 0 || json->tokens[data].type != JSON_STRING) {
+			fprintf(stderr, "Error: %s has no layer data.\n", filename);
+			return false;
+		}
+		const char *start = &json->text[json->tokens[data].start];
+		const char *end = &json->text[json->tokens[data].end];
+		return read_base64(filename, start, end, compression, firstgid, tilemap);
+	}
+	uint32_t n = 0;
+	uint32_t n_cells = tilemap->width * tilemap->height;
+	if (json_count(json, data) != (int)n_cells) {
+		fprintf(stderr, "Error: %s doesn't have %ux%u tiles in its layer.\n", filename, tilemap->width, tilemap->height);
+		return false;
+	}
+	for (uint32_t i = data + 1; i < json->tokens[data].next; i = json->tokens[i].next) {
+		long long gid = json_int(json, i);
+		if (gid < 0 || gid > UINT32_MAX || !set_gid(filename, tilemap, n++, gid, firstgid)) {
+			fprintf(stderr, "Error: %s has an invalid tile in its layer.\n", filename);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Read every level of an LDtk project, each from its first layer with
+ * any tiles, whether placed by hand or by rules.
+ */
+struct tilemap *load_ldtk(const char *filename, const struct json *json, uint32_t columns, int *n_tilemaps)
+{
+	if (json_equals(json, json_get(json, 0, "externalLevels"), "true")) {
+		fprintf(stderr, "Error: %s saves levels in separate files.\n", filename);
+		return NULL;
+	}
+	int levels = json_get(json, 0, "levels");
+	int n_levels = json_count(json, levels);
+	if (n_levels <= 0) {
+		fprintf(stderr, "Error: %s has no levels.\n", filename);
+		return NULL;
+	}
+	struct tilemap *tilemaps = calloc(n_levels, sizeof(*tilemaps));
+	*n_tilemaps = n_levels;
+
+	int n = 0;
+	for (uint32_t level = levels + 1; level < json->tokens[levels].next; level = json->tokens[level].next) {
+		struct tilemap *tilemap = &tilemaps[n++];
+		int identifier = json_get(json, level, "identifier");
+		json_string(json, identifier, tilemap->name, sizeof(tilemap->name));
+		bool valid = tilemap->name[0] != '\0';
+		for (const char *c = tilemap->name; *c; c++) {
+			valid = valid && (isalnum((unsigned char)*c) || *c == '_');
+		}
+		if (!valid || json->tokens[identifier].end - json->tokens[identifier].start >= MAX_REGION_NAME) {
+			fprintf(stderr, "Error: Level %d of %s has an invalid identifier.\n", n - 1, filename);
+			tilemaps_destroy(tilemaps, n_levels);
+			return NULL;
+		}
+
+		int layers = json_get(json, level, "layerInstances");
+		int layer = -1;
+		int tiles = -1;
+		if (json_count(json, layers) > 0) {
+			for (uint32_t i = layers + 1; i < json->tokens[layers].next && layer < 0; i = json->tokens[i].next) {
+				tiles = json_get(json, i, "gridTiles");
+				if (json_count(json, tiles) <= 0) {
+					tiles = json_get(json, i, "autoLayerTiles");
+				}
+				if (json_count(json, tiles) > 0) {
+					layer = i;
+				}
+			}
+		}
+		if (layer < 0) {
+			fprintf(stderr, "Error: Level %s of %s has no tiles.\n", tilemap->name, filename);
+			tilemaps_destroy(tilemaps, n_levels);
+			return NULL;
+		}
+		long long grid = json_int(json, json_get(json, layer, "__gridSize"));
+		if (!check_grid(filename, grid, grid)
+				|| !init_cells(filename, tilemap, json_int(json, json_get(json, layer, "__cWid")),
+					json_int(json, json_get(json, layer, "__cHei")))) {
+			tilemaps_destroy(tilemaps, n_levels);
+			return NULL;
+		}
+
+		for (uint32_t i = tiles + 1; i < json->tokens[tiles].next; i = json->tokens[i].next) {
+			int px = json_get(json, i, "px");
+			int src = json_get(json, i, "src");
+			long long flips = json_int(json, json_get(json, i, "f"));
+			long long x = json_count(json, px) == 2 ? json_int(json, px + 1) : -1;
+			long long y = json_count(json, px) == 2 ? json_int(json, json->tokens[px + 1].next) : -1;
+			long long sx = json_count(json, src) == 2 ? json_int(json, src + 1) : -1;
+			long long sy = json_count(json, src) == 2 ? json_int(json, json->tokens[src + 1].next) : -1;
+			if (x < 0 || y < 0 || sx < 0 || sy < 0 || flips < 0 || x % 8 || y % 8 || sx % 8 || sy % 8
+					|| x / 8 >= tilemap->width || y / 8 >= tilemap->height
+					|| (uint64_t)sx / 8 >= columns || sy / 8 > TILEMAP_ID / MAX(columns, 1)) {
+				fprintf(stderr, "Error: Level %s of %s has an invalid tile.\n", tilemap->name, filename);
+				tilemaps_destroy(tilemaps, n_levels);
+				return NULL;
+			}
+			uint32_t cell = (sy / 8) * columns + sx / 8;
+			cell |= (flips & 1) ? TILEMAP_HFLIP : 0;
+			cell |= (flips & 2) ? TILEMAP_VFLIP : 0;
+			tilemap->cells[(y / 8) * tilemap->width + x / 8] = cell;
+		}
+	}
+	return tilemaps;
+}
+
+bool check_grid(const char *filename, long long tile_width, long long tile_height)
+{
+	if (tile_width != 8 || tile_height != 8) {
+		fprintf(stderr, "Error: %s must use 8x8 tiles.\n", filename);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Size the map, with every cell empty, refusing sizes no real map has
+ * before allocating anything.
+ */
+bool init_cells(const char *filename, struct tilemap *tilemap, long long width, long long height)
+{
+	if (width <= 0 || height <= 0 || width > UINT16_MAX || height > UINT16_MAX
+			|| width * height > MAX_TILEMAP_CELLS) {
+		fprintf(stderr, "Error: %s has an invalid size.\n", filename);
+		return false;
+	}
+	tilemap->width = width;
+	tilemap->height = height;
+	tilemap->cells = malloc(width * height * sizeof(*tilemap->cells));
+	memset(tilemap->cells, 0xFF, width * height * sizeof(*tilemap->cells));
+	return true;
+}
+
+/*
+ * Set a cell from a Tiled global tile ID, with its flip flags in the top
+ * bits, where 0 is an empty cell.
+ */
+bool set_gid(const char *filename, struct tilemap *tilemap, uint32_t idx, uint32_t gid, uint32_t firstgid)
+{
+	if (gid == 0) {
+		return true;
+	}
+	uint32_t x = idx % tilemap->width;
+	uint32_t y = idx / tilemap->width;
+	if (gid & TILED_DFLIP) {
+		fprintf(stderr, "Error: Tile (%u, %u) of %s is flipped diagonally, which the GBC can't show.\n", x, y, filename);
+		return false;
+	}
+	uint32_t id = gid & TILEMAP_ID;
+	if (id < firstgid) {
+		fprintf(stderr, "Error: Tile (%u, %u) of %s isn't from the tileset.\n", x, y, filename);
+		return false;
+	}
+	tilemap->cells[idx] = (id - firstgid) | (gid & (TILEMAP_HFLIP | TILEMAP_VFLIP));
+	return true;
+}
+
+bool read_csv(const char *filename, const char *data, const char *end, uint32_t firstgid, struct tilemap *tilemap)
+{
+	uint32_t n_cells = tilemap->width * tilemap->height;
+	uint32_t n = 0;
+	for (const char *p = data; p < end;) {
+		if (isspace((unsigned char)*p) || *p == ',') {
+			p++;
+			continue;
+		}
+		char *next;
+		unsigned long gid = strtoul(p, &next, 10);
+		if (next == p || next > end || n == n_cells) {
+			fprintf(stderr, "Error: %s doesn't have %ux%u tiles in its layer.\n", filename, tilemap->width, tilemap->height);
+			return false;
+		}
+		if (!set_gid(filename, tilemap, n++, gid, firstgid)) {
+			return false;
+		}
+		p = next;
+	}
+	if (n != n_cells) {
+		fprintf(stderr, "Error: %s doesn't have %ux%u tiles in its layer.\n", filename, tilemap->width, tilemap->height);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Decode Base64 layer data, inflating it if compressed with zlib or gzip.
+ * The output is sized for the layer, so inflation stops as soon as the
+ * data would overflow it.
+ */
+bool read_base64(const char *filename, const char *data, const char *end, const char *compression, uint32_t firstgid, struct tilemap *tilemap)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	if (compression[0] && strcmp(compression, "zlib") != 0 && strcmp(compression, "gzip") != 0) {
+		fprintf(stderr, "Error: %s uses %s compression, which isn't supported.\n", filename, compression);
+		return false;
+	}
+
+	uint8_t *raw = malloc(3 * ((end - data) / 4) + 3);
+	size_t raw_len = 0;
+	uint32_t bits = 0;
+	int n_bits = 0;
+	for (const char *p = data; p < end && *p != '='; p++) {
+		if (isspace((unsigned char)*p) || *p == '\\') {
+			continue;
+		}
+		const char *c = *p ? strchr(alphabet, *p) : NULL;
+		if (!c) {
+			fprintf(stderr, "Error: %s has invalid Base64 in its layer.\n", filename);
+			free(raw);
+			return false;
+		}
+		bits = (bits << 6) | (c - alphabet);
+		n_bits += 6;
+		if (n_bits >= 8) {
+			n_bits -= 8;
+			raw[raw_len++] = bits >> n_bits;
+		}
+	}
+
+	size_t n_cells = (size_t)tilemap->width * tilemap->height;
+	uint8_t *gids = raw;
+	size_t len = raw_len;
+	if (compression[0]) {
+		gids = malloc(4 * n_cells);
+		z_stream stream = {
+			.next_in = raw,
+			.avail_in = raw_len,
+			.next_out = gids,
+			.avail_out = 4 * n_cells
+		};
+		bool ok = inflateInit2(&stream, 15 + 32) == Z_OK;
+		ok = ok && inflate(&stream, Z_FINISH) == Z_STREAM_END;
+		len = ok ? stream.total_out : 0;
+		inflateEnd(&stream);
+		free(raw);
+	}
+	bool ok = len == 4 * n_cells;
+	if (!ok) {
+		fprintf(stderr, "Error: %s doesn't have %ux%u tiles in its layer.\n", filename, tilemap->width, tilemap->height);
+	}
+	for (size_t i = 0; ok && i < n_cells; i++) {
+		uint32_t gid = gids[4 * i] | gids[4 * i + 1] << 8 | gids[4 * i + 2] << 16 | (uint32_t)gids[4 * i + 3] << 24;
+		ok = set_gid(filename, tilemap, i, gid, firstgid);
+	}
+	free(gids);
+	return ok;
+}
+
+/*
+ * Returns the start of the first element with the given name, or NULL.
+ * This is only enough XML for what Tiled writes.
+ */
+const char *find_tag(const char *xml, const char *name)
+{
+	size_t len = strlen(name);
+	for (const char *p = strchr(xml, '<'); p; p = strchr(p + 1, '<')) {
+		if (strncmp(p + 1, name, len) == 0 && strchr(" \t\r\n/>", p[len + 1]) && p[len + 1] != '\0') {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+bool xml_attr(const char *tag, const char *attr, char *value, size_t size)
+{
+	size_t len = strlen(attr);
+	const char *end = strchr(tag, '>');
+	for (const char *p = strstr(tag, attr); p && (!end || p < end); p = strstr(p + 1, attr)) {
+		if (!isspace((unsigned char)p[-1]) || p[len] != '=' || (p[len + 1] != '"' && p[len + 1] != '\'')) {
+			continue;
+		}
+		const char *start = &p[len + 2];
+		const char *close = strchr(start, p[len + 1]);
+		if (!close) {
+			return false;
+		}
+		snprintf(value, size, "%.*s", (int)(close - start), start);
+		return true;
+	}
+	return false;
+}
+
+long long xml_int(const char *tag, const char *attr)
+{
+	char value[32];
+	if (!xml_attr(tag, attr, value, sizeof(value))) {
+		return -1;
+	}
+	char *end;
+	long long n = strtoll(value, &end, 10);
+	return (end == value || *end != '\0') ? -1 : n;
+}
@@ -0,0 +1,43 @@
+#ifndef TILEMAP_H
+#define TILEMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "batch.h"
+#include "convert.h"
+#include "image.h"
+
+#define TILEMAP_HFLIP 0x80000000u
+#define TILEMAP_VFLIP 0x40000000u
+#define TILEMAP_ID 0x0FFFFFFFu
+#define TILEMAP_EMPTY UINT32_MAX
+
+/* The most cells a map can have, to bound what a header can ask for. */
+#define MAX_TILEMAP_CELLS (1u << 24)
+
+/*
+ * One tile layer from a map editor, as a grid of tileset tile IDs (row
+ * by row, from the tileset's top left) with TILEMAP_HFLIP and
+ * TILEMAP_VFLIP, or TILEMAP_EMPTY. name is the level's identifier for
+ * LDtk projects, and empty for Tiled maps.
+ *
+ * gather_tiles fills in tiles, a bitmap of just the tileset tiles the map
+ * uses, and slots, the position of each in it or -1.
+ */
+struct tilemap {
+	char name[MAX_REGION_NAME];
+	uint32_t width;
+	uint32_t height;
+	uint32_t *cells;
+	struct bitmap tiles;
+	int32_t *slots;
+	int n_used;
+};
+
+struct tilemap *load_tilemaps(const char *filename, uint32_t columns, int *n_tilemaps);
+bool gather_tiles(struct tilemap *tilemap, const struct bitmap *tileset);
+void apply_tilemap(const struct tilemap *tilemap, struct conversion *conv);
+void draw_tilemap(const struct tilemap *tilemap, const struct bitmap *tileset, struct bitmap *world);
+void tilemaps_destroy(struct tilemap *tilemaps, int n_tilemaps);
+
+#endif /* TILEMAP_H */
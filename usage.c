@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usage.h"
+
+#define HEATMAP_UNIQUE 0xFF4040FFu
+#define HEATMAP_MAX_USES 16
+
+/* A stored tile and its use count, for sorting. */
+struct tile_use {
+	uint32_t uses;
+	int idx;
+};
+
+static int cmp_uses(const void *a, const void *b);
+
+static const char *flip_names[4] = {"-", "h", "v", "hv"};
+
+/*
+ * List every stored tile, most used first, with its bank and index, how
+ * many map cells use it, the flips and the palettes they use it with.
+ */
+void print_usage(FILE *fp, const struct conversion *conv, const char *name)
+{
+	struct tile_use order[MAX_TILES];
+	int n = 0;
+	for (int bank = 0; bank < N_BANKS; bank++) {
+		for (int i = 0; i < conv->bank_tiles[bank]; i++) {
+			int idx = TILES_PER_BANK * bank + i;
+			order[n].uses = conv->tile_uses[idx];
+			order[n++].idx = idx;
+		}
+	}
+	qsort(order, n, sizeof(*order), cmp_uses);
+
+	int n_single = 0;
+	for (int i = 0; i < n; i++) {
+		n_single += order[i].uses == 1;
+	}
+	fprintf(fp, "; %s%s%d tiles, %d used once\n", name ? name : "", name ? ": " : "", n, n_single);
+	fprintf(fp, "; tile  uses  flips     palettes\n");
+	for (int i = 0; i < n; i++) {
+		int idx = order[i].idx;
+		char flips[12] = "";
+		for (int f = 0; f < 4; f++) {
+			if (conv->tile_flips[idx] & (1u << f)) {
+				strcat(flips, flips[0] ? "," : "");
+				strcat(flips, flip_names[f]);
+			}
+		}
+		fprintf(fp, "%d:%-3d %5u  %-8s  ", idx / TILES_PER_BANK, idx % TILES_PER_BANK, order[i].uses, flips);
+		int first = 1;
+		for (int p = 0; p < MAX_PALETTES; p++) {
+			if (conv->tile_palettes[idx] & (1u << p)) {
+				fprintf(fp, "%s%d", first ? "" : ",", p);
+				first = 0;
+			}
+		}
+		fprintf(fp, "\n");
+	}
+}
+
+/*
+ * Paint each map cell of the conversion into the heatmap at (x, y): red
+ * if its tile is used only there, otherwise green, brighter the more
+ * cells share the tile.
+ */
+void paint_heatmap(struct bitmap *heatmap, const struct conversion *conv, int x, int y)
+{
+	for (int ty = 0; ty < conv->tiles_height; ty++) {
+		for (int tx = 0; tx < conv->tiles_width; tx++) {
+			uint8_t attr = conv->attributes[ty * conv->map_width + tx];
+			int idx = conv->map[ty * conv->map_width + tx] + ((attr & ATTR_BANK) ? TILES_PER_BANK : 0);
+			uint32_t uses = conv->tile_uses[idx];
+			uint32_t colour = HEATMAP_UNIQUE;
+			if (uses > 1) {
+				uint32_t clamped = uses < HEATMAP_MAX_USES ? uses : HEATMAP_MAX_USES;
+				uint32_t green = 96 + (159 * clamped) / HEATMAP_MAX_USES;
+				colour = 0xFF000000u | (green << 8u);
+			}
+			for (int py = 0; py < 8; py++) {
+				uint32_t *row = &heatmap->data[(size_t)(y + 8 * ty + py) * heatmap->stride + x + 8 * tx];
+				for (int px = 0; px < 8; px++) {
+					row[px] = colour;
+				}
+			}
+		}
+	}
+}
+
+/* Most used first, then in tile order. */
+int cmp_uses(const void *a, const void *b)
+{
+	const struct tile_use *ua = a;
+	const struct tile_use *ub = b;
+	if (ua->uses != ub->uses) {
+		return ua->uses > ub->uses ? -1 : 1;
+	}
+	return ua->idx - ub->idx;
+}
@@ -0,0 +1,11 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <stdio.h>
+#include "convert.h"
+#include "image.h"
+
+void print_usage(FILE *fp, const struct conversion *conv, const char *name);
+void paint_heatmap(struct bitmap *heatmap, const struct conversion *conv, int x, int y);
+
+#endif /* USAGE_H */